@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
+#include "gz_input.h"
 
 /* Given the names of two files of MPC astrometry on the command
 line,  this determines which objects are in each file,  then figures
@@ -66,14 +67,14 @@ of lines won't affect the final result.  It also means that when we
 eliminate duplicates,  XORing the hashes from them gets us the right
 answer,  just as if the file had been completely sorted. */
 
-static obj_t *find_objects_in_file( FILE *ifile, unsigned *n_found)
+static obj_t *find_objects_in_file( gz_input_t *ifile, unsigned *n_found)
 {
    obj_t *rval = NULL;
    unsigned n = 0, i, j;
    char buff[90];
    const unsigned lookback = 10;
 
-   while( fgets( buff, sizeof( buff), ifile))
+   while( gz_input_gets( buff, sizeof( buff), ifile))
       if( strlen( buff) == 81)
          {
          unsigned loc = n;
@@ -111,7 +112,7 @@ static obj_t *find_objects_in_file( FILE *ifile, unsigned *n_found)
 
 int main( const int argc, const char **argv)
 {
-   FILE *before, *after;
+   gz_input_t *before, *after;
    obj_t *obj_bef, *obj_aft;
    unsigned n_bef, n_aft, i, j;
    bool is_nsd_obs;
@@ -124,17 +125,19 @@ int main( const int argc, const char **argv)
          "have been updated.  (Irrelevancies such as reference changes are\n"
          "ignored.)  The astrometry for objects in the second file that didn't\n"
          "exist in the first,  or were changed,  is output to stdout (or\n"
-         "to the filename specified by a third command line argument.)\n");
+         "to the filename specified by a third command line argument.)\n"
+         "Either input file may be gzipped.\n");
       return( -1);
       }
-   before = fopen( argv[1], "rb");
+   before = gz_input_open( argv[1]);
    assert( before);
    obj_bef = find_objects_in_file( before, &n_bef);
-   fclose( before);
+   gz_input_close( before);
 
-   after = fopen( argv[2], "rb");
+   after = gz_input_open( argv[2]);
    assert( after);
-   obj_aft = find_objects_in_file( before, &n_aft);
+   obj_aft = find_objects_in_file( after, &n_aft);
+   gz_input_close( after);
 
    for( i = j = 0; i < n_aft; i++)
       {
@@ -163,9 +166,10 @@ int main( const int argc, const char **argv)
       int changed_or_new = 0;
 
       assert( ofile);
-      fseek( after, 0L, SEEK_SET);
+      after = gz_input_open( argv[2]);     /* can't rewind a gzipped file */
+      assert( after);
       memset( prev_packed, 0, sizeof( prev_packed));
-      while( fgets( buff, sizeof( buff), after))
+      while( gz_input_gets( buff, sizeof( buff), after))
          {
          if( memcmp( prev_packed, buff, 12))       /* new packed desig */
             {
@@ -181,8 +185,8 @@ int main( const int argc, const char **argv)
             }
          }
       fclose( ofile);
+      gz_input_close( after);
       }
-   fclose( after);
    free( obj_aft);
    return( 0);
 }
@@ -1,5 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include "bc430_store.h"
+#include "bc430_pos.h"
 
 /* Example code to extract elements from BC430.  Following is what
 you ought to get for (980) Anacostia for JD 2459000.5 = 2020 May 31.
@@ -7,7 +13,7 @@ For comparison,  see elems at https://ssd.jpl.nasa.gov/sbdb.cgi?ID=a0000980 .
 
 Compile with
 
-gcc -Wall -Wextra -pedantic -o bc430 bc430.c
+gcc -Wall -Wextra -pedantic -o bc430 bc430.c bc430_store.c bc430_pos.c -lm
 
 BC430 itself is available at
 
@@ -31,6 +37,34 @@ a nearly,  but not entirely,  unordered list... maybe ordered by
 the initial masses before they were re-determined?)  Actual elements
 are very slightly different,  due to improvements between DE405 and
 DE430.
+
+   Reading the text files means skipping up to a few million lines to
+reach a late epoch.  Run once with
+
+./bc430 -c
+
+   to convert them to 'bc430.bin' (see 'bc430_store.c'),  after which
+each lookup is a single read.  If 'bc430.bin' exists,  it's used instead
+of the text files.  For many lookups in one run,  put them in a file,
+one 'asteroid_number JD' pair per line,  and run
+
+./bc430 -b(filename)
+
+   (or '-b-' to read them from stdin).  One line of output is written per
+query :  the asteroid number,  the JD asked for,  the epoch used,  then
+a,  e,  q,  incl,  arg per,  node,  and mean anomaly (angles in degrees).
+'bc430.bin' is made first if it doesn't exist yet.
+
+   The following also use 'bc430.bin',  and the two-body propagation in
+'bc430_pos.c' :
+
+./bc430 -p(JD)    Heliocentric positions of all 300 asteroids at that JD
+./bc430 -e        Error report :  propagates each epoch to the next one and
+                  to the midpoint,  and compares to propagation from the
+                  next epoch,  giving RMS and worst-case errors
+./bc430 -t[n]     Benchmark :  positions of all 300 at n (default 100000)
+                  random times,  at nearby times,  and at repeated times,
+                  plus a check against a plain scalar propagation
 */
 
 #define N_ASTEROIDS 300
@@ -39,33 +73,409 @@ DE430.
 #define JD_STEP      40
 #define PI 3.1415926535897932384626433832795028841971693993751058209749445923
 
+#define STORE_FILENAME "bc430.bin"
+
 static void err_exit( void)
 {
    fprintf( stderr, "'bc430' takes the asteroid number and desired epoch as\n"
                     "command line arguments,  and outputs the elements.\n"
                     "Example usage (for (449) Hamburga,  JD 2451545) :\n"
-                    "\n./bc430 449 2451545\n");
+                    "\n./bc430 449 2451545\n"
+                    "\n'./bc430 -c' converts the text files to '" STORE_FILENAME "';\n"
+                    "'./bc430 -b(filename)' answers a list of (number, JD) queries.\n"
+                    "'./bc430 -p(JD)' gives positions of all 300 asteroids;\n"
+                    "'./bc430 -e' and '-t' give error and speed reports.\n");
    exit( -1);
 }
 
+static bc430_store_t *open_store( const bool convert_if_missing)
+{
+   bc430_store_t *store = bc430_open( STORE_FILENAME);
+
+   if( !store && convert_if_missing)
+      {
+      const int err = bc430_convert( "asteroid_indices.txt",
+                             "asteroid_ephemeris.txt", STORE_FILENAME);
+
+      if( err)
+         {
+         fprintf( stderr, "Couldn't make '%s' : %s\n", STORE_FILENAME,
+                  (err == -1 ? "BC430 text files not found" :
+                   err == -2 ? "BC430 text files incomplete" :
+                               "write error"));
+         exit( -1);
+         }
+      store = bc430_open( STORE_FILENAME);
+      }
+   return( store);
+}
+
+/* Shows a double with as few digits as will reproduce it,  which gives
+the same text as in 'asteroid_ephemeris.txt'.   */
+
+static void show_double( const char *label, const double ival)
+{
+   char buff[40];
+   int precision = 1;
+
+   do
+      snprintf( buff, sizeof( buff), "%.*g", precision++, ival);
+   while( precision <= 17 && atof( buff) != ival);
+   printf( "%s %s\n", label, buff);
+}
+
+static int show_stored_elements( const bc430_store_t *store, const int idx,
+                                 const long epoch_idx)
+{
+   double elems[6];
+
+   if( bc430_get_elements( store, idx, epoch_idx, elems))
+      return( -1);
+   printf( "Epoch = JD %.0f\n", bc430_epoch_jd( epoch_idx));
+   show_double( "Semimajor axis (AU)", elems[BC430_A]);
+   show_double( "Eccentricity", elems[BC430_ECC]);
+   printf( "Perihelion dist (AU) %.8f\n", elems[BC430_A] * (1. - elems[BC430_ECC]));
+   printf( "Incl (deg)      %12.8f\n", elems[BC430_INCL] * 180. / PI);
+   printf( "Arg per (deg)   %12.8f\n", elems[BC430_ARG_PER] * 180. / PI);
+   printf( "Asc node (deg)  %12.8f\n", elems[BC430_ASC_NODE] * 180. / PI);
+   printf( "Mean anom (deg) %12.8f\n", elems[BC430_MEAN_ANOM] * 180. / PI);
+   return( 0);
+}
+
+/* Answers one query per input line.  Queries for asteroids not in
+BC430,  or for times it doesn't cover,  get an error line (and the run
+continues).   */
+
+static int run_batch( const char *filename)
+{
+   FILE *ifile = (strcmp( filename, "-") ? fopen( filename, "rb") : stdin);
+   bc430_store_t *store;
+   char buff[200];
+   long n_queries = 0, n_failed = 0;
+
+   if( !ifile)
+      {
+      fprintf( stderr, "Couldn't open '%s'\n", filename);
+      return( -1);
+      }
+   store = open_store( true);
+   if( !store)
+      {
+      fprintf( stderr, "Couldn't open '%s'\n", STORE_FILENAME);
+      return( -1);
+      }
+   while( fgets( buff, sizeof( buff), ifile))
+      {
+      long number;
+      double jd, elems[6];
+      int idx;
+      long epoch_idx;
+
+      if( sscanf( buff, "%ld %lf", &number, &jd) != 2)
+         continue;
+      n_queries++;
+      idx = bc430_asteroid_index( store, number);
+      epoch_idx = bc430_epoch_index( jd);
+      if( idx < 0 || epoch_idx < 0
+                || bc430_get_elements( store, idx, epoch_idx, elems))
+         {
+         printf( "%6ld %10.2f  %s\n", number, jd,
+                (idx < 0 ? "not in BC430" : "outside BC430's time span"));
+         n_failed++;
+         continue;
+         }
+      printf( "%6ld %10.2f %8.0f %.16f %.14f %.8f %12.8f %12.8f %12.8f %12.8f\n",
+               number, jd, bc430_epoch_jd( epoch_idx),
+               elems[BC430_A], elems[BC430_ECC],
+               elems[BC430_A] * (1. - elems[BC430_ECC]),
+               elems[BC430_INCL] * 180. / PI, elems[BC430_ARG_PER] * 180. / PI,
+               elems[BC430_ASC_NODE] * 180. / PI, elems[BC430_MEAN_ANOM] * 180. / PI);
+      }
+   if( ifile != stdin)
+      fclose( ifile);
+   bc430_close( store);
+   fprintf( stderr, "%ld queries;  %ld failed\n", n_queries, n_failed);
+   return( 0);
+}
+
+/* Straightforward one-asteroid-at-a-time two-body propagation,  as a
+check on (and for speed comparison with) bc430_pos.c.   */
+
+static void reference_position( const double *elems, const double dt,
+                                double *xyz)
+{
+   const double a = elems[BC430_A], ecc = elems[BC430_ECC];
+   const double mean_anom = elems[BC430_MEAN_ANOM]
+                           + dt * .01720209895 / (a * sqrt( a));
+   const double incl = elems[BC430_INCL], node = elems[BC430_ASC_NODE];
+   const double omega = elems[BC430_ARG_PER];
+   double ecc_anom = mean_anom, delta, x, y;
+   int iter = 0;
+
+   do
+      {
+      delta = (ecc_anom - ecc * sin( ecc_anom) - mean_anom)
+                     / (1. - ecc * cos( ecc_anom));
+      ecc_anom -= delta;
+      }
+      while( fabs( delta) > 1e-12 && iter++ < 30);
+   x = a * (cos( ecc_anom) - ecc);
+   y = a * sqrt( 1. - ecc * ecc) * sin( ecc_anom);
+   xyz[0] = x * (cos( omega) * cos( node) - sin( omega) * sin( node) * cos( incl))
+          - y * (sin( omega) * cos( node) + cos( omega) * sin( node) * cos( incl));
+   xyz[1] = x * (cos( omega) * sin( node) + sin( omega) * cos( node) * cos( incl))
+          - y * (sin( omega) * sin( node) - cos( omega) * cos( node) * cos( incl));
+   xyz[2] = (x * sin( omega) + y * cos( omega)) * sin( incl);
+}
+
+static bc430_store_t *open_store_or_exit( void)
+{
+   bc430_store_t *store = open_store( true);
+
+   if( !store)
+      {
+      fprintf( stderr, "Couldn't open '%s'\n", STORE_FILENAME);
+      exit( -1);
+      }
+   return( store);
+}
+
+static int show_positions( const double jd)
+{
+   bc430_store_t *store = open_store_or_exit( );
+   bc430_pos_t *pos = bc430_pos_init( store, 1);
+   const double *xyz = bc430_positions( pos, jd);
+   int i;
+
+   if( !xyz)
+      {
+      fprintf( stderr, "JD %f is outside BC430's time span\n", jd);
+      return( -1);
+      }
+   printf( "Heliocentric ecliptic J2000 positions (AU) at JD %f\n", jd);
+   for( i = 0; i < N_ASTEROIDS; i++)
+      printf( "%6ld %18.14f %18.14f %18.14f\n", bc430_asteroid_number( store, i),
+               xyz[i * 3], xyz[i * 3 + 1], xyz[i * 3 + 2]);
+   bc430_pos_free( pos);
+   bc430_close( store);
+   return( 0);
+}
+
+#define AU_IN_KM 1.495978707e+8
+
+typedef struct
+{
+   double sum_sq, max_err;
+   long n, worst_number, worst_epoch;
+} err_stats_t;
+
+static void add_errors( err_stats_t *stats, const double *xyz1,
+            const double *xyz2, const bc430_store_t *store, const long epoch_jd)
+{
+   int i;
+
+   for( i = 0; i < N_ASTEROIDS; i++, xyz1 += 3, xyz2 += 3)
+      {
+      const double dx = xyz1[0] - xyz2[0], dy = xyz1[1] - xyz2[1];
+      const double dz = xyz1[2] - xyz2[2];
+      const double err2 = dx * dx + dy * dy + dz * dz;
+
+      stats->sum_sq += err2;
+      stats->n++;
+      if( stats->max_err < sqrt( err2))
+         {
+         stats->max_err = sqrt( err2);
+         stats->worst_number = bc430_asteroid_number( store, i);
+         stats->worst_epoch = epoch_jd;
+         }
+      }
+}
+
+static void show_errors( const char *title, const err_stats_t *stats)
+{
+   printf( "%s\n   RMS %.3f km;  worst %.3f km,  for (%ld) from JD %ld\n",
+            title, sqrt( stats->sum_sq / (double)stats->n) * AU_IN_KM,
+            stats->max_err * AU_IN_KM, stats->worst_number, stats->worst_epoch);
+}
+
+/* Two-body propagation ignores the perturbations that change the
+osculating elements from one epoch to the next.  The 40-day comparison
+(propagating an epoch to the next one,  and comparing to that epoch's
+elements) is a worst case;  bc430_positions() is never more than 20 days
+from an epoch,  and the midpoint comparison shows how far apart the two
+neighbouring epochs' propagations are at the worst possible time.  */
+
+static int error_report( void)
+{
+   bc430_store_t *store = open_store_or_exit( );
+   bc430_pos_t *pos = bc430_pos_init( store, 1);
+   double *xyz = (double *)malloc( N_ASTEROIDS * 3 * sizeof( double));
+   err_stats_t full_step, midpoint;
+   long epoch;
+
+   memset( &full_step, 0, sizeof( err_stats_t));
+   memset( &midpoint, 0, sizeof( err_stats_t));
+   for( epoch = 0; epoch < BC430_N_EPOCHS - 1; epoch++)
+      {
+      const double jd = bc430_epoch_jd( epoch);
+
+      memcpy( xyz, bc430_positions_from_epoch( pos, epoch, jd + JD_STEP),
+                                 N_ASTEROIDS * 3 * sizeof( double));
+      add_errors( &full_step, xyz,
+                  bc430_positions_from_epoch( pos, epoch + 1, jd + JD_STEP),
+                  store, (long)jd);
+      memcpy( xyz, bc430_positions_from_epoch( pos, epoch, jd + JD_STEP / 2),
+                                 N_ASTEROIDS * 3 * sizeof( double));
+      add_errors( &midpoint, xyz,
+                  bc430_positions_from_epoch( pos, epoch + 1, jd + JD_STEP / 2),
+                  store, (long)jd);
+      }
+   show_errors( "Propagated 40 days,  vs. the next epoch :", &full_step);
+   show_errors( "Propagated 20 days from adjacent epochs,  vs. each other :",
+                                       &midpoint);
+   free( xyz);
+   bc430_pos_free( pos);
+   bc430_close( store);
+   return( 0);
+}
+
+static double time_calls( bc430_pos_t *pos, const double *jds, const long n)
+{
+   const clock_t t0 = clock( );
+   long i;
+
+   for( i = 0; i < n; i++)
+      bc430_positions( pos, jds[i]);
+   return( (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC);
+}
+
+static void show_rate( const char *title, const long n, const double seconds)
+{
+   printf( "%-30s %8ld times in %7.3f s:  %9.0f times/s (%.3g positions/s)\n",
+            title, n, seconds, (double)n / seconds,
+            (double)n * N_ASTEROIDS / seconds);
+}
+
+static int benchmark( const long n)
+{
+   bc430_store_t *store = open_store_or_exit( );
+   bc430_pos_t *pos = bc430_pos_init( store, 8);
+   double *jds = (double *)malloc( n * sizeof( double)), max_diff = 0.;
+   const double span = (double)( END_JD - START_JD);
+   double seconds, xyz[3];
+   const double *elems;
+   clock_t t0;
+   long i, j, n_computed, n_hits;
+
+   srand( 1);
+   for( i = 0; i < n; i++)
+      jds[i] = START_JD + span * (double)rand( ) / (double)RAND_MAX;
+   show_rate( "Random times", n, time_calls( pos, jds, n));
+   for( i = 0; i < n; i++)          /* spread over two days */
+      jds[i] = 2451545. + 2. * (double)i / (double)n;
+   show_rate( "Nearby times", n, time_calls( pos, jds, n));
+   for( i = 0; i < n; i++)          /* cycling over four times */
+      jds[i] = 2451545. + (double)( i % 4);
+   show_rate( "Repeated times", n, time_calls( pos, jds, n));
+   bc430_pos_counts( pos, &n_computed, &n_hits);
+   printf( "%ld computed,  %ld from cache\n", n_computed, n_hits);
+
+   for( i = 0; i < n; i++)
+      jds[i] = START_JD + span * (double)rand( ) / (double)RAND_MAX;
+   t0 = clock( );
+   for( i = 0; i < n / 10; i++)
+      {
+      const long epoch = bc430_epoch_index( jds[i] + .5);
+
+      elems = bc430_epoch_elements( store, epoch);
+      for( j = 0; j < N_ASTEROIDS; j++)
+         reference_position( elems + j * 6, jds[i] - bc430_epoch_jd( epoch), xyz);
+      }
+   seconds = (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC;
+   show_rate( "Scalar reference", n / 10, seconds);
+   for( i = 0; i < n / 100; i++)
+      {
+      const long epoch = bc430_epoch_index( jds[i] + .5);
+      const double *pos_xyz = bc430_positions_from_epoch( pos, epoch, jds[i]);
+
+      elems = bc430_epoch_elements( store, epoch);
+      for( j = 0; j < N_ASTEROIDS; j++, pos_xyz += 3)
+         {
+         reference_position( elems + j * 6, jds[i] - bc430_epoch_jd( epoch), xyz);
+         max_diff = fmax( max_diff, fabs( xyz[0] - pos_xyz[0]));
+         max_diff = fmax( max_diff, fabs( xyz[1] - pos_xyz[1]));
+         max_diff = fmax( max_diff, fabs( xyz[2] - pos_xyz[2]));
+         }
+      }
+   printf( "Largest difference from scalar reference : %.3g AU (%.3g mm)\n",
+            max_diff, max_diff * AU_IN_KM * 1e+6);
+   free( jds);
+   bc430_pos_free( pos);
+   bc430_close( store);
+   return( 0);
+}
+
 int main( const int argc, const char **argv)
 {
    long epoch, idx = -1, line_no = 0, obj_number;
    char buff[300];
-   FILE *ifile = fopen( "asteroid_indices.txt", "rb");
+   FILE *ifile;
+   bc430_store_t *store;
    double a, ecc;
 
-   if( !ifile)
+   if( argc > 1 && !strcmp( argv[1], "-c"))
       {
-      fprintf( stderr, "Couldn't open 'asteroid_indices.txt'\n");
-      err_exit( );
+      store = open_store( true);
+      if( !store)
+         return( -1);
+      bc430_close( store);
+      printf( "'%s' is ready\n", STORE_FILENAME);
+      return( 0);
       }
+   if( argc > 1 && argv[1][0] == '-' && argv[1][1] == 'b')
+      return( run_batch( argv[1][2] ? argv[1] + 2 : "-"));
+   if( argc > 1 && argv[1][0] == '-' && argv[1][1] == 'p')
+      return( show_positions( atof( argv[1] + 2)));
+   if( argc > 1 && !strcmp( argv[1], "-e"))
+      return( error_report( ));
+   if( argc > 1 && argv[1][0] == '-' && argv[1][1] == 't')
+      return( benchmark( argv[1][2] ? atol( argv[1] + 2) : 100000L));
    if( argc < 3)
       {
       fprintf( stderr, "Need object number and epoch on command line\n");
       err_exit( );
       }
    obj_number = atol( argv[1]);
+   store = open_store( false);
+   if( store)
+      {
+      const int store_idx = bc430_asteroid_index( store, obj_number);
+      const long epoch_idx = bc430_epoch_index( atof( argv[2]));
+      int rval;
+
+      if( store_idx < 0)
+         {
+         fprintf( stderr, "'%s' is not a valid object index\n", argv[1]);
+         fprintf( stderr, "(Valid asteroid numbers are listed in 'asteroid_indices.txt')\n");
+         err_exit( );
+         }
+      if( epoch_idx < 0)
+         {
+         fprintf( stderr, "'%s' is not a valid epoch\n", argv[2]);
+         fprintf( stderr, "(BC430 covers JD %d to %d)\n",
+                        START_JD, END_JD);
+         err_exit( );
+         }
+      rval = show_stored_elements( store, store_idx, epoch_idx);
+      bc430_close( store);
+      return( rval);
+      }
+   ifile = fopen( "asteroid_indices.txt", "rb");
+   if( !ifile)
+      {
+      fprintf( stderr, "Couldn't open 'asteroid_indices.txt'\n");
+      err_exit( );
+      }
    while( idx == -1 && fgets( buff, sizeof( buff), ifile))
       {
       if( obj_number == atol( buff))
@@ -0,0 +1,376 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bc430_store.h"
+#include "bc430_pos.h"
+
+/* For perturbation work,  we want positions of all 300 BC430 asteroids
+at many times.  bc430_positions() gets them for any JD within BC430's
+span,  in AU in the frame of the BC430 elements (ecliptic J2000),  by
+propagating the osculating elements of the nearest epoch (never more
+than 20 days away) as a two-body orbit.  That's good to the extent the
+asteroid's perturbations over 20 days are small;  'bc430 -e' reports how
+good,  by comparing propagations from adjacent epochs to their midpoint.
+
+   Most of the work (finding the orientation vectors,  and solving
+Kepler's equation at the epoch) depends only on the epoch.  That's done
+once per epoch,  and the last few epochs are kept.  For a time 'dt'
+from the epoch,  we then solve for the change 'd' in the eccentric
+anomaly from its value E0 at the epoch :
+
+d - e * (sin( E0) * (cos( d) - 1) + cos( E0) * sin( d)) = n * dt
+
+   with |d| small,  so sin( d) and cos( d) - 1 are short polynomials.
+Everything is kept as arrays (one element per asteroid),  and the loops
+over them have no calls or branches,  so the compiler vectorizes them.
+Newton's method is run over all 300 at once until every one has
+converged.  The per-epoch setup works the same way,  using the
+vectorizable sin_cos() below rather than sin() and cos().
+
+   Finally,  the last 'n_cached_times' results are kept,  so asking for
+the same time again (common when integrating with step rejection) just
+returns the stored positions.  The returned pointer is to 300 * 3
+doubles (x, y, z for each asteroid,  in index order),  and is valid
+until the next call.    */
+
+#define N_AST           BC430_N_ASTEROIDS
+#define N_EPOCH_CACHE   4
+#define GAUSS_K         .01720209895
+#define MAX_POLY_D      .8
+#define MAX_ITERATIONS  10
+#define PI 3.1415926535897932384626433832795028841971693993751058209749445923
+
+            /* Newton's method converges quadratically,  so once a step */
+            /* is below 1e-12,  the result after it is good to an ulp.  */
+#define CONVERGED       1e-12
+
+            /* Baseline x86-64 (SSE2) can't vectorize the convergence */
+            /* counts;  AVX2 can,  so on x86-64 Linux make both versions */
+#if defined( __GNUC__) && defined( __x86_64__) && defined( __linux__)
+   #define SIMD_CLONES __attribute__((target_clones( "avx2", "default")))
+#else
+   #define SIMD_CLONES
+#endif
+
+typedef struct
+{
+   long epoch_idx, last_used;
+   double a[N_AST], ecc[N_AST], b[N_AST], n[N_AST];
+   double sin_e0[N_AST], cos_e0[N_AST];
+   double px[N_AST], py[N_AST], pz[N_AST];
+   double qx[N_AST], qy[N_AST], qz[N_AST];
+} epoch_setup_t;
+
+typedef struct
+{
+   double jd;
+   long last_used;
+   double *xyz;
+} cached_time_t;
+
+struct bc430_pos
+{
+   const bc430_store_t *store;
+   epoch_setup_t *setups;
+   cached_time_t *times;
+   int n_cached_times;
+   long n_calls, n_computed, n_cache_hits;
+   double d[N_AST], sin_d[N_AST], cos_d_minus_1[N_AST];
+   double scratch[N_AST * 3];
+};
+
+/* sin( x) and cos( x) - 1 by Taylor series;  with |x| < .8,  the first
+omitted terms are below 1e-17.   */
+
+static inline void small_sin_cos( const double x, double *sin_x,
+                                  double *cos_x_minus_1)
+{
+   const double x2 = x * x;
+
+   *sin_x = x * (1. - x2 * (1. / 6.) * (1. - x2 * (1. / 20.)
+               * (1. - x2 * (1. / 42.) * (1. - x2 * (1. / 72.)
+               * (1. - x2 * (1. / 110.) * (1. - x2 * (1. / 156.)
+               * (1. - x2 * (1. / 210.) * (1. - x2 * (1. / 272.)))))))));
+   *cos_x_minus_1 = -x2 * .5 * (1. - x2 * (1. / 12.)
+               * (1. - x2 * (1. / 30.) * (1. - x2 * (1. / 56.)
+               * (1. - x2 * (1. / 90.) * (1. - x2 * (1. / 132.)
+               * (1. - x2 * (1. / 182.) * (1. - x2 * (1. / 240.))))))));
+}
+
+/* sin() and cos() for arrays of angles of modest size (anything within
+a few million radians),  without library calls,  so loops using this are
+vectorized.  The angle is reduced to |r| <= pi/4 with pi/2 split into
+two parts,  as in fdlibm,  so the reduction is essentially exact;  results
+are within an ulp or two of the library functions.  floor() would keep
+the loop from being vectorized (GCC won't inline it without
+-fno-trapping-math),  so rounding is done by adding and subtracting
+1.5 * 2^52.  The quadrant is applied arithmetically (multiplying by
+zero or one is exact),  since GCC won't if-convert the selections.  */
+
+#define PIO2_1   1.57079632673412561417e+00     /* first 33 bits of pi/2 */
+#define PIO2_1T  6.07710050650619224932e-11     /* pi/2 - PIO2_1 */
+#define ROUNDER  6755399441055744.
+
+static inline double round_to_int( const double x)
+{
+   return( (x + ROUNDER) - ROUNDER);
+}
+
+static inline void sin_cos( const double *x, double *sin_x, double *cos_x,
+                            const int n)
+{
+   int i;
+
+   for( i = 0; i < n; i++)
+      {
+      const double k = round_to_int( x[i] * (2. / PI));
+      const double half_k = round_to_int( k * .5 - .25);    /* floor( k/2) */
+      const double odd = k - 2. * half_k;                   /* 0 or 1 */
+      const double sign = 1. - 2. * (half_k - 2. * round_to_int( half_k * .5 - .25));
+      double s, c;
+
+      small_sin_cos( (x[i] - k * PIO2_1) - k * PIO2_1T, &s, &c);
+      c += 1.;
+      sin_x[i] = sign * (odd * c + (1. - odd) * s);
+      cos_x[i] = sign * ((1. - odd) * c - odd * s);
+      }
+}
+
+static int SIMD_CLONES set_up_epoch( const bc430_store_t *store,
+                         epoch_setup_t *setup, const long epoch_idx)
+{
+   const double *elems = bc430_epoch_elements( store, epoch_idx);
+   double angle[N_AST], sin_i[N_AST], cos_i[N_AST], sin_o[N_AST], cos_o[N_AST];
+   double sin_w[N_AST], cos_w[N_AST], mean_anom[N_AST], ecc_anom[N_AST];
+   int i, iter, n_unconverged = N_AST;
+
+   if( !elems)
+      return( -1);
+   for( i = 0; i < N_AST; i++)
+      angle[i] = elems[i * 6 + BC430_INCL];
+   sin_cos( angle, sin_i, cos_i, N_AST);
+   for( i = 0; i < N_AST; i++)
+      angle[i] = elems[i * 6 + BC430_ASC_NODE];
+   sin_cos( angle, sin_o, cos_o, N_AST);
+   for( i = 0; i < N_AST; i++)
+      angle[i] = elems[i * 6 + BC430_ARG_PER];
+   sin_cos( angle, sin_w, cos_w, N_AST);
+   for( i = 0; i < N_AST; i++)
+      {
+      const double a = elems[i * 6 + BC430_A], ecc = elems[i * 6 + BC430_ECC];
+
+      setup->a[i] = a;
+      setup->ecc[i] = ecc;
+      setup->b[i] = a * sqrt( 1. - ecc * ecc);
+      setup->n[i] = GAUSS_K / (a * sqrt( a));
+      setup->px[i] = cos_w[i] * cos_o[i] - sin_w[i] * sin_o[i] * cos_i[i];
+      setup->py[i] = cos_w[i] * sin_o[i] + sin_w[i] * cos_o[i] * cos_i[i];
+      setup->pz[i] = sin_w[i] * sin_i[i];
+      setup->qx[i] = -sin_w[i] * cos_o[i] - cos_w[i] * sin_o[i] * cos_i[i];
+      setup->qy[i] = -sin_w[i] * sin_o[i] + cos_w[i] * cos_o[i] * cos_i[i];
+      setup->qz[i] = cos_w[i] * sin_i[i];
+      mean_anom[i] = ecc_anom[i] = elems[i * 6 + BC430_MEAN_ANOM];
+      }
+            /* Kepler's equation at the epoch,  for all 300 at once */
+   for( iter = 0; n_unconverged && iter < 30; iter++)
+      {
+      n_unconverged = 0;
+      sin_cos( ecc_anom, setup->sin_e0, setup->cos_e0, N_AST);
+      for( i = 0; i < N_AST; i++)
+         {
+         const double delta = (ecc_anom[i] - setup->ecc[i] * setup->sin_e0[i]
+                        - mean_anom[i]) / (1. - setup->ecc[i] * setup->cos_e0[i]);
+
+         ecc_anom[i] -= delta;
+         n_unconverged += (fabs( delta) > CONVERGED);
+         }
+      }
+   sin_cos( ecc_anom, setup->sin_e0, setup->cos_e0, N_AST);
+   setup->epoch_idx = epoch_idx;
+   return( 0);
+}
+
+bc430_pos_t *bc430_pos_init( const bc430_store_t *store, const int n_cached_times)
+{
+   bc430_pos_t *pos = (bc430_pos_t *)calloc( 1, sizeof( bc430_pos_t));
+   int i;
+
+   pos->store = store;
+   pos->setups = (epoch_setup_t *)calloc( N_EPOCH_CACHE, sizeof( epoch_setup_t));
+   for( i = 0; i < N_EPOCH_CACHE; i++)
+      pos->setups[i].epoch_idx = -1;
+   pos->n_cached_times = (n_cached_times > 0 ? n_cached_times : 1);
+   pos->times = (cached_time_t *)calloc( pos->n_cached_times, sizeof( cached_time_t));
+   for( i = 0; i < pos->n_cached_times; i++)
+      {
+      pos->times[i].jd = -1.;
+      pos->times[i].xyz = (double *)malloc( N_AST * 3 * sizeof( double));
+      }
+   return( pos);
+}
+
+static epoch_setup_t *get_setup( bc430_pos_t *pos, const long epoch_idx)
+{
+   epoch_setup_t *setup = pos->setups;
+   int i;
+
+   for( i = 0; i < N_EPOCH_CACHE; i++)
+      if( pos->setups[i].epoch_idx == epoch_idx)
+         {
+         pos->setups[i].last_used = pos->n_calls;
+         return( pos->setups + i);
+         }
+      else if( pos->setups[i].last_used < setup->last_used)
+         setup = pos->setups + i;
+   if( epoch_idx < 0 || epoch_idx >= BC430_N_EPOCHS
+               || set_up_epoch( pos->store, setup, epoch_idx))
+      {
+      setup->epoch_idx = -1;
+      return( NULL);
+      }
+   setup->last_used = pos->n_calls;
+   return( setup);
+}
+
+/* d,  sin( d),  and cos( d) - 1 for all 300 asteroids,  for a time dt
+from the epoch.  If any |d| is too big for the polynomials (can't happen
+for BC430's orbits,  but just in case),  the rest is done using the
+general sin_cos() for all asteroids.    */
+
+static void SIMD_CLONES compute_positions( bc430_pos_t *pos,
+                  const epoch_setup_t *s, const double dt, double *xyz)
+{
+   double *d = pos->d, *sin_d = pos->sin_d, *cm1 = pos->cos_d_minus_1;
+   int i, iter, n_unconverged = N_AST, n_too_big = 0;
+
+   for( i = 0; i < N_AST; i++)        /* first-order starting guess */
+      d[i] = s->n[i] * dt / (1. - s->ecc[i] * s->cos_e0[i]);
+   for( iter = 0; iter <= MAX_ITERATIONS; iter++)
+      {
+      if( !n_too_big)
+         for( i = 0; i < N_AST; i++)
+            n_too_big += (fabs( d[i]) > MAX_POLY_D);
+      if( !n_too_big)
+         for( i = 0; i < N_AST; i++)
+            small_sin_cos( d[i], sin_d + i, cm1 + i);
+      else
+         {
+         sin_cos( d, sin_d, cm1, N_AST);
+         for( i = 0; i < N_AST; i++)
+            cm1[i] -= 1.;
+         }
+      if( !n_unconverged || iter == MAX_ITERATIONS)
+         break;
+      n_unconverged = 0;
+      for( i = 0; i < N_AST; i++)
+         {
+         const double e = s->ecc[i];
+         const double f = d[i] - e * (s->sin_e0[i] * cm1[i] + s->cos_e0[i] * sin_d[i])
+                                     - s->n[i] * dt;
+         const double fprime = 1. - e * (s->cos_e0[i] * (cm1[i] + 1.)
+                                     - s->sin_e0[i] * sin_d[i]);
+         const double delta = f / fprime;
+
+         d[i] -= delta;
+         n_unconverged += (fabs( delta) > CONVERGED);
+         }
+      }
+   for( i = 0; i < N_AST; i++)
+      {
+      const double sin_e = s->sin_e0[i] * (cm1[i] + 1.) + s->cos_e0[i] * sin_d[i];
+      const double cos_e = s->cos_e0[i] * (cm1[i] + 1.) - s->sin_e0[i] * sin_d[i];
+      const double x = s->a[i] * (cos_e - s->ecc[i]), y = s->b[i] * sin_e;
+
+      xyz[i * 3] = x * s->px[i] + y * s->qx[i];
+      xyz[i * 3 + 1] = x * s->py[i] + y * s->qy[i];
+      xyz[i * 3 + 2] = x * s->pz[i] + y * s->qz[i];
+      }
+}
+
+/* Returns NULL if the JD is outside BC430's span,  by the same rule as
+bc430_epoch_index() (so a JD is accepted here if and only if the element
+lookups accept it).  */
+
+const double *bc430_positions( bc430_pos_t *pos, const double jd)
+{
+   const double t = (jd - (double)BC430_START_JD) / (double)BC430_JD_STEP;
+   cached_time_t *slot = pos->times;
+   const epoch_setup_t *setup;
+   long epoch_idx;
+   int i;
+
+   if( bc430_epoch_index( jd) < 0)
+      return( NULL);
+   pos->n_calls++;
+   for( i = 0; i < pos->n_cached_times; i++)
+      if( pos->times[i].jd == jd)
+         {
+         pos->times[i].last_used = pos->n_calls;
+         pos->n_cache_hits++;
+         return( pos->times[i].xyz);
+         }
+      else if( pos->times[i].last_used < slot->last_used)
+         slot = pos->times + i;
+   epoch_idx = (long)floor( t + .5);
+   setup = get_setup( pos, epoch_idx);
+   if( !setup)
+      return( NULL);
+   compute_positions( pos, setup, jd - bc430_epoch_jd( epoch_idx), slot->xyz);
+   slot->jd = jd;
+   slot->last_used = pos->n_calls;
+   pos->n_computed++;
+   return( slot->xyz);
+}
+
+/* As above,  but always propagating from the given epoch (and without
+caching),  for comparing propagations from different epochs.  This
+counts as a call,  so that the epoch setups' LRU stamps stay current.  */
+
+const double *bc430_positions_from_epoch( bc430_pos_t *pos,
+                        const long epoch_idx, const double jd)
+{
+   const epoch_setup_t *setup;
+
+   pos->n_calls++;
+   setup = get_setup( pos, epoch_idx);
+   if( !setup)
+      return( NULL);
+   compute_positions( pos, setup, jd - bc430_epoch_jd( epoch_idx), pos->scratch);
+   return( pos->scratch);
+}
+
+void bc430_pos_counts( const bc430_pos_t *pos, long *n_computed,
+                       long *n_cache_hits)
+{
+   *n_computed = pos->n_computed;
+   *n_cache_hits = pos->n_cache_hits;
+}
+
+void bc430_pos_free( bc430_pos_t *pos)
+{
+   int i;
+
+   for( i = 0; i < pos->n_cached_times; i++)
+      free( pos->times[i].xyz);
+   free( pos->times);
+   free( pos->setups);
+   free( pos);
+}
@@ -0,0 +1,29 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+/* Two-body positions of all 300 BC430 asteroids at arbitrary times,
+from the nearest epoch in a bc430_store.  See 'bc430_pos.c'.  */
+
+typedef struct bc430_pos bc430_pos_t;
+
+bc430_pos_t *bc430_pos_init( const bc430_store_t *store, const int n_cached_times);
+const double *bc430_positions( bc430_pos_t *pos, const double jd);
+const double *bc430_positions_from_epoch( bc430_pos_t *pos,
+                        const long epoch_idx, const double jd);
+void bc430_pos_counts( const bc430_pos_t *pos, long *n_computed,
+                       long *n_cache_hits);
+void bc430_pos_free( bc430_pos_t *pos);
@@ -0,0 +1,273 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+#include "bc430_store.h"
+
+/* BC430 comes as 'asteroid_indices.txt' (the 300 asteroid numbers,  one
+per line) and 'asteroid_ephemeris.txt' (six lines per asteroid per 40-day
+epoch:  a,  e,  then incl,  arg per,  node,  and mean anomaly in radians).
+Getting elements for a late epoch means skipping millions of text lines.
+
+   bc430_convert() reads those once and writes a binary file :  a header
+giving the layout and asteroid numbers,  then six doubles per record,
+with records ordered by epoch,  then by asteroid (i.e.,  in the same
+order as the text).  So the record for (epoch, asteroid) is at a fixed
+offset,  and is read with one pread() or (when the file can be memory-
+mapped) is simply a pointer into the map.  All 300 asteroids for one epoch
+are contiguous,  for code that wants to propagate all of them.
+
+   Values are in native byte order (the header 'magic' doubles as a check
+of that).   */
+
+#define BC430_MAGIC    "BC430BI1"
+
+typedef struct
+{
+   char magic[8];
+   int32_t n_asteroids, n_epochs, start_jd, jd_step;
+   int32_t numbers[BC430_N_ASTEROIDS];
+} bc430_header_t;
+
+#define RECORD_SIZE (6 * sizeof( double))
+#define EPOCH_SIZE  (BC430_N_ASTEROIDS * RECORD_SIZE)
+#define STORE_SIZE  (sizeof( bc430_header_t) + BC430_N_EPOCHS * EPOCH_SIZE)
+
+struct bc430_store
+{
+   bc430_header_t hdr;
+   FILE *ifile;
+   const char *map;        /* NULL if not memory-mapped */
+   long buffered_epoch;    /* for bc430_epoch_elements() when not mapped */
+   double *epoch_buff;
+};
+
+/* Returns 0 on success,  -1 if the text files couldn't be opened,  -2
+if they were incomplete,  -3 if the output couldn't be written.  The
+output is written to a temporary file and then renamed,  so a reader
+never sees a partial store.      */
+
+int bc430_convert( const char *indices_filename,
+               const char *ephem_filename, const char *ofilename)
+{
+   FILE *ifile = fopen( indices_filename, "rb"), *ofile;
+   bc430_header_t hdr;
+   char buff[300], *temp_name;
+   double *elems;
+   long i, n_records = (long)BC430_N_EPOCHS * BC430_N_ASTEROIDS;
+   int j, rval = 0;
+
+   if( !ifile)
+      return( -1);
+   memset( &hdr, 0, sizeof( hdr));
+   memcpy( hdr.magic, BC430_MAGIC, 8);
+   while( hdr.n_asteroids < BC430_N_ASTEROIDS && fgets( buff, sizeof( buff), ifile))
+      hdr.numbers[hdr.n_asteroids++] = (int32_t)atol( buff);
+   fclose( ifile);
+   if( hdr.n_asteroids != BC430_N_ASTEROIDS)
+      return( -2);
+   hdr.n_epochs = BC430_N_EPOCHS;
+   hdr.start_jd = BC430_START_JD;
+   hdr.jd_step = BC430_JD_STEP;
+   ifile = fopen( ephem_filename, "rb");
+   if( !ifile)
+      return( -1);
+   temp_name = (char *)malloc( strlen( ofilename) + 5);
+   strcpy( temp_name, ofilename);
+   strcat( temp_name, ".tmp");
+   ofile = fopen( temp_name, "wb");
+   elems = (double *)malloc( EPOCH_SIZE);
+   if( !ofile || !elems)
+      rval = -3;
+   else if( fwrite( &hdr, sizeof( hdr), 1, ofile) != 1)
+      rval = -3;
+   for( i = 0; !rval && i < n_records; i++)
+      {
+      double *rec = elems + (i % BC430_N_ASTEROIDS) * 6;
+
+      for( j = 0; j < 6; j++)
+         {
+         if( !fgets( buff, sizeof( buff), ifile))
+            {
+            rval = -2;
+            break;
+            }
+         rec[j] = atof( buff);
+         }
+      if( !rval && i % BC430_N_ASTEROIDS == BC430_N_ASTEROIDS - 1)
+         if( fwrite( elems, EPOCH_SIZE, 1, ofile) != 1)
+            rval = -3;
+      }
+   fclose( ifile);
+   free( elems);
+   if( ofile && fclose( ofile) && !rval)
+      rval = -3;
+   if( !rval && rename( temp_name, ofilename))
+      rval = -3;
+   if( rval)
+      remove( temp_name);
+   free( temp_name);
+   return( rval);
+}
+
+bc430_store_t *bc430_open( const char *filename)
+{
+   FILE *ifile = fopen( filename, "rb");
+   bc430_store_t *store;
+
+   if( !ifile)
+      return( NULL);
+   store = (bc430_store_t *)calloc( 1, sizeof( bc430_store_t));
+   if( fread( &store->hdr, sizeof( bc430_header_t), 1, ifile) != 1
+            || memcmp( store->hdr.magic, BC430_MAGIC, 8)
+            || store->hdr.n_asteroids != BC430_N_ASTEROIDS
+            || store->hdr.n_epochs != BC430_N_EPOCHS
+            || store->hdr.start_jd != BC430_START_JD
+            || store->hdr.jd_step != BC430_JD_STEP
+            || fseek( ifile, 0L, SEEK_END) || ftell( ifile) != (long)STORE_SIZE)
+      {
+      fclose( ifile);
+      free( store);
+      return( NULL);
+      }
+   store->ifile = ifile;
+   store->buffered_epoch = -1;
+#ifndef _WIN32
+   store->map = (const char *)mmap( NULL, STORE_SIZE, PROT_READ, MAP_SHARED,
+                                    fileno( ifile), 0);
+   if( store->map == (const char *)MAP_FAILED)
+      store->map = NULL;
+#endif
+   return( store);
+}
+
+/* Returns the index (0 to 299) within BC430 for the given asteroid
+number,  or -1 if it's not one of the BC430 asteroids.  */
+
+int bc430_asteroid_index( const bc430_store_t *store, const long number)
+{
+   int i;
+
+   for( i = 0; i < BC430_N_ASTEROIDS; i++)
+      if( store->hdr.numbers[i] == number)
+         return( i);
+   return( -1);
+}
+
+long bc430_asteroid_number( const bc430_store_t *store, const int idx)
+{
+   return( (long)store->hdr.numbers[idx]);
+}
+
+/* Returns the index of the epoch nearest to the JD (which is truncated
+to an integer first,  as the original 'bc430' did),  or -1 if it's out
+of range.  */
+
+long bc430_epoch_index( const double jd)
+{
+   const long epoch = (long)jd - BC430_START_JD;
+
+   if( jd < (double)BC430_START_JD || epoch > BC430_END_JD - BC430_START_JD)
+      return( -1);
+   return( (epoch + BC430_JD_STEP / 2) / BC430_JD_STEP);
+}
+
+double bc430_epoch_jd( const long epoch_idx)
+{
+   return( (double)( BC430_START_JD + epoch_idx * BC430_JD_STEP));
+}
+
+static long long record_offset( const int asteroid_idx, const long epoch_idx)
+{
+   return( (long long)sizeof( bc430_header_t)
+            + ((long long)epoch_idx * BC430_N_ASTEROIDS + asteroid_idx)
+            * (long long)RECORD_SIZE);
+}
+
+static int read_at( const bc430_store_t *store, const long long offset,
+                    void *buff, const size_t size)
+{
+   if( store->map)
+      {
+      memcpy( buff, store->map + offset, size);
+      return( 0);
+      }
+#ifndef _WIN32
+   if( pread( fileno( store->ifile), buff, size, (off_t)offset) != (ssize_t)size)
+      return( -2);
+#else
+   if( fseek( store->ifile, (long)offset, SEEK_SET)
+            || fread( buff, size, 1, store->ifile) != 1)
+      return( -2);
+#endif
+   return( 0);
+}
+
+/* Gets the six elements for an (asteroid, epoch) pair with one read. */
+
+int bc430_get_elements( const bc430_store_t *store, const int asteroid_idx,
+               const long epoch_idx, double *elems)
+{
+   if( asteroid_idx < 0 || asteroid_idx >= BC430_N_ASTEROIDS
+                  || epoch_idx < 0 || epoch_idx >= BC430_N_EPOCHS)
+      return( -1);
+   return( read_at( store, record_offset( asteroid_idx, epoch_idx),
+                                   elems, RECORD_SIZE));
+}
+
+/* Returns a pointer to the elements of all 300 asteroids for an epoch
+(6 * 300 doubles,  in index order).  If the store isn't memory-mapped,
+they're read into a buffer,  overwritten by the next call.  */
+
+const double *bc430_epoch_elements( const bc430_store_t *store,
+               const long epoch_idx)
+{
+   bc430_store_t *s = (bc430_store_t *)store;
+
+   if( epoch_idx < 0 || epoch_idx >= BC430_N_EPOCHS)
+      return( NULL);
+   if( store->map)
+      return( (const double *)( store->map + record_offset( 0, epoch_idx)));
+   if( s->buffered_epoch != epoch_idx)
+      {
+      if( !s->epoch_buff)
+         s->epoch_buff = (double *)malloc( EPOCH_SIZE);
+      if( read_at( store, record_offset( 0, epoch_idx), s->epoch_buff, EPOCH_SIZE))
+         return( NULL);
+      s->buffered_epoch = epoch_idx;
+      }
+   return( s->epoch_buff);
+}
+
+void bc430_close( bc430_store_t *store)
+{
+#ifndef _WIN32
+   if( store->map)
+      munmap( (void *)store->map, STORE_SIZE);
+#endif
+   fclose( store->ifile);
+   free( store->epoch_buff);
+   free( store);
+}
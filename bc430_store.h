@@ -0,0 +1,48 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+/* Binary store of BC430 elements,  with fixed-size records indexed by
+(epoch, asteroid).  See 'bc430_store.c' for details.  */
+
+#define BC430_N_ASTEROIDS    300
+#define BC430_START_JD   2378495
+#define BC430_END_JD     2524615
+#define BC430_JD_STEP         40
+#define BC430_N_EPOCHS   ((BC430_END_JD - BC430_START_JD) / BC430_JD_STEP + 1)
+
+            /* Elements are stored in the order used in the text files : */
+#define BC430_A            0
+#define BC430_ECC          1
+#define BC430_INCL         2
+#define BC430_ARG_PER      3
+#define BC430_ASC_NODE     4
+#define BC430_MEAN_ANOM    5
+
+typedef struct bc430_store bc430_store_t;
+
+int bc430_convert( const char *indices_filename,
+               const char *ephem_filename, const char *ofilename);
+bc430_store_t *bc430_open( const char *filename);
+int bc430_asteroid_index( const bc430_store_t *store, const long number);
+long bc430_asteroid_number( const bc430_store_t *store, const int idx);
+long bc430_epoch_index( const double jd);
+double bc430_epoch_jd( const long epoch_idx);
+int bc430_get_elements( const bc430_store_t *store, const int asteroid_idx,
+               const long epoch_idx, double *elems);
+const double *bc430_epoch_elements( const bc430_store_t *store,
+               const long epoch_idx);
+void bc430_close( bc430_store_t *store);
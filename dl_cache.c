@@ -0,0 +1,403 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#ifdef _WIN32
+   #include <process.h>
+#else
+   #include <unistd.h>
+   #include <fcntl.h>
+   #include <dirent.h>
+   #include <utime.h>
+   #include <sys/file.h>
+   #include <sys/stat.h>
+   #include <sys/types.h>
+#endif
+#include "dl_cache.h"
+
+/* grab_mpc,  grab_new,  and mpecer each used to decide whether to
+re-download something by looking at a 'COM UNIX time' header in a
+previous output file,  or not at all;  and they downloaded into fixed
+scratch files ('/tmp/zzz1',  'zz') that concurrent runs would clobber.
+This is a small cache they all share.
+
+   Each entry is a file in the cache directory,  named for a 64-bit
+FNV-1a hash of the key (the URL plus anything else that determines the
+response).  The file starts with a line giving the time at which it was
+stored,  then a line giving the full key (so hash collisions are just
+cache misses),  then the data.  An entry is 'fresh' if it was stored
+less than 'ttl' seconds ago;  the TTL is up to the caller,  so that
+(say) NEOCP data can be refreshed every few minutes while MPECs,  which
+don't change,  can be kept for a month.
+
+   Entries are written to a unique temporary file,  then rename()d into
+place,  so a reader in another process sees either the old entry or the
+complete new one,  never a partial one.  Each hit updates the file's
+modification time,  which therefore serves as a 'last used' time.  After
+each store,  if the directory holds more than DL_CACHE_MAX_BYTES,  the
+least recently used entries are removed (under an flock(),  so that only
+one process evicts at a time) until it's down to 90% of that.
+
+   The cache lives in $DL_CACHE_DIR,  or ~/.dl_cache if that isn't set.
+Setting DL_CACHE_DIR to '-' disables the cache.  On Windows,  it's
+currently always disabled;  only dl_cache_temp_file() does anything. */
+
+#define DL_CACHE_MAX_BYTES  (200L * 1024L * 1024L)
+#define DL_CACHE_MAGIC "DLC1 "
+
+static uint64_t fnv1a_hash( const char *key)
+{
+   uint64_t rval = (uint64_t)0xcbf29ce484222325ULL;
+
+   while( *key)
+      {
+      rval ^= (uint64_t)(unsigned char)*key++;
+      rval *= (uint64_t)0x100000001b3ULL;
+      }
+   return( rval);
+}
+
+#ifdef _WIN32
+
+char *dl_cache_load( const char *key, const long ttl, size_t *len)
+{
+   (void)key;
+   (void)ttl;
+   *len = 0;
+   return( NULL);
+}
+
+bool dl_cache_copy_to( const char *key, const long ttl, FILE *ofile)
+{
+   (void)key;
+   (void)ttl;
+   (void)ofile;
+   return( false);
+}
+
+FILE *dl_cache_open( const char *key, const long ttl)
+{
+   (void)key;
+   (void)ttl;
+   return( NULL);
+}
+
+int dl_cache_store( const char *key, const void *data, const size_t len)
+{
+   (void)key;
+   (void)data;
+   (void)len;
+   return( DL_CACHE_ERR_DISABLED);
+}
+
+int dl_cache_store_file( const char *key, const char *filename)
+{
+   (void)key;
+   (void)filename;
+   return( DL_CACHE_ERR_DISABLED);
+}
+
+FILE *dl_cache_temp_file( char *filename, const size_t filename_size)
+{
+   snprintf( filename, filename_size, "zzz%d", (int)_getpid( ));
+   return( fopen( filename, "w+b"));
+}
+
+#else       /* non-Windows:  the real cache */
+
+/* Returns NULL if the cache is disabled or the directory can't be made. */
+
+static const char *cache_dir( void)
+{
+   static char dir[300];
+   static int state = 0;      /* 0 = not checked yet,  1 = OK,  -1 = off */
+
+   if( !state)
+      {
+      const char *env = getenv( "DL_CACHE_DIR");
+
+      state = -1;
+      if( env && *env)
+         {
+         if( strcmp( env, "-"))
+            snprintf( dir, sizeof( dir), "%s", env);
+         }
+      else if( (env = getenv( "HOME")) != NULL)
+         snprintf( dir, sizeof( dir), "%s/.dl_cache", env);
+      if( *dir && (!mkdir( dir, 0755) || errno == EEXIST))
+         state = 1;
+      }
+   return( state == 1 ? dir : NULL);
+}
+
+static char *entry_path( const char *key, char *path, const size_t path_size)
+{
+   const char *dir = cache_dir( );
+
+   if( !dir)
+      return( NULL);
+   snprintf( path, path_size, "%s/%016llx", dir,
+                     (unsigned long long)fnv1a_hash( key));
+   return( path);
+}
+
+/* Opens the entry for 'key' and skips its header,  returning NULL if
+there's no such entry or it's older than 'ttl' seconds.  */
+
+static FILE *open_fresh_entry( const char *key, const long ttl, char *path,
+                               const size_t path_size)
+{
+   FILE *ifile;
+   char buff[100];
+   const size_t key_len = strlen( key);
+   char *stored_key;
+   bool is_fresh;
+
+   if( !entry_path( key, path, path_size))
+      return( NULL);
+   ifile = fopen( path, "rb");
+   if( !ifile)
+      return( NULL);
+   is_fresh = (fgets( buff, sizeof( buff), ifile)
+          && !memcmp( buff, DL_CACHE_MAGIC, 5)
+          && atol( buff + 5) + ttl > (long)time( NULL));
+   stored_key = (char *)malloc( key_len + 2);
+   if( is_fresh && (!fgets( stored_key, (int)key_len + 2, ifile)
+                   || memcmp( stored_key, key, key_len)
+                   || stored_key[key_len] != '\n'))
+      is_fresh = false;      /* hash collision or damaged entry */
+   free( stored_key);
+   if( !is_fresh)
+      {
+      fclose( ifile);
+      return( NULL);
+      }
+   utime( path, NULL);       /* mark as recently used */
+   return( ifile);
+}
+
+char *dl_cache_load( const char *key, const long ttl, size_t *len)
+{
+   char path[400], *rval;
+   FILE *ifile = open_fresh_entry( key, ttl, path, sizeof( path));
+   long start, end;
+
+   *len = 0;
+   if( !ifile)
+      return( NULL);
+   start = ftell( ifile);
+   fseek( ifile, 0L, SEEK_END);
+   end = ftell( ifile);
+   fseek( ifile, start, SEEK_SET);
+   rval = (char *)malloc( (size_t)( end - start) + 1);
+   assert( rval);
+   *len = fread( rval, 1, (size_t)( end - start), ifile);
+   rval[*len] = '\0';
+   fclose( ifile);
+   return( rval);
+}
+
+   /* Returns the entry for 'key',  opened for reading and positioned
+      at the start of the data;  or NULL if it's missing or stale.  This
+      lets callers stream large entries instead of loading them.  */
+
+FILE *dl_cache_open( const char *key, const long ttl)
+{
+   char path[400];
+
+   return( open_fresh_entry( key, ttl, path, sizeof( path)));
+}
+
+bool dl_cache_copy_to( const char *key, const long ttl, FILE *ofile)
+{
+   char path[400], buff[8192];
+   FILE *ifile = open_fresh_entry( key, ttl, path, sizeof( path));
+   size_t n_read;
+
+   if( !ifile)
+      return( false);
+   while( (n_read = fread( buff, 1, sizeof( buff), ifile)) > 0)
+      fwrite( buff, 1, n_read, ofile);
+   fclose( ifile);
+   return( true);
+}
+
+FILE *dl_cache_temp_file( char *filename, const size_t filename_size)
+{
+   const char *dir = cache_dir( );
+   int fd;
+
+   snprintf( filename, filename_size, "%s/tmp.XXXXXX", (dir ? dir : "/tmp"));
+   fd = mkstemp( filename);
+   return( fd < 0 ? NULL : fdopen( fd, "w+b"));
+}
+
+typedef struct
+{
+   time_t mtime;
+   long size;
+   char name[20];
+} cache_entry_t;
+
+static int compare_entries( const void *a, const void *b)
+{
+   const cache_entry_t *e1 = (const cache_entry_t *)a;
+   const cache_entry_t *e2 = (const cache_entry_t *)b;
+
+   return( e1->mtime > e2->mtime ? 1 : (e1->mtime < e2->mtime ? -1 : 0));
+}
+
+static void evict_if_needed( const char *dir)
+{
+   char path[400];
+   int lock_fd;
+   DIR *dirp;
+   struct dirent *dent;
+   cache_entry_t *entries = NULL;
+   size_t n_entries = 0, n_alloced = 0, i;
+   long total = 0;
+
+   snprintf( path, sizeof( path), "%s/.lock", dir);
+   lock_fd = open( path, O_RDWR | O_CREAT, 0644);
+   if( lock_fd < 0)
+      return;
+   if( flock( lock_fd, LOCK_EX | LOCK_NB))
+      {                 /* someone else is already evicting */
+      close( lock_fd);
+      return;
+      }
+   dirp = opendir( dir);
+   while( dirp && (dent = readdir( dirp)) != NULL)
+      if( strlen( dent->d_name) == 16)
+         {
+         struct stat sbuf;
+
+         snprintf( path, sizeof( path), "%s/%s", dir, dent->d_name);
+         if( !stat( path, &sbuf))
+            {
+            if( n_entries == n_alloced)
+               {
+               n_alloced = (n_alloced ? n_alloced * 2 : 256);
+               entries = (cache_entry_t *)realloc( entries,
+                                    n_alloced * sizeof( cache_entry_t));
+               assert( entries);
+               }
+            entries[n_entries].mtime = sbuf.st_mtime;
+            entries[n_entries].size = (long)sbuf.st_size;
+            strcpy( entries[n_entries].name, dent->d_name);
+            total += (long)sbuf.st_size;
+            n_entries++;
+            }
+         }
+   if( dirp)
+      closedir( dirp);
+   if( total > DL_CACHE_MAX_BYTES)
+      {
+      qsort( entries, n_entries, sizeof( cache_entry_t), compare_entries);
+      for( i = 0; i < n_entries && total > DL_CACHE_MAX_BYTES / 10 * 9; i++)
+         {
+         snprintf( path, sizeof( path), "%s/%s", dir, entries[i].name);
+         if( !unlink( path))
+            total -= entries[i].size;
+         }
+      }
+   free( entries);
+   flock( lock_fd, LOCK_UN);
+   close( lock_fd);
+}
+
+/* Writes the header to a unique temporary file,  then calls
+'write_data' to add the actual data,  then renames it into place. */
+
+static int store_entry( const char *key,
+          int (*write_data)( FILE *ofile, const void *context),
+          const void *context)
+{
+   char path[400], temp_name[400];
+   FILE *ofile;
+   int rval = 0;
+
+   if( !entry_path( key, path, sizeof( path)))
+      return( DL_CACHE_ERR_DISABLED);
+   ofile = dl_cache_temp_file( temp_name, sizeof( temp_name));
+   if( !ofile)
+      return( DL_CACHE_ERR_WRITE);
+   fprintf( ofile, "%s%ld\n%s\n", DL_CACHE_MAGIC, (long)time( NULL), key);
+   rval = write_data( ofile, context);
+   if( fclose( ofile))
+      rval = DL_CACHE_ERR_WRITE;
+   if( !rval && rename( temp_name, path))
+      rval = DL_CACHE_ERR_WRITE;
+   if( rval)
+      unlink( temp_name);
+   else
+      evict_if_needed( cache_dir( ));
+   return( rval);
+}
+
+typedef struct
+{
+   const void *data;
+   size_t len;
+} mem_data_t;
+
+static int write_mem_data( FILE *ofile, const void *context)
+{
+   const mem_data_t *mdata = (const mem_data_t *)context;
+
+   if( mdata->len && fwrite( mdata->data, mdata->len, 1, ofile) != 1)
+      return( DL_CACHE_ERR_WRITE);
+   return( 0);
+}
+
+int dl_cache_store( const char *key, const void *data, const size_t len)
+{
+   mem_data_t mdata;
+
+   mdata.data = data;
+   mdata.len = len;
+   return( store_entry( key, write_mem_data, &mdata));
+}
+
+static int write_file_data( FILE *ofile, const void *context)
+{
+   FILE *ifile = fopen( (const char *)context, "rb");
+   char buff[8192];
+   size_t n_read;
+   int rval = 0;
+
+   if( !ifile)
+      return( DL_CACHE_ERR_READ);
+   while( !rval && (n_read = fread( buff, 1, sizeof( buff), ifile)) > 0)
+      if( fwrite( buff, 1, n_read, ofile) != n_read)
+         rval = DL_CACHE_ERR_WRITE;
+   fclose( ifile);
+   return( rval);
+}
+
+int dl_cache_store_file( const char *key, const char *filename)
+{
+   return( store_entry( key, write_file_data, filename));
+}
+
+#endif
@@ -0,0 +1,39 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Small on-disk download cache shared by grab_mpc,  grab_new,  and
+mpecer.  See 'dl_cache.c' for details.  Keys are the URL plus whatever
+else determines the response (POST data,  byte ranges,  etc.);  TTLs
+are in seconds,  and are chosen by the caller for each source.  */
+
+#define DL_CACHE_TTL_NEOCP              300
+#define DL_CACHE_TTL_MPC_OBS          10800
+#define DL_CACHE_TTL_MPEC           2592000
+
+char *dl_cache_load( const char *key, const long ttl, size_t *len);
+bool dl_cache_copy_to( const char *key, const long ttl, FILE *ofile);
+FILE *dl_cache_open( const char *key, const long ttl);
+int dl_cache_store( const char *key, const void *data, const size_t len);
+int dl_cache_store_file( const char *key, const char *filename);
+FILE *dl_cache_temp_file( char *filename, const size_t filename_size);
+
+#define DL_CACHE_ERR_DISABLED       -1
+#define DL_CACHE_ERR_WRITE          -2
+#define DL_CACHE_ERR_READ           -3
@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include "gz_input.h"
 
 /* Code to read in one file containing a list of object designations
 in packed form,  and then to read in another file of punched-card
@@ -20,7 +21,8 @@ static void error_exit( void)
    fprintf( stderr,
            "'get_objs' needs two command line arguments : the name of a file\n"
            "listing packed designations of objects for which astrometry is to be\n"
-           "extracted,  and the name of a file containing the astrometry.\n");
+           "extracted,  and the name of a file containing the astrometry.\n"
+           "Either file may be gzipped.\n");
    exit( -1);
 }
 
@@ -33,7 +35,7 @@ static int compare( const void *a, const void *b)
 
 int main( const int argc, const char **argv)
 {
-   FILE *ifile;
+   gz_input_t *ifile;
    char buff[200], *desigs = NULL;
    char prev_desig[13];
    int it_matches = 0;
@@ -42,14 +44,14 @@ int main( const int argc, const char **argv)
 
    if( argc < 3)
       error_exit( );
-   ifile = fopen( argv[1], "rb");
+   ifile = gz_input_open( argv[1]);
    if( !ifile)
       {
       fprintf( stderr, "Couldn't open '%s' :", argv[1]);
       perror( NULL);
       error_exit( );
       }
-   while( fgets( buff, sizeof( buff), ifile))
+   while( gz_input_gets( buff, sizeof( buff), ifile))
       if( *buff != '#')             /* both temp and permanent desigs */
          {
          char tdesig[20];
@@ -69,7 +71,7 @@ int main( const int argc, const char **argv)
             desigs = (char *)realloc( desigs, n_desigs * 2 * desig_len);
          strcpy( desigs + (n_desigs - 1) * desig_len, tdesig);
          }
-   fclose( ifile);
+   gz_input_close( ifile);
    if( !n_desigs)
       {
       printf( "No designations found in '%s'\n", argv[1]);
@@ -78,7 +80,7 @@ int main( const int argc, const char **argv)
    qsort( desigs, n_desigs, desig_len, compare);
    for( i = 0; i < n_desigs; i++)
       printf( "(%u) '%s'\n", i, desigs + i * desig_len);
-   ifile = fopen( argv[2], "rb");
+   ifile = gz_input_open( argv[2]);
    if( !ifile)
       {
       fprintf( stderr, "Couldn't open '%s' :", argv[2]);
@@ -86,7 +88,7 @@ int main( const int argc, const char **argv)
       error_exit( );
       }
    memset( prev_desig, 0, sizeof( prev_desig));
-   while( fgets( buff, sizeof( buff), ifile))
+   while( gz_input_gets( buff, sizeof( buff), ifile))
       {
       if( memcmp( prev_desig, buff, 12))
          {
@@ -100,7 +102,7 @@ int main( const int argc, const char **argv)
       if( it_matches)
          printf( "%s", buff);
       }
-   fclose( ifile);
+   gz_input_close( ifile);
    free( desigs);
    return( 0);
 }
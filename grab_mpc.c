@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <curl/curl.h>
 #include <curl/easy.h>
 #include <unistd.h>
+#include "url_fetch.h"
 #endif
 #include <stdio.h>
 #include <string.h>
@@ -29,12 +30,19 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <stdbool.h>
 #include <assert.h>
 #include <time.h>
+#include "dl_cache.h"
 
 /* Code to download astrometry for a given object from MPC.  Run as
 
 ./grab_mpc filename object name [-a]
 
--a = append astrometry to file rather than overwriting the file. */
+-a = append astrometry to file rather than overwriting the file.
+
+   Downloads go through the shared cache in 'dl_cache.c',  so that
+asking for the same object again within DL_CACHE_TTL_MPC_OBS seconds
+(or for the NEOCP bulk file within DL_CACHE_TTL_NEOCP seconds) doesn't
+touch the network.  Each download goes to a unique temporary file,  so
+concurrent runs don't clobber one another.  */
 
 size_t total_written;
 
@@ -114,6 +122,11 @@ static FILE *init_output_file( const char *url, const char *object_name,
    return( ofile);
 }
 
+/* grab_file( ) returns zero if the transfer worked.  That doesn't mean
+we got the file;  a 404 page is still a successful transfer.  So only
+if the server returned 200 does http_ok( ) return true,  and it's only
+then that the result can go into the download cache.  */
+
 #ifdef _WIN32
 static int grab_file( const char *url, const char *outfilename)
 {
@@ -122,71 +135,86 @@ static int grab_file( const char *url, const char *outfilename)
    rval = URLDownloadToFile( NULL, url, outfilename, 0, NULL);
    return( rval != S_OK);
 }
+
+static bool http_ok( void)    /* URLDownloadToFile() fails on HTTP errors */
+{
+   return( true);
+}
 #else             /* non-Win32 file grabbing */
 
-static size_t write_data(void *ptr, size_t size, size_t nmemb, FILE *stream) {
-    size_t written;
+/* The connection to MPC is kept open between calls (and transient
+failures retried) by the shared code in 'url_fetch.c'.  */
+
+static int grab_file( const char *url, const char *outfilename)
+{
+   int rval = 0;
+   FILE *fp = fopen( outfilename, "wb");
+   CURLcode res;
 
-    written = fwrite(ptr, size, nmemb, stream);
-    total_written += written;
-    return written;
+   if( !fp)
+      return( FETCH_FOPEN_FAILED);
+   curl_easy_setopt( url_fetch_default_handle( ), CURLOPT_USERAGENT,
+         "Mozilla/5.0 (Windows NT 6.1; Win64; x64; rv:61.0) Gecko/20100101 Firefox/61.0");
+   res = url_fetch_to_file( url, fp);
+   total_written += (size_t)ftell( fp);
+   if( res)
+      {
+      fprintf( fp, "Error '%s'\n", curl_easy_strerror( res));
+      rval = FETCH_CURL_PERFORM_FAILED;
+      }
+   fclose(fp);
+   return rval;
 }
 
-static int grab_file( const char *url, const char *outfilename)
+static bool http_ok( void)
 {
-    CURL *curl;
-    int rval = 0;
-    FILE *fp = fopen( outfilename, "wb");
-
-    if( !fp)
-        return( FETCH_FOPEN_FAILED);
-    curl = curl_easy_init();
-    if (curl)
-        {
-        CURLcode res;
-        char err_buff[CURL_ERROR_SIZE];
-
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, err_buff);
-        curl_easy_setopt(curl, CURLOPT_USERAGENT,
-            "Mozilla/5.0 (Windows NT 6.1; Win64; x64; rv:61.0) Gecko/20100101 Firefox/61.0");
-        res = curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
-        if( res)
-           {
-           fprintf( fp, "Error '%s'\n", err_buff);
-           rval = FETCH_CURL_PERFORM_FAILED;
-           }
-        }
-    else
-        {
-        fprintf( fp, "Error: couldn't initialize curl\n");
-        rval = FETCH_CURL_INIT_FAILED;
-        }
-    fclose(fp);
-    return rval;
+   long response_code = 0;
+
+   curl_easy_getinfo( url_fetch_default_handle( ), CURLINFO_RESPONSE_CODE,
+                                 &response_code);
+   return( response_code == 200);
 }
 #endif
 
 static int grab_file_with_time_info( const char *url, const char *object_name,
-                  const char *outfilename, const bool append)
+                  const char *outfilename, const bool append, const long ttl)
 {
    FILE *ofile, *ifile;
-#if defined( _WIN32) || defined( __WATCOMC__)
-   const char *tname = "zzz1";
-#else
-   const char *tname = "/tmp/zzz1";
-#endif
+   char tname[400], *cached;
+   size_t cached_len;
 
-   unlink( tname);
+   cached = dl_cache_load( url, ttl, &cached_len);
+   if( cached)
+      {
+      if( verbose)
+         printf( "Using cached '%s'\n", url);
+      ofile = init_output_file( url, object_name, outfilename, append);
+      if( ofile)
+         {
+         fwrite( cached, 1, cached_len, ofile);
+         total_written += cached_len;
+         fclose( ofile);
+         }
+      free( cached);
+      return( ofile ? 0 : FETCH_FOPEN_FAILED);
+      }
+   ifile = dl_cache_temp_file( tname, sizeof( tname));
+   if( !ifile)
+      return( FETCH_FOPEN_FAILED);
+   fclose( ifile);
    if( grab_file( url, tname))
-       return( -1);
+      {
+      unlink( tname);
+      return( -1);
+      }
+   if( http_ok( ))
+      dl_cache_store_file( url, tname);
    ofile = init_output_file( url, object_name, outfilename, append);
    if( !ofile)
+      {
+      unlink( tname);
       return( FETCH_FOPEN_FAILED);
+      }
    ifile = fopen( tname, "rb");
    if( ifile)
       {
@@ -246,7 +274,8 @@ static int fetch_astrometry_from_mpc( const char *output_filename,
    if( !strcmp( object_name, "n"))
       {
       strcpy( url, BASE_MPC_URL "//cgi-bin/bulk_neocp.cgi?what=obs");
-      return( grab_file_with_time_info( url, "NEOCP", output_filename, 0));
+      return( grab_file_with_time_info( url, "NEOCP", output_filename, 0,
+                                        DL_CACHE_TTL_NEOCP));
       }
 
    snprintf( url2, sizeof( url2), "%s.txt", object_name);
@@ -272,7 +301,8 @@ static int fetch_astrometry_from_mpc( const char *output_filename,
    if( verbose)
       printf( "Grabbing '%s''\n", url);
    unlink( output_filename);
-   rval = grab_file_with_time_info( url, object_name, output_filename, 0);
+   rval = grab_file_with_time_info( url, object_name, output_filename, 0,
+                                    DL_CACHE_TTL_MPC_OBS);
    if( !rval && !look_for_link_to_astrometry( output_filename, url2))
       rval = FETCH_OBJECT_NOT_FOUND;
    if( verbose)
@@ -287,7 +317,8 @@ static int fetch_astrometry_from_mpc( const char *output_filename,
       printf( "Grabbing '%s'\n", url2);
 #endif
    total_written = 0;
-   rval = grab_file_with_time_info( url2, object_name, output_filename, append);
+   rval = grab_file_with_time_info( url2, object_name, output_filename, append,
+                                    DL_CACHE_TTL_MPC_OBS);
    if( rval)
       rval -= 1000;
    return( rval);
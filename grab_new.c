@@ -30,30 +30,62 @@ just handles the latter).  This will be a replacement for 'grab_mpc.c'
 offer several advantages (access to ADES data, observations available
 quicker,  etc.)  Compile with
 
-gcc -Wall -Wextra -pedantic -I../include -o grab_mpc grab_new.c ../lunar/snprintf.cpp
+gcc -Wall -Wextra -pedantic -I../include -o grab_mpc grab_new.c dl_cache.c url_fetch.c ../lunar/snprintf.cpp -lcurl -lpthread
 
    to generate a 'grab_mpc' executable;  you should be able to just
 drop it in as a replacement.
 
-   This code assembles a curl command resembling those shown at the
-above URLs (look under "Curl Example - XML format").  I tried using
-libcURL instead of system( curl command),  but without success;  I
-didn't find the right invocation of the library.  So this won't work
-on systems lacking the 'curl' command.
+   This code makes requests resembling the curl commands shown at the
+above URLs (look under "Curl Example - XML format"),  but does so with
+libcURL rather than system( curl command).  The trick is that it's a GET
+with a JSON body,  i.e.,  CURLOPT_POSTFIELDS plus a custom "GET" request.
+Handles come from 'url_fetch.c',  so that when several requests are made,
+the connection to MPC is reused,  and transient failures are retried.
 
-   The resulting file has the line feed (character 10) converted into
-a backslash and an 'n'.  So we have to go through and convert all
-of those.  The file also has some header and trailer data not needed
-for our purposes;  those are stripped,  and the output written back
-to the file.
+   The response has the line feed (character 10) converted into a
+backslash and an 'n'.  So we have to go through and convert all of
+those.  It also has some header and trailer data not needed for our
+purposes;  those are stripped before the ADES is written to the file.
+This is all done as the data arrives,  without ever holding the full
+response in memory (see 'ades_stream_t' below).  With '-8',  the ADES
+is converted to 80-column MPC records,  and those are written instead :
+
+./grab_new (output filename) (object desig) -8
+
+   The conversion is done by lunar's ADES translator (see
+fgets_with_ades_xlation() in 'mpc_func.h',  also used by 'ades2mpc'),
+so designation packing,  catalog and mode codes,  etc. are maintained
+in one place.
+
+   The API accepts arrays of designations.  So in 'batch mode',
+
+./grab_new -b(list file)
+
+   reads lines of the form '(output filename) (object desig)' from the
+list file,  and asks for up to 50 objects per request.  The
+response contains one '<ades ...>...</ades>' block per object,  normally
+in the order requested;  each is written to its own output file.  But
+before any of them are renamed into place,  the permID,  provID,  or
+trkSub of each block's observations must match the designation asked
+for.  If they don't (blocks out of order,  or one object dropped and
+another added),  or if the number of blocks doesn't match the number of
+objects requested (e.g.,  some weren't found),  we fall back to
+requesting those objects one at a time.  '-n(size)' sets the batch size.
 
    In order to avoid hammering MPC's servers,  we do a bit of checking:
 if the file exists,  and has data for the object we're looking for
-(based on the file names in the URLs matching),  _and_ no more than
+(based on the file names in the URLs matching),  in the same format
+(ADES or '-8' 80-column),  _and_ no more than
 delay_between_reloads seconds have elapsed,  then we can recycle the
 existing file.   Currently,  that means we try again if three hours
 have elapsed.  With modifications,  this program could work with
-NEOCP as well;  we'd presumably use a shorter delay there.     */
+NEOCP as well;  we'd presumably use a shorter delay there.
+
+   The ADES for each object is also kept in the shared download cache
+(see 'dl_cache.c'),  keyed by the API URL and designation,  with the
+same delay as its TTL.  So if the output file is gone (or a different
+output file is asked for),  we still don't ask MPC again within that
+time,  whether the object was fetched singly or in a batch.     */
 
 #include <stdio.h>
 #include <time.h>
@@ -61,36 +93,526 @@ NEOCP as well;  we'd presumably use a shorter delay there.     */
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <curl/curl.h>
 #include "stringex.h"
+#include "mpc_func.h"
+#include "dl_cache.h"
+#include "url_fetch.h"
 
 
 static int delay_between_reloads = 10800;    /* = three-hour delay */
 
+/* A fresh handle is made for each request,  so no options linger from
+the previous one;  the connection itself is kept open in the pool shared
+by all handles from 'url_fetch.c'.  */
+
+static CURL *curl_handle = NULL;
+
+static CURL *get_curl_handle( void)
+{
+   if( curl_handle)
+      curl_easy_cleanup( curl_handle);
+   curl_handle = url_fetch_new_handle( );
+   return( curl_handle);
+}
+
+static void cleanup_curl( void)
+{
+   if( curl_handle)
+      curl_easy_cleanup( curl_handle);
+   curl_handle = NULL;
+   url_fetch_cleanup( );
+}
+
 static int grab_file( const char *url, const char *outfilename)
 {
-   const size_t buffsize = strlen( url) + strlen( outfilename) + 16;
-   char *command = (char *)malloc( buffsize + 1);
-   int err_code;
+   FILE *ofile = fopen( outfilename, "wb");
+   CURLcode res;
 
-   snprintf_err( command, buffsize, "curl -s %s -o%s", url, outfilename);
-   err_code = system( command);
-   if( err_code)
-      fprintf( stderr, "Error %d for grab_file\n'%s'\n", err_code, command);
-   return( err_code);
+   if( !ofile)
+      {
+      fprintf( stderr, "Couldn't open '%s'\n", outfilename);
+      return( -2);
+      }
+   res = url_fetch_to_file( url, ofile);
+   fclose( ofile);
+   if( res)
+      fprintf( stderr, "Error %d for grab_file\n'%s'\n%s\n", (int)res, url,
+                              curl_easy_strerror( res));
+   return( (int)res);
 }
 
 static int verbose = 0;
+static bool eighty_column_output = false;
 
-static int download_astrometry( const char *filename, const char *object_desig,
-                  const bool is_neocp)
+/* Output files start with three 'COM' lines :  the download time,  the
+object,  and the output format.  The last is checked,  so that an ADES
+file isn't taken as a fresh '-8' download or vice versa.  */
+
+static const char *output_format( void)
+{
+   return( eighty_column_output ? "80-column" : "ADES");
+}
+
+/* Each <ades> block is run through a minimal parser,  a character at a
+time as it arrives,  that just records the first permID,  provID,  and
+trkSub found in its <optical> records,  so that batch responses can be
+checked against the designations requested.  (Conversion to 80-column
+form with '-8' is left to lunar's ADES translator;  see
+convert_to_80_column() below.)  */
+
+#define ADES_FIELD_LEN 60
+
+static const char *ades_id_names[3] = { "permID", "provID", "trkSub" };
+
+typedef struct
+{
+   bool in_tag, in_optical, skip_rest_of_tag;
+   char tag[40], text[ADES_FIELD_LEN];
+   size_t tag_len, text_len;
+   int curr_field;
+   char ids[3][ADES_FIELD_LEN];     /* first permID, provID, trkSub seen */
+} ades_parser_t;
+
+static void ades_parse_char( ades_parser_t *p, const char c)
+{
+   if( c == '<')
+      {
+      p->in_tag = true;
+      p->skip_rest_of_tag = false;
+      p->tag_len = 0;
+      }
+   else if( p->in_tag && c == '>')
+      {
+      const char *tag = p->tag;
+      int i;
+
+      p->in_tag = false;
+      p->tag[p->tag_len] = '\0';
+      if( !strcmp( tag, "optical"))
+         {
+         p->in_optical = true;
+         p->curr_field = -1;
+         }
+      else if( !strcmp( tag, "/optical"))
+         p->in_optical = false;
+      else if( p->in_optical && *tag != '/')
+         {
+         p->curr_field = -1;
+         for( i = 0; i < 3; i++)
+            if( !strcmp( tag, ades_id_names[i]) && !*p->ids[i])
+               p->curr_field = i;
+         p->text_len = 0;
+         }
+      else if( p->in_optical && p->curr_field >= 0
+                  && !strcmp( tag + 1, ades_id_names[p->curr_field]))
+         {
+         p->text[p->text_len] = '\0';
+         strcpy( p->ids[p->curr_field], p->text);
+         p->curr_field = -1;
+         }
+      }
+   else if( p->in_tag && !p->skip_rest_of_tag)
+      {
+      if( c <= ' ' || (c == '/' && p->tag_len))
+         p->skip_rest_of_tag = true;      /* ignore attributes,  etc. */
+      else if( p->tag_len < sizeof( p->tag) - 1)
+         p->tag[p->tag_len++] = c;
+      }
+   else if( p->curr_field >= 0 && p->text_len < ADES_FIELD_LEN - 1
+                  && (c != ' ' || p->text_len))
+      p->text[p->text_len++] = c;
+}
+
+/* The response is processed as a stream,  a chunk at a time,  as libcurl
+delivers it.  "\n" pairs are converted to line feeds;  text between
+'<ades version=' and '</ades>' blocks is discarded;  and the n-th block
+goes to the n-th 'sink'.  Each sink writes the output (ADES,  or 80-column
+data) to a temporary file in the same directory as the final output,  and
+the cleaned ADES to a temporary file for the download cache.  The ADES is
+always run through the parser,  so that the designations in each block
+are known.  Only if the number of blocks matches the number of objects
+requested,  and each block's designations match its object,  are those
+renamed into place (and stored in the cache).  So memory use doesn't
+depend on how many observations there are,  and a mismatched batch leaves
+no misleading 'fresh' output files behind.  */
+
+typedef struct
+{
+   const char *desig, *filename;
+   char out_name[300], ades_name[400];
+   char ids[3][ADES_FIELD_LEN];     /* permID, provID, trkSub of block */
+   FILE *ofile, *ades_file;
+} ades_sink_t;
+
+typedef struct
+{
+   ades_sink_t *sinks;
+   size_t n_sinks, n_blocks, match_len;
+   bool pending_backslash, in_block, cache_ades;
+   time_t t0;
+   ades_parser_t parser;
+} ades_stream_t;
+
+static const char *ades_start_marker = "<ades version=";
+static const char *ades_end_marker = "</ades>";
+
+static ades_sink_t *curr_sink( ades_stream_t *s)
+{
+   return( s->n_blocks < s->n_sinks ? s->sinks + s->n_blocks : NULL);
+}
+
+static void emit_ades_char( ades_stream_t *s, const char c)
+{
+   ades_sink_t *sink = curr_sink( s);
+
+   if( sink && sink->ofile)
+      {
+      if( sink->ades_file)
+         fputc( c, sink->ades_file);
+      ades_parse_char( &s->parser, c);
+      fputc( c, sink->ofile);
+      }
+}
+
+static void open_sink( ades_stream_t *s)
+{
+   ades_sink_t *sink = curr_sink( s);
+   int fd;
+
+   memset( &s->parser, 0, sizeof( ades_parser_t));
+   s->parser.curr_field = -1;
+   if( !sink)
+      return;
+   snprintf( sink->out_name, sizeof( sink->out_name), "%s.XXXXXX",
+                                    sink->filename);
+   fd = mkstemp( sink->out_name);
+   sink->ofile = (fd < 0 ? NULL : fdopen( fd, "wb"));
+   if( !sink->ofile)
+      {
+      fprintf( stderr, "Couldn't open temp file for '%s'\n", sink->filename);
+      return;
+      }
+   fprintf( sink->ofile, "COM UNIX time %ld (%.24s)\n", (long)s->t0,
+                  asctime( gmtime( &s->t0)));
+   fprintf( sink->ofile, "COM Obj %s\n", sink->desig);
+   fprintf( sink->ofile, "COM Format %s\n", output_format( ));
+   if( s->cache_ades)
+      sink->ades_file = dl_cache_temp_file( sink->ades_name,
+                                            sizeof( sink->ades_name));
+}
+
+static void stream_ades_char( ades_stream_t *s, const char c)
+{
+   if( !s->in_block)
+      {
+      if( c == ades_start_marker[s->match_len])
+         s->match_len++;
+      else
+         s->match_len = (c == '<' ? 1 : 0);
+      if( !ades_start_marker[s->match_len])
+         {
+         const char *tptr = ades_start_marker;
+
+         s->in_block = true;
+         s->match_len = 0;
+         open_sink( s);
+         while( *tptr)
+            emit_ades_char( s, *tptr++);
+         }
+      }
+   else
+      {
+      emit_ades_char( s, c);
+      if( c == ades_end_marker[s->match_len])
+         s->match_len++;
+      else
+         s->match_len = (c == '<' ? 1 : 0);
+      if( !ades_end_marker[s->match_len])
+         {
+         ades_sink_t *sink = curr_sink( s);
+
+         if( sink && sink->ofile)
+            fputc( '\n', sink->ofile);
+         if( sink)
+            memcpy( sink->ids, s->parser.ids, sizeof( sink->ids));
+         s->in_block = false;
+         s->match_len = 0;
+         s->n_blocks++;
+         }
+      }
+}
+
+static void stream_ades_data( ades_stream_t *s, const char *data, size_t n_bytes)
+{
+   while( n_bytes--)
+      {
+      const char c = *data++;
+
+      if( s->pending_backslash)
+         {
+         s->pending_backslash = false;
+         if( c == 'n')
+            {
+            stream_ades_char( s, '\n');
+            continue;
+            }
+         stream_ades_char( s, '\\');
+         }
+      if( c == '\\')
+         s->pending_backslash = true;
+      else
+         stream_ades_char( s, c);
+      }
+}
+
+static size_t ades_stream_write( char *ptr, size_t size, size_t nmemb,
+                                       void *context_ptr)
+{
+   stream_ades_data( (ades_stream_t *)context_ptr, ptr, size * nmemb);
+   return( size * nmemb);
+}
+
+static void obs_cache_key( char *key, const size_t key_size,
+                     const char *object_desig, const bool is_neocp)
+{
+   snprintf( key, key_size,
+            "https://data.minorplanetcenter.net/api/get-obs%s %s=%s XML",
+            (is_neocp ? "-neocp" : ""), (is_neocp ? "trksubs" : "desigs"),
+            object_desig);
+}
+
+static void init_ades_stream( ades_stream_t *s, ades_sink_t *sinks,
+                  const size_t n_sinks, const time_t t0, const bool cache_ades)
+{
+   memset( s, 0, sizeof( ades_stream_t));
+   memset( sinks, 0, n_sinks * sizeof( ades_sink_t));
+   s->sinks = sinks;
+   s->n_sinks = n_sinks;
+   s->t0 = t0;
+   s->cache_ades = cache_ades;
+}
+
+/* With '-8',  the ADES in a sink's temporary output file is run through
+lunar's ADES-to-80-column translator (the one 'ades2mpc' uses) into a
+second temporary file,  which replaces it.  The three 'COM' header lines
+are copied over unchanged.  */
+
+static bool convert_to_80_column( ades_sink_t *sink)
+{
+   char buff[400], xlated_name[300];
+   FILE *ifile = fopen( sink->out_name, "rb"), *ofile = NULL;
+   void *ades_context;
+   unsigned n_lines = 0;
+   int fd, i;
+   bool rval;
+
+   if( !ifile)
+      return( false);
+   snprintf( xlated_name, sizeof( xlated_name), "%s.XXXXXX", sink->filename);
+   fd = mkstemp( xlated_name);
+   if( fd >= 0)
+      ofile = fdopen( fd, "wb");
+   if( !ofile)
+      {
+      fprintf( stderr, "Couldn't open temp file for '%s'\n", sink->filename);
+      fclose( ifile);
+      return( false);
+      }
+   for( i = 0; i < 3 && fgets( buff, sizeof( buff), ifile); i++)
+      fputs( buff, ofile);
+   ades_context = init_ades2mpc( );
+   while( fgets_with_ades_xlation( buff, sizeof( buff), ades_context, ifile))
+      {
+      size_t len = strlen( buff);
+
+      while( len && (buff[len - 1] == '\n' || buff[len - 1] == '\r'))
+         len--;
+      fprintf( ofile, "%.*s\n", (int)len, buff);
+      n_lines++;
+      }
+   free_ades2mpc_context( ades_context);
+   fclose( ifile);
+   rval = !fclose( ofile);
+   unlink( sink->out_name);
+   strcpy( sink->out_name, xlated_name);
+   if( verbose)
+      printf( "%s : %u lines of 80-column data\n", sink->desig, n_lines);
+   return( rval);
+}
+
+/* If all went well,  output files are renamed into place and the ADES is
+stored in the cache.  Otherwise,  temporary files are just removed.
+Returns the number of objects that failed.  */
+
+static int finish_ades_stream( ades_stream_t *s, const bool is_neocp,
+                               const bool ok)
+{
+   size_t i;
+   int n_failed = 0;
+
+   if( s->pending_backslash)
+      stream_ades_char( s, '\\');
+   for( i = 0; i < s->n_sinks; i++)
+      {
+      ades_sink_t *sink = s->sinks + i;
+      bool got_it = (ok && s->n_blocks == s->n_sinks && sink->ofile);
+
+      if( sink->ofile && fclose( sink->ofile))
+         got_it = false;
+      if( got_it && eighty_column_output && !convert_to_80_column( sink))
+         got_it = false;
+      if( sink->ades_file)
+         {
+         fclose( sink->ades_file);
+         if( got_it)
+            {
+            char key[200];
+
+            obs_cache_key( key, sizeof( key), sink->desig, is_neocp);
+            dl_cache_store_file( key, sink->ades_name);
+            }
+         unlink( sink->ades_name);
+         }
+      if( got_it && rename( sink->out_name, sink->filename))
+         {
+         fprintf( stderr, "Couldn't write '%s'\n", sink->filename);
+         got_it = false;
+         }
+      if( !got_it)
+         {
+         if( sink->ofile)
+            unlink( sink->out_name);
+         n_failed++;
+         }
+      }
+   return( n_failed);
+}
+
+/* If a request has to be retried,  whatever partial output it produced
+is discarded,  and the stream starts over.   */
+
+static void reset_ades_stream( void *context)
+{
+   ades_stream_t *s = (ades_stream_t *)context;
+   size_t i;
+
+   finish_ades_stream( s, false, false);
+   for( i = 0; i < s->n_sinks; i++)
+      s->sinks[i].ofile = s->sinks[i].ades_file = NULL;
+   s->n_blocks = s->match_len = 0;
+   s->pending_backslash = s->in_block = false;
+}
+
+/* True if each block's permID,  provID,  or trkSub is the designation
+that was requested for that sink.  A block with no observations has no
+designations to check,  and is treated as a mismatch.   */
+
+static bool blocks_match_desigs( const ades_stream_t *s)
+{
+   size_t i;
+
+   for( i = 0; i < s->n_sinks; i++)
+      {
+      const ades_sink_t *sink = s->sinks + i;
+      int j;
+
+      for( j = 0; j < 3; j++)
+         if( !strcmp( sink->ids[j], sink->desig))
+            break;
+      if( j == 3)
+         {
+         if( verbose)
+            printf( "Block %u is for '%s'/'%s'/'%s',  not '%s'\n", (unsigned)i,
+                     sink->ids[0], sink->ids[1], sink->ids[2], sink->desig);
+         return( false);
+         }
+      }
+   return( true);
+}
+
+/* Asks the get-obs API for astrometry for 'n_desigs' objects,  streaming
+the response through 's'.  Transient failures are retried.  */
+
+static int fetch_observations( const char **desigs, const size_t n_desigs,
+                  const bool is_neocp, ades_stream_t *stream)
+{
+   CURL *curl = get_curl_handle( );
+   struct curl_slist *headers = NULL;
+   char *json, url[80];
+   size_t i, json_len = 100;
+   CURLcode res;
+
+   for( i = 0; i < n_desigs; i++)
+      json_len += strlen( desigs[i]) + 4;
+   json = (char *)malloc( json_len);
+   snprintf( json, json_len, "{ \"%s\": [", (is_neocp ? "trksubs" : "desigs"));
+   for( i = 0; i < n_desigs; i++)
+      {
+      strcat( json, (i ? ", \"" : "\""));
+      strcat( json, desigs[i]);
+      strcat( json, "\"");
+      }
+   strcat( json, "], \"output_format\":[\"XML\"]}");
+   snprintf( url, sizeof( url), "https://data.minorplanetcenter.net/api/get-obs%s",
+                  (is_neocp ? "-neocp" : ""));
+   if( verbose)
+      printf( "%s\n%s\n", url, json);
+   headers = curl_slist_append( headers, "Content-Type: application/json");
+   url_fetch_set_url( curl, url);
+   curl_easy_setopt( curl, CURLOPT_CUSTOMREQUEST, "GET");
+   curl_easy_setopt( curl, CURLOPT_HTTPHEADER, headers);
+   curl_easy_setopt( curl, CURLOPT_POSTFIELDS, json);
+   curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, ades_stream_write);
+   curl_easy_setopt( curl, CURLOPT_WRITEDATA, stream);
+   res = url_fetch_perform( curl, reset_ades_stream, stream);
+   curl_slist_free_all( headers);
+   free( json);
+   if( res)
+      {
+      fprintf( stderr, "Error %d\n%s\n", (int)res, curl_easy_strerror( res));
+      return( -3);
+      }
+   return( 0);
+}
+
+/* Cached ADES is run through the same stream,  so that it can be
+converted to 80-column form if desired.  */
+
+static bool save_from_cache( const char *filename, const char *object_desig,
+                const bool is_neocp, const time_t t0)
+{
+   char key[200], buff[8192];
+   FILE *ifile;
+   ades_stream_t stream;
+   ades_sink_t sink;
+   size_t n_read;
+
+   obs_cache_key( key, sizeof( key), object_desig, is_neocp);
+   ifile = dl_cache_open( key, (long)delay_between_reloads);
+   if( !ifile)
+      return( false);
+   if( verbose)
+      printf( "Using cached ADES for '%s'\n", object_desig);
+   init_ades_stream( &stream, &sink, 1, t0, false);
+   sink.filename = filename;
+   sink.desig = object_desig;
+   while( (n_read = fread( buff, 1, sizeof( buff), ifile)) > 0)
+      stream_ades_data( &stream, buff, n_read);
+   fclose( ifile);
+   return( !finish_ades_stream( &stream, is_neocp, true));
+}
+
+/* Returns true if 'filename' has data for 'object_desig',  in the output
+format currently asked for,  that is no more than delay_between_reloads
+seconds old.   */
+
+static bool previous_download_is_fresh( const char *filename,
+                     const char *object_desig, const time_t t0)
 {
    FILE *fp = fopen( filename, "rb");
-   int err_code, rval = 0;
-   char command[250];
-   const time_t t0 = time( NULL);
-   const char *format = "curl -X GET -H \"Content-Type: application/json\" " \
-              "-d '{ \"%s\": [\"%s\"], \"output_format\":[\"XML\"]}' "  \
-              "https://data.minorplanetcenter.net/api/get-obs%s -o%s -s";
+   bool rval = false;
 
    if( fp)
       {
@@ -104,73 +626,163 @@ static int download_astrometry( const char *filename, const char *object_desig,
                   && fgets( tbuff, sizeof( tbuff), fp)
                   && !memcmp( tbuff, "COM Obj ", 8)
                   && !memcmp( tbuff + 8, object_desig, strlen( object_desig))
-                  && tbuff[strlen( object_desig) + 8] < ' ')
+                  && tbuff[strlen( object_desig) + 8] < ' '
+                  && fgets( tbuff, sizeof( tbuff), fp)
+                  && !memcmp( tbuff, "COM Format ", 11)
+                  && !memcmp( tbuff + 11, output_format( ), strlen( output_format( )))
+                  && tbuff[strlen( output_format( )) + 11] < ' ')
          {
          if( verbose)
             printf( "Previous download isn't stale yet\n");
-         return( 0);
+         rval = true;
          }
-      if( verbose)
+      else if( verbose)
          printf( "Got to '%s'\n", tbuff);
       fclose( fp);
       }
+   return( rval);
+}
 
-   snprintf( command, sizeof( command), format,
-                  (is_neocp ? "trksubs" : "desigs"),
-                  object_desig,
-                  (is_neocp ? "-neocp" : ""),
-                  filename);
-   if( verbose)
-      printf( "%s\n", command);
-   err_code = system( command);
-   if( err_code)
-      {
-      fprintf( stderr, "Error %d\n", err_code);
-      rval = -3;
-      }
-   else
+static int download_astrometry( const char *filename, const char *object_desig,
+                  const bool is_neocp)
+{
+   int rval;
+   const time_t t0 = time( NULL);
+   ades_stream_t stream;
+   ades_sink_t sink;
+
+   if( previous_download_is_fresh( filename, object_desig, t0))
+      return( 0);
+   if( save_from_cache( filename, object_desig, is_neocp, t0))
+      return( 0);
+   init_ades_stream( &stream, &sink, 1, t0, true);
+   sink.filename = filename;
+   sink.desig = object_desig;
+   rval = fetch_observations( &object_desig, 1, is_neocp, &stream);
+   if( !stream.n_blocks && !rval)
+      rval = -1;
+   if( finish_ades_stream( &stream, is_neocp, !rval) && !rval)
+      rval = -2;
+   return( rval);
+}
+
+static int download_one_object( const char *filename, const char *object_desig)
+{
+   int rval = download_astrometry( filename, object_desig, false);
+
+   if( -1 == rval && strlen( object_desig) < 8)
+      rval = download_astrometry( filename, object_desig, true);
+   return( rval);
+}
+
+static size_t batch_size = 50;
+
+/* Objects whose previous downloads (or cached ADES) are still fresh are
+dropped from the list,  and the rest are requested 'batch_size' at a time.  Returns the
+number of objects for which we failed to get astrometry.  */
+
+static int download_batch( const char **filenames, const char **desigs,
+                           const size_t n_objs)
+{
+   const time_t t0 = time( NULL);
+   const char **batch_desigs = (const char **)calloc( batch_size, sizeof( char *));
+   size_t *batch_idx = (size_t *)calloc( batch_size, sizeof( size_t));
+   ades_sink_t *sinks = (ades_sink_t *)calloc( batch_size, sizeof( ades_sink_t));
+   size_t i = 0, j, n_in_batch;
+   int n_failed = 0;
+
+   assert( batch_desigs && batch_idx && sinks);
+   while( i < n_objs)
       {
-      size_t i, j, len, bytes_read;
-      char *buff, *tptr;
-
-      fp = fopen( filename, "rb");
-      assert( fp);
-      fseek( fp, 0L, SEEK_END);
-      len = (size_t)ftell( fp);
-      fseek( fp, 0L, SEEK_SET);
-      buff = (char *)malloc( len + 1);
-      buff[len] = '\0';
-      bytes_read = fread( buff, 1, len, fp);
-      assert( bytes_read == len);
-      fclose( fp);
-      for( i = j = 0; i < len; i++, j++)
-         if( buff[i] == '\\' && buff[i + 1] == 'n')
+      for( n_in_batch = 0; i < n_objs && n_in_batch < batch_size; i++)
+         if( !previous_download_is_fresh( filenames[i], desigs[i], t0)
+                && !save_from_cache( filenames[i], desigs[i], false, t0))
             {
-            buff[j] = '\n';
-            i++;
+            batch_idx[n_in_batch] = i;
+            batch_desigs[n_in_batch++] = desigs[i];
             }
-         else
-            buff[j] = buff[i];
-      buff[j] = '\0';
-      tptr = strstr( buff, "</ades>");
-      if( tptr)
-         {
-         tptr[7] = '\n';
-         tptr[8] = '\0';
-         tptr = strstr( buff, "<ades version=");
-         assert( tptr);
-         fp = fopen( filename, "wb");
-         assert( fp);
-
-         fprintf( fp, "COM UNIX time %ld (%.24s)\n", (long)t0, asctime( gmtime( &t0)));
-         fprintf( fp, "COM Obj %s\n", object_desig);
-         fwrite( tptr, 1, strlen( tptr), fp);
-         fclose( fp);
+      if( !n_in_batch)
+         continue;
+      {
+      ades_stream_t stream;
+      int err;
+
+      init_ades_stream( &stream, sinks, n_in_batch, t0, true);
+      for( j = 0; j < n_in_batch; j++)
+         {
+         sinks[j].filename = filenames[batch_idx[j]];
+         sinks[j].desig = desigs[batch_idx[j]];
          }
-      else
-         rval = -1;
-      free( buff);
+      err = fetch_observations( batch_desigs, n_in_batch, false, &stream);
+      if( !err && stream.n_blocks == n_in_batch
+                     && blocks_match_desigs( &stream))
+         {
+         n_failed += finish_ades_stream( &stream, false, true);
+         continue;
+         }
+      finish_ades_stream( &stream, false, false);
+      if( verbose && !err)
+         printf( "%u blocks for %u objects,  or mismatched;  trying one at a time\n",
+                     (unsigned)stream.n_blocks, (unsigned)n_in_batch);
+      }
+      for( j = 0; j < n_in_batch; j++)
+         if( download_one_object( filenames[batch_idx[j]], desigs[batch_idx[j]]))
+            n_failed++;
+      }
+   free( sinks);
+   free( batch_desigs);
+   free( batch_idx);
+   return( n_failed);
+}
+
+/* Each line of the list file gives an output filename,  then the
+object designation (which may contain spaces).  */
+
+static int download_from_list( const char *list_filename)
+{
+   FILE *ifile = fopen( list_filename, "rb");
+   char buff[200], **filenames = NULL, **desigs = NULL;
+   size_t n_objs = 0, n_alloced = 0, i;
+   int rval;
+
+   if( !ifile)
+      {
+      fprintf( stderr, "Couldn't open list file '%s'\n", list_filename);
+      return( -1);
+      }
+   while( fgets( buff, sizeof( buff), ifile))
+      {
+      char *tptr;
+
+      for( i = strlen( buff); i && buff[i - 1] <= ' '; i--)
+         ;
+      buff[i] = '\0';
+      if( *buff == '#' || !(tptr = strchr( buff, ' ')))
+         continue;
+      *tptr++ = '\0';
+      while( *tptr == ' ')
+         tptr++;
+      if( n_objs == n_alloced)
+         {
+         n_alloced = (n_alloced ? n_alloced * 2 : 64);
+         filenames = (char **)realloc( filenames, n_alloced * sizeof( char *));
+         desigs = (char **)realloc( desigs, n_alloced * sizeof( char *));
+         assert( filenames && desigs);
+         }
+      filenames[n_objs] = (char *)malloc( strlen( buff) + strlen( tptr) + 2);
+      strcpy( filenames[n_objs], buff);
+      desigs[n_objs] = filenames[n_objs] + strlen( buff) + 1;
+      strcpy( desigs[n_objs], tptr);
+      n_objs++;
       }
+   fclose( ifile);
+   rval = download_batch( (const char **)filenames, (const char **)desigs, n_objs);
+   if( verbose || rval)
+      printf( "%u objects;  %d failed\n", (unsigned)n_objs, rval);
+   for( i = 0; i < n_objs; i++)
+      free( filenames[i]);
+   free( filenames);
+   free( desigs);
    return( rval);
 }
 
@@ -180,10 +792,42 @@ int main( const int argc, const char **argv)
    char object_desig[30];
    int rval;
 
+   assert( argc > 1);
+   for( i = 1; i < (size_t)argc; i++)
+      if( argv[i][0] == '-' && argv[i][1] == 'n')
+         {
+         const int new_size = atoi( argv[i] + 2);
+
+         if( new_size < 0)
+            {
+            fprintf( stderr, "Batch size can't be negative : '%s'\n", argv[i]);
+            return( -1);
+            }
+         batch_size = (size_t)new_size;
+         }
+      else if( argv[i][0] == '-' && argv[i][1] == 'v')
+         verbose = 1;
+      else if( argv[i][0] == '-' && argv[i][1] == 't')
+         delay_between_reloads = atoi( argv[i] + 2);
+      else if( argv[i][0] == '-' && argv[i][1] == '8')
+         eighty_column_output = true;
+   if( !batch_size)
+      batch_size = 1;
+   for( i = 1; i < (size_t)argc; i++)
+      if( argv[i][0] == '-' && argv[i][1] == 'b')
+         {
+         rval = download_from_list( argv[i] + 2);
+         cleanup_curl( );
+         return( rval);
+         }
    assert( argc > 2);
    if( 3 == argc)                /* simply downloading a file */
       if( !memcmp( argv[2], "http", 4) || !memcmp( argv[2], "ftp", 3))
-         return( grab_file( argv[2], argv[1]));
+         {
+         rval = grab_file( argv[2], argv[1]);
+         cleanup_curl( );
+         return( rval);
+         }
    *object_desig = '\0';
    for( i = 2; i < (size_t)argc; i++)
       if( argv[i][0] != '-')    /* not a command-line option; */
@@ -198,7 +842,8 @@ int main( const int argc, const char **argv)
             verbose = 1;
             break;
          case 't':
-            delay_between_reloads = atoi( argv[i] + 2);
+         case 'n':
+         case '8':
             break;
          default:
             fprintf( stderr, "Argument '%s' not recognized\n", argv[i]);
@@ -208,8 +853,7 @@ int main( const int argc, const char **argv)
    assert( strlen( object_desig) < sizeof( object_desig) - 1);
    if( verbose)
       printf( "Object desig '%s'\n", object_desig);
-   rval = download_astrometry( argv[1], object_desig, false);
-   if( -1 == rval && strlen( object_desig) < 8)
-      rval = download_astrometry( argv[1], object_desig, true);
+   rval = download_one_object( argv[1], object_desig);
+   cleanup_curl( );
    return( rval);
 }
@@ -0,0 +1,337 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gz_input.h"
+#ifndef _WIN32
+#include <pthread.h>
+#include <zlib.h>
+#endif
+
+/* MPC distributes MPCORB.DAT,  NumObs.txt,  etc. gzipped.  Rather than
+gunzip them to disk first,  tools can open them with gz_input_open() and
+read lines with gz_input_gets() (or blocks with gz_input_read()),  much
+as with fopen(),  fgets(),  and fread().
+
+   If the file starts with the gzip 'magic' bytes,  a thread is started
+that reads the compressed data and inflates it into a ring buffer of
+GZ_INPUT_RING_SIZE bytes;  gz_input_gets() takes lines from the other
+end.  So inflation runs on one core while the caller parses on another.
+Concatenated gzip members (as made by 'cat a.gz b.gz') are handled.  The
+consumer only takes the lock when it has used up what it knew to be
+available,  and returns space to the producer in quarter-ring batches,
+so the locking cost is negligible.
+
+   Other files are simply read with stdio.  For those (only),
+gz_input_file() returns the underlying FILE,  so callers can seek or
+memory-map the file.  gz_input_tell() gives the position in the
+uncompressed data.
+
+   Windows builds (MinGW cross-compiles) have neither zlib nor pthreads,
+so there,  only plain files are read,  and gzipped ones are rejected with
+a message suggesting they be gunzipped first.  */
+
+#ifdef _WIN32
+struct gz_input
+{
+   FILE *ifile;
+};
+
+gz_input_t *gz_input_open( const char *filename)
+{
+   FILE *ifile = fopen( filename, "rb");
+   gz_input_t *in;
+
+   if( !ifile)
+      return( NULL);
+   if( getc( ifile) == 0x1f && getc( ifile) == 0x8b)
+      {
+      fprintf( stderr, "'%s' is gzipped;  gunzip it first\n", filename);
+      fclose( ifile);
+      return( NULL);
+      }
+   rewind( ifile);
+   in = (gz_input_t *)calloc( 1, sizeof( gz_input_t));
+   in->ifile = ifile;
+   return( in);
+}
+
+char *gz_input_gets( char *buff, const int size, gz_input_t *in)
+{
+   return( fgets( buff, size, in->ifile));
+}
+
+size_t gz_input_read( void *buff, const size_t size, gz_input_t *in)
+{
+   return( fread( buff, 1, size, in->ifile));
+}
+
+long long gz_input_tell( gz_input_t *in)
+{
+   return( (long long)ftell( in->ifile));
+}
+
+FILE *gz_input_file( gz_input_t *in)
+{
+   return( in->ifile);
+}
+
+int gz_input_close( gz_input_t *in)
+{
+   fclose( in->ifile);
+   free( in);
+   return( 0);
+}
+#else
+struct gz_input
+{
+   FILE *ifile;
+   const char *filename;
+   bool compressed;
+   char *ring;
+   unsigned long long head;        /* total bytes inflated so far */
+   unsigned long long tail;        /* total bytes released by the reader */
+   unsigned long long rpos;        /* reader's position (private) */
+   unsigned long long known_head;  /* last 'head' the reader saw */
+   bool eof, stop, error;
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   pthread_cond_t data_ready, space_ready;
+};
+
+#define INFLATE_CHUNK   (256 * 1024)
+
+static void *inflate_thread( void *arg)
+{
+   gz_input_t *in = (gz_input_t *)arg;
+   unsigned char *ibuff = (unsigned char *)malloc( INFLATE_CHUNK);
+   z_stream zs;
+   bool stream_ended = false, stop = false;
+   int rval = Z_OK;
+
+   memset( &zs, 0, sizeof( zs));
+   if( !ibuff || inflateInit2( &zs, 15 + 32) != Z_OK)
+      in->error = true;
+   while( !in->error)
+      {
+      size_t start, len;
+
+      if( !zs.avail_in)
+         {
+         zs.avail_in = (uInt)fread( ibuff, 1, INFLATE_CHUNK, in->ifile);
+         zs.next_in = ibuff;
+         if( !zs.avail_in)
+            {
+            in->error = !stream_ended;     /* truncated file */
+            break;
+            }
+         }
+      if( stream_ended)          /* another gzip member follows */
+         {
+         inflateReset( &zs);
+         stream_ended = false;
+         }
+      pthread_mutex_lock( &in->mutex);
+      while( !in->stop && in->head - in->tail == GZ_INPUT_RING_SIZE)
+         pthread_cond_wait( &in->space_ready, &in->mutex);
+      start = (size_t)( in->head % GZ_INPUT_RING_SIZE);
+      len = GZ_INPUT_RING_SIZE - (size_t)( in->head - in->tail);
+      stop = in->stop;
+      pthread_mutex_unlock( &in->mutex);
+      if( stop)
+         break;
+      if( len > GZ_INPUT_RING_SIZE - start)
+         len = GZ_INPUT_RING_SIZE - start;
+      zs.next_out = (Bytef *)in->ring + start;
+      zs.avail_out = (uInt)len;
+      rval = inflate( &zs, Z_NO_FLUSH);
+      if( rval == Z_STREAM_END)
+         stream_ended = true;
+      else if( rval != Z_OK && rval != Z_BUF_ERROR)
+         in->error = true;
+      pthread_mutex_lock( &in->mutex);
+      in->head += len - zs.avail_out;
+      pthread_cond_signal( &in->data_ready);
+      pthread_mutex_unlock( &in->mutex);
+      }
+   if( in->error)
+      fprintf( stderr, "'%s': corrupt or truncated gzip data\n", in->filename);
+   inflateEnd( &zs);
+   free( ibuff);
+   pthread_mutex_lock( &in->mutex);
+   in->eof = true;
+   pthread_cond_signal( &in->data_ready);
+   pthread_mutex_unlock( &in->mutex);
+   return( NULL);
+}
+
+gz_input_t *gz_input_open( const char *filename)
+{
+   FILE *ifile = fopen( filename, "rb");
+   gz_input_t *in;
+   int c1, c2;
+
+   if( !ifile)
+      return( NULL);
+   in = (gz_input_t *)calloc( 1, sizeof( gz_input_t));
+   in->ifile = ifile;
+   in->filename = filename;
+   c1 = getc( ifile);
+   c2 = getc( ifile);
+   rewind( ifile);
+   if( c1 == 0x1f && c2 == 0x8b)
+      {
+      in->compressed = true;
+      in->ring = (char *)malloc( GZ_INPUT_RING_SIZE);
+      pthread_mutex_init( &in->mutex, NULL);
+      pthread_cond_init( &in->data_ready, NULL);
+      pthread_cond_init( &in->space_ready, NULL);
+      if( !in->ring || pthread_create( &in->thread, NULL, inflate_thread, in))
+         {
+         fclose( ifile);
+         free( in->ring);
+         free( in);
+         return( NULL);
+         }
+      }
+   return( in);
+}
+
+/* Makes sure at least one byte is available to the reader,  if possible.
+Returns the number of contiguous bytes available (0 at end of file).  */
+
+static size_t bytes_available( gz_input_t *in)
+{
+   size_t rval;
+
+   if( in->rpos == in->known_head)
+      {
+      pthread_mutex_lock( &in->mutex);
+      in->tail = in->rpos;
+      pthread_cond_signal( &in->space_ready);
+      while( in->head == in->rpos && !in->eof)
+         pthread_cond_wait( &in->data_ready, &in->mutex);
+      in->known_head = in->head;
+      pthread_mutex_unlock( &in->mutex);
+      }
+   else if( in->rpos - in->tail > GZ_INPUT_RING_SIZE / 4)
+      {
+      pthread_mutex_lock( &in->mutex);
+      in->tail = in->rpos;
+      pthread_cond_signal( &in->space_ready);
+      pthread_mutex_unlock( &in->mutex);
+      }
+   rval = (size_t)( in->known_head - in->rpos);
+   if( rval > GZ_INPUT_RING_SIZE - in->rpos % GZ_INPUT_RING_SIZE)
+      rval = GZ_INPUT_RING_SIZE - in->rpos % GZ_INPUT_RING_SIZE;
+   return( rval);
+}
+
+/* Same semantics as fgets():  reads up to size - 1 bytes,  stopping after
+a line feed.  Returns NULL if nothing could be read.  */
+
+char *gz_input_gets( char *buff, const int size, gz_input_t *in)
+{
+   size_t n = 0;
+   bool got_eol = false;
+
+   if( !in->compressed)
+      return( fgets( buff, size, in->ifile));
+   while( !got_eol && n + 1 < (size_t)size)
+      {
+      size_t avail = bytes_available( in);
+      const char *src = in->ring + in->rpos % GZ_INPUT_RING_SIZE;
+      const char *eol;
+
+      if( !avail)
+         break;
+      if( avail > (size_t)size - 1 - n)
+         avail = (size_t)size - 1 - n;
+      eol = (const char *)memchr( src, '\n', avail);
+      if( eol)
+         {
+         avail = eol + 1 - src;
+         got_eol = true;
+         }
+      memcpy( buff + n, src, avail);
+      n += avail;
+      in->rpos += avail;
+      }
+   buff[n] = '\0';
+   return( n ? buff : NULL);
+}
+
+/* Same semantics as fread( buff, 1, size, ifile).   */
+
+size_t gz_input_read( void *buff, const size_t size, gz_input_t *in)
+{
+   size_t n = 0;
+
+   if( !in->compressed)
+      return( fread( buff, 1, size, in->ifile));
+   while( n < size)
+      {
+      size_t avail = bytes_available( in);
+
+      if( !avail)
+         break;
+      if( avail > size - n)
+         avail = size - n;
+      memcpy( (char *)buff + n, in->ring + in->rpos % GZ_INPUT_RING_SIZE, avail);
+      n += avail;
+      in->rpos += avail;
+      }
+   return( n);
+}
+
+long long gz_input_tell( gz_input_t *in)
+{
+   return( in->compressed ? (long long)in->rpos : (long long)ftell( in->ifile));
+}
+
+FILE *gz_input_file( gz_input_t *in)
+{
+   return( in->compressed ? NULL : in->ifile);
+}
+
+/* Returns -1 if the gzip data was corrupt or truncated.  (Closing before
+reading everything is fine.)   */
+
+int gz_input_close( gz_input_t *in)
+{
+   int rval = 0;
+
+   if( in->compressed)
+      {
+      pthread_mutex_lock( &in->mutex);
+      in->stop = true;
+      pthread_cond_signal( &in->space_ready);
+      pthread_mutex_unlock( &in->mutex);
+      pthread_join( in->thread, NULL);
+      rval = (in->error ? -1 : 0);
+      pthread_mutex_destroy( &in->mutex);
+      pthread_cond_destroy( &in->data_ready);
+      pthread_cond_destroy( &in->space_ready);
+      free( in->ring);
+      }
+   fclose( in->ifile);
+   free( in);
+   return( rval);
+}
+#endif
@@ -0,0 +1,33 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Line input from plain or gzipped files,  for mpcorbx,  get_objs,
+ast_diff,  and orb_hist.  See 'gz_input.c' for details.   */
+
+#define GZ_INPUT_RING_SIZE   (4 << 20)
+
+typedef struct gz_input gz_input_t;
+
+gz_input_t *gz_input_open( const char *filename);
+char *gz_input_gets( char *buff, const int size, gz_input_t *in);
+size_t gz_input_read( void *buff, const size_t size, gz_input_t *in);
+long long gz_input_tell( gz_input_t *in);
+FILE *gz_input_file( gz_input_t *in);
+int gz_input_close( gz_input_t *in);
@@ -0,0 +1,571 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <curl/curl.h>
+
+/* A local stand-in for the MPC/JPL servers,  so that neocp,  neocp2,
+grab_mpc,  grab_new,  mpecer,  and my_wget can be tested and benchmarked
+with no network access.  Those tools all set URLs via 'url_fetch.c';  if
+the environment variable URL_FETCH_REPLAY is set to (say)
+'http://127.0.0.1:8642',  a request for
+
+https://www.minorplanetcenter.net/iau/NEO/neocp.txt
+
+   is sent here as
+
+http://127.0.0.1:8642/www.minorplanetcenter.net/iau/NEO/neocp.txt
+
+   and answered with the contents of
+
+(recording dir)/www.minorplanetcenter.net/iau/NEO/neocp.txt
+
+   Characters other than letters,  digits,  and ._-/ are replaced with
+'_' (so '?what=obs' becomes '_what_obs'),  as is a '.' starting a path
+component,  so that '..' can't reach outside the recording directory.  If the request has a body
+(grab_new's JSON requests),  '_' and a 16-hex-digit FNV-1a hash of the
+body are appended.  A missing recording gets a 404,  and its expected
+file name is logged.  With '-r',  missing recordings are instead fetched
+from the real server (https) and saved,  so a recording directory can
+be made just by running the tools once with '-r'.
+
+   Range requests,  HEAD,  keep-alive,  and conditional requests (an
+If-None-Match matching our ETag,  or an If-Modified-Since equal to our
+Last-Modified,  gets a 304) are supported.  Options :
+
+   -p(port)      Port to listen on (default 8642)
+   -l(ms)        Latency added before each response
+   -b(bytes/s)   Per-connection bandwidth limit
+   -e(pct)       Percentage of requests answered with a 503
+   -x(pct)       Percentage of responses truncated partway through
+   -3(pct)       Percentage of requests answered with a 304 regardless
+   -s(seed)      Random seed,  for repeatable error injection
+   -r            Record mode (see above)
+
+   Each response is logged to stdout as
+
+(method) (path) (status) (bytes sent) (ms)
+
+   which 'replay_bench.sh' totals up.  */
+
+static const char *recording_dir;
+static long latency_ms = 0, bytes_per_sec = 0;
+static double error_pct = 0., truncate_pct = 0., not_modified_pct = 0.;
+static bool record_mode = false;
+static unsigned random_seed = 1;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define MAX_HEADER 16384
+#define SEND_CHUNK 4096
+
+static double current_ms( void)
+{
+   struct timeval tv;
+
+   gettimeofday( &tv, NULL);
+   return( (double)tv.tv_sec * 1000. + (double)tv.tv_usec / 1000.);
+}
+
+static void sleep_ms( const double ms)
+{
+   if( ms > 0.)
+      {
+      struct timespec t;
+
+      t.tv_sec = (time_t)( ms / 1000.);
+      t.tv_nsec = (long)( (ms - (double)t.tv_sec * 1000.) * 1e+6);
+      nanosleep( &t, NULL);
+      }
+}
+
+/* Returns true 'pct' percent of the time.  All threads share one
+random sequence,  so that a given seed gives the same injected errors
+(given the same order of requests).    */
+
+static bool roll_dice( const double pct)
+{
+   bool rval;
+
+   if( pct <= 0.)
+      return( false);
+   pthread_mutex_lock( &mutex);
+   rval = ((double)rand( ) / ((double)RAND_MAX + 1.) * 100. < pct);
+   pthread_mutex_unlock( &mutex);
+   return( rval);
+}
+
+static uint64_t fnv1a_hash( const char *data, size_t len)
+{
+   uint64_t rval = 0xcbf29ce484222325u;
+
+   while( len--)
+      {
+      rval ^= (uint64_t)(unsigned char)*data++;
+      rval *= 0x100000001b3u;
+      }
+   return( rval);
+}
+
+static void make_filename( char *filename, const size_t max_len,
+                const char *target, const char *body, const size_t body_len)
+{
+   size_t i, j = strlen( recording_dir);
+
+   snprintf( filename, max_len, "%s/", recording_dir);
+   j++;
+   while( *target == '/')
+      target++;
+   for( i = 0; target[i] && j < max_len - 20; i++)
+      {
+      const char c = target[i];
+      const bool starts_component = (!i || target[i - 1] == '/');
+
+      if( c == '.' && starts_component)     /* no '..' or hidden files */
+         filename[j++] = '_';
+      else
+         filename[j++] = ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+                  || (c >= '0' && c <= '9') || strchr( "._-/", c) ? c : '_');
+      }
+   filename[j] = '\0';
+   if( body_len)
+      snprintf( filename + j, max_len - j, "_%016llx",
+                     (unsigned long long)fnv1a_hash( body, body_len));
+}
+
+/* Creates any missing directories leading up to 'filename'.  */
+
+static void make_path( const char *filename)
+{
+   char *path = (char *)malloc( strlen( filename) + 1), *tptr;
+
+   strcpy( path, filename);
+   for( tptr = path + 1; (tptr = strchr( tptr, '/')) != NULL; tptr++)
+      {
+      *tptr = '\0';
+      mkdir( path, 0755);
+      *tptr = '/';
+      }
+   free( path);
+}
+
+/* In record mode,  a missing file is fetched from the real server,  with
+the same method and body,  and saved.   */
+
+static int record_response( const char *target, const char *filename,
+            const char *method, const char *body, const size_t body_len)
+{
+   CURL *curl = curl_easy_init( );
+   char *url = (char *)malloc( strlen( target) + 10), tname[600];
+   FILE *ofile;
+   CURLcode res;
+   long response_code = 0;
+
+   assert( curl && url);
+   while( *target == '/')
+      target++;
+   strcpy( url, "https://");
+   strcat( url, target);
+   make_path( filename);
+   snprintf( tname, sizeof( tname), "%s.tmp", filename);
+   ofile = fopen( tname, "wb");
+   if( !ofile)
+      {
+      free( url);
+      curl_easy_cleanup( curl);
+      return( -1);
+      }
+   curl_easy_setopt( curl, CURLOPT_URL, url);
+   curl_easy_setopt( curl, CURLOPT_WRITEDATA, ofile);
+   curl_easy_setopt( curl, CURLOPT_FOLLOWLOCATION, 1L);
+   if( body_len)
+      {
+      struct curl_slist *headers = NULL;
+
+      headers = curl_slist_append( headers, "Content-Type: application/json");
+      curl_easy_setopt( curl, CURLOPT_HTTPHEADER, headers);
+      curl_easy_setopt( curl, CURLOPT_CUSTOMREQUEST, method);
+      curl_easy_setopt( curl, CURLOPT_POSTFIELDS, body);
+      curl_easy_setopt( curl, CURLOPT_POSTFIELDSIZE, (long)body_len);
+      res = curl_easy_perform( curl);
+      curl_slist_free_all( headers);
+      }
+   else
+      res = curl_easy_perform( curl);
+   curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &response_code);
+   curl_easy_cleanup( curl);
+   fclose( ofile);
+   free( url);
+   if( res || response_code >= 400)
+      {
+      unlink( tname);
+      return( -1);
+      }
+   return( rename( tname, filename));
+}
+
+static bool send_all( const int fd, const char *data, size_t len)
+{
+   while( len)
+      {
+      const ssize_t n_sent = send( fd, data, len, MSG_NOSIGNAL);
+
+      if( n_sent <= 0)
+         return( false);
+      data += n_sent;
+      len -= (size_t)n_sent;
+      }
+   return( true);
+}
+
+/* Body data is sent in SEND_CHUNK pieces,  with pauses to keep within
+the bandwidth limit (if any).  Returns the number of bytes sent.   */
+
+static size_t send_file_data( const int fd, FILE *ifile, const long offset,
+                              size_t len)
+{
+   char buff[SEND_CHUNK];
+   size_t n_sent = 0;
+   const double t0 = current_ms( );
+
+   fseek( ifile, offset, SEEK_SET);
+   while( len)
+      {
+      const size_t n_read = fread( buff, 1, (len > SEND_CHUNK ? SEND_CHUNK : len),
+                                   ifile);
+
+      if( !n_read || !send_all( fd, buff, n_read))
+         break;
+      n_sent += n_read;
+      len -= n_read;
+      if( bytes_per_sec)
+         sleep_ms( (double)n_sent * 1000. / (double)bytes_per_sec
+                        - (current_ms( ) - t0));
+      }
+   return( n_sent);
+}
+
+static const char *header_value( const char *headers, const char *name)
+{
+   const size_t len = strlen( name);
+   const char *tptr = headers;
+
+   while( (tptr = strchr( tptr, '\n')) != NULL)
+      {
+      tptr++;
+      if( !strncasecmp( tptr, name, len) && tptr[len] == ':')
+         {
+         tptr += len + 1;
+         while( *tptr == ' ')
+            tptr++;
+         return( tptr);
+         }
+      }
+   return( NULL);
+}
+
+static bool header_matches( const char *headers, const char *name,
+                            const char *value)
+{
+   const char *tptr = header_value( headers, name);
+
+   return( tptr && !strncmp( tptr, value, strlen( value))
+                && (tptr[strlen( value)] == '\r' || tptr[strlen( value)] == '\n'));
+}
+
+typedef struct
+{
+   int status;
+   size_t bytes_sent;
+   bool close_connection;
+} response_t;
+
+static void send_simple( const int fd, const int status, const char *text,
+                                 response_t *resp)
+{
+   char buff[300];
+
+   snprintf( buff, sizeof( buff), "HTTP/1.1 %d %s\r\nContent-Length: %u\r\n\r\n%s\n",
+            status, text, (unsigned)strlen( text) + 1, text);
+   send_all( fd, buff, strlen( buff));
+   resp->status = status;
+   resp->bytes_sent = strlen( text) + 1;
+}
+
+static void respond( const int fd, const char *method, const char *target,
+               const char *headers, const char *body, const size_t body_len,
+               response_t *resp)
+{
+   char filename[600], buff[800], etag[40], last_modified[40];
+   const char *range = header_value( headers, "Range");
+   const bool is_head = !strcmp( method, "HEAD");
+   long start = 0, end;
+   struct stat st;
+   FILE *ifile;
+
+   sleep_ms( (double)latency_ms);
+   make_filename( filename, sizeof( filename), target, body, body_len);
+   if( stat( filename, &st) && record_mode)
+      record_response( target, filename, method, body, body_len);
+   if( stat( filename, &st) || !(ifile = fopen( filename, "rb")))
+      {
+      fprintf( stderr, "MISSING %s\n", filename);
+      send_simple( fd, 404, "Not Found", resp);
+      return;
+      }
+   if( roll_dice( error_pct))
+      {
+      fclose( ifile);
+      send_simple( fd, 503, "Service Unavailable", resp);
+      return;
+      }
+   snprintf( etag, sizeof( etag), "\"%lx-%lx\"", (unsigned long)st.st_mtime,
+                                    (unsigned long)st.st_size);
+   strftime( last_modified, sizeof( last_modified), "%a, %d %b %Y %H:%M:%S GMT",
+                                    gmtime( &st.st_mtime));
+   if( roll_dice( not_modified_pct)
+            || header_matches( headers, "If-None-Match", etag)
+            || header_matches( headers, "If-Modified-Since", last_modified))
+      {
+      fclose( ifile);
+      snprintf( buff, sizeof( buff), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n"
+                  "Last-Modified: %s\r\n\r\n", etag, last_modified);
+      send_all( fd, buff, strlen( buff));
+      resp->status = 304;
+      return;
+      }
+   end = (long)st.st_size - 1;
+   resp->status = 200;
+   if( range && !strncmp( range, "bytes=", 6))
+      {
+      char *endptr;
+
+      if( range[6] == '-')       /* suffix range:  'bytes=-N' = last N bytes */
+         {
+         start = (long)st.st_size - strtol( range + 7, NULL, 10);
+         if( start < 0)
+            start = 0;
+         }
+      else
+         {
+         start = strtol( range + 6, &endptr, 10);
+         if( *endptr == '-' && endptr[1] >= '0' && endptr[1] <= '9')
+            end = strtol( endptr + 1, NULL, 10);
+         }
+      if( end > (long)st.st_size - 1)
+         end = (long)st.st_size - 1;
+      if( start > end)
+         {
+         fclose( ifile);
+         send_simple( fd, 416, "Range Not Satisfiable", resp);
+         return;
+         }
+      resp->status = 206;
+      }
+   snprintf( buff, sizeof( buff), "HTTP/1.1 %d %s\r\nContent-Length: %ld\r\n"
+               "ETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\n",
+               resp->status, (resp->status == 200 ? "OK" : "Partial Content"),
+               end - start + 1, etag, last_modified);
+   if( resp->status == 206)
+      snprintf( buff + strlen( buff), sizeof( buff) - strlen( buff),
+               "Content-Range: bytes %ld-%ld/%ld\r\n", start, end, (long)st.st_size);
+   strcat( buff, "\r\n");
+   send_all( fd, buff, strlen( buff));
+   if( !is_head)
+      {
+      size_t len = (size_t)( end - start + 1);
+
+      if( roll_dice( truncate_pct))
+         {
+         len /= 2;
+         resp->close_connection = true;
+         }
+      resp->bytes_sent = send_file_data( fd, ifile, start, len);
+      }
+   fclose( ifile);
+}
+
+/* Reads requests from one connection until it's closed (or we close
+it after a truncated response).    */
+
+static void *handle_connection( void *arg)
+{
+   const int fd = (int)(intptr_t)arg;
+   char *buff = (char *)malloc( MAX_HEADER + 1);
+   size_t n_bytes = 0;
+   bool keep_going = true;
+
+   assert( buff);
+   while( keep_going)
+      {
+      char *end_of_headers, method[20], target[2000];
+      char *body = NULL;
+      const char *tptr;
+      size_t header_len, body_len = 0;
+      response_t resp;
+      double t0;
+      ssize_t n_read;
+
+      buff[n_bytes] = '\0';
+      while( !(end_of_headers = strstr( buff, "\r\n\r\n")) && n_bytes < MAX_HEADER)
+         {
+         n_read = recv( fd, buff + n_bytes, MAX_HEADER - n_bytes, 0);
+         if( n_read <= 0)
+            break;
+         n_bytes += (size_t)n_read;
+         buff[n_bytes] = '\0';
+         }
+      if( !end_of_headers || sscanf( buff, "%19s %1999s", method, target) != 2)
+         break;
+      t0 = current_ms( );
+      header_len = (size_t)( end_of_headers - buff) + 4;
+      if( (tptr = header_value( buff, "Content-Length")) != NULL)
+         body_len = (size_t)atol( tptr);
+      if( body_len)
+         {
+         size_t in_buff = n_bytes - header_len, have;
+
+         body = (char *)malloc( body_len + 1);
+         assert( body);
+         if( in_buff > body_len)
+            in_buff = body_len;
+         memcpy( body, buff + header_len, in_buff);
+         have = in_buff;
+         while( have < body_len && (n_read = recv( fd, body + have,
+                                    body_len - have, 0)) > 0)
+            have += (size_t)n_read;
+         body[body_len] = '\0';
+         header_len += in_buff;     /* body bytes that were in 'buff' */
+         }
+      memset( &resp, 0, sizeof( resp));
+      respond( fd, method, target, buff, body, body_len, &resp);
+      if( header_value( buff, "Connection")
+                  && header_matches( buff, "Connection", "close"))
+         resp.close_connection = true;
+      printf( "%s %s %d %lu %.1f\n", method, target, resp.status,
+                  (unsigned long)resp.bytes_sent, current_ms( ) - t0);
+      fflush( stdout);
+      free( body);
+      memmove( buff, buff + header_len, n_bytes - header_len);
+      n_bytes -= header_len;
+      keep_going = !resp.close_connection;
+      }
+   close( fd);
+   free( buff);
+   return( NULL);
+}
+
+static void set_option( const char *arg)
+{
+   switch( arg[1])
+      {
+      case 'l':
+         latency_ms = atol( arg + 2);
+         break;
+      case 'b':
+         bytes_per_sec = atol( arg + 2);
+         break;
+      case 'e':
+         error_pct = atof( arg + 2);
+         break;
+      case 'x':
+         truncate_pct = atof( arg + 2);
+         break;
+      case '3':
+         not_modified_pct = atof( arg + 2);
+         break;
+      case 's':
+         random_seed = (unsigned)atol( arg + 2);
+         break;
+      case 'r':
+         record_mode = true;
+         break;
+      default:
+         fprintf( stderr, "Option '%s' ignored\n", arg);
+         break;
+      }
+}
+
+int main( const int argc, const char **argv)
+{
+   int port = 8642, sock, i, one = 1;
+   struct sockaddr_in addr;
+
+   if( argc < 2)
+      {
+      fprintf( stderr, "Usage:  http_replay (recording dir) [options]\n"
+                       "See 'http_replay.c' for options\n");
+      return( -1);
+      }
+   recording_dir = argv[1];
+   for( i = 2; i < argc; i++)
+      if( argv[i][0] == '-' && argv[i][1] == 'p')
+         port = atoi( argv[i] + 2);
+      else if( argv[i][0] == '-')
+         set_option( argv[i]);
+   srand( random_seed);
+   signal( SIGPIPE, SIG_IGN);
+   curl_global_init( CURL_GLOBAL_DEFAULT);
+   sock = socket( AF_INET, SOCK_STREAM, 0);
+   assert( sock >= 0);
+   setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one));
+   memset( &addr, 0, sizeof( addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK);
+   addr.sin_port = htons( (uint16_t)port);
+   if( bind( sock, (struct sockaddr *)&addr, sizeof( addr)) || listen( sock, 64))
+      {
+      perror( "Couldn't listen");
+      return( -2);
+      }
+   fprintf( stderr, "Replaying '%s' on http://127.0.0.1:%d\n", recording_dir, port);
+   for( ;;)
+      {
+      const int fd = accept( sock, NULL, NULL);
+      pthread_t thread;
+
+      if( fd < 0)
+         {
+         if( errno == EINTR)
+            continue;
+         perror( "accept");
+         break;
+         }
+      if( pthread_create( &thread, NULL, handle_connection, (void *)(intptr_t)fd))
+         close( fd);
+      else
+         pthread_detach( thread);
+      }
+   close( sock);
+   curl_global_cleanup( );
+   return( 0);
+}
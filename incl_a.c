@@ -14,7 +14,8 @@ enough,  and there were artifacts.  Run with a scale of 8 in March 2022,
 the 'assert( ochar < 127)' line didn't trigger.  A smaller scale may
 be needed for future runs.  Or,  more likely,  I should switch to a more
 Digest2-like scheme in which the histogram involves quantities other than
-just inclination and semimajor axis.   */
+just inclination and semimajor axis.  'orb_hist.c' now does that (and,
+with no dimensions specified,  makes the same table as this does).   */
 
 int main( const int argc, const char **argv)
 {
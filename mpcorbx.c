@@ -21,6 +21,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <stdbool.h>
 #include <math.h>
 #include <time.h>
+#include "gz_input.h"
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 static void show_error_message( void)
 {
@@ -41,7 +50,15 @@ static void show_error_message( void)
    printf( "O(19900810     Only objects last observed before 1990 August 10\n");
    printf( "d)K10K42Q      Only provisional desigs after K10K42Q = 2010 KQ42\n");
    printf( "-ofiltered.txt Direct output to 'filtered.txt' (default is stdout)\n");
-   printf( "-impcz.txt     Read input from 'mpcz.txt' (default is MPCORB.DAT)\n\n");
+   printf( "-impcz.txt     Read input from 'mpcz.txt' (default is MPCORB.DAT)\n");
+   printf( "               (which may be gzipped,  e.g.,  -iMPCORB.DAT.gz)\n");
+   printf( "-t4            Filter using four threads (-t alone = one per CPU)\n");
+   printf( "-xmpcorb.col   Use (and if need be,  create) a columnar cache\n");
+   printf( "-sq            Sort output by q (or any field above except d)\n");
+   printf( "-Sq            Sort output by q,  in descending order\n");
+   printf( "-k500          Output only the first 500 objects after sorting\n\n");
+   printf( "For example,  'mpcorbx H(22 -sq -k500' will output the 500 objects\n");
+   printf( "brighter than H=22 with the smallest perihelion distances.\n\n");
    printf( "Note the use of ( and ) instead of < or >.  The latter are file\n");
    printf( "redirection operators,  so sadly,  we can't use them here.\n\n");
    printf( "When filtering,  the output will default to being without carriage\n");
@@ -69,16 +86,1122 @@ static void output_line( FILE *ofile, const char *buff, const int use_cr)
       fwrite( tbuff + 1, 1, 1, ofile);
 }
 
+/* Without arguments,  all we do is convert MPCORB.DAT to CR/LF line
+endings,  which is part of packaging it for Windows users.  Going through
+fgets() and output_line() for that means two fwrite()s and a byte-by-byte
+scan per line.  Instead,  the input is read in BULK_SIZE blocks;  lines
+are found with memchr(),  checked for control characters with a loop the
+compiler vectorizes,  and copied (plus CR/LF) into a large output buffer.
+The result is byte-for-byte what the line-by-line code produced,
+including its quirks :  lines are taken as fgets() with a 300-byte buffer
+would split them,  lines that aren't records are dropped,  and each is
+cut off at its first control character.   */
+
+#define BULK_SIZE     (1 << 20)
+#define MAX_PIECE     299          /* as from fgets( buff, 300, ifile) */
+
+static size_t first_control_char( const char *line, const size_t len)
+{
+   unsigned char any_control = 0;
+   size_t i;
+
+   for( i = 0; i < len; i++)
+      any_control |= ((unsigned char)line[i] < ' ');
+   if( !any_control)
+      return( len);
+   for( i = 0; (unsigned char)line[i] >= ' '; i++)
+      ;
+   return( i);
+}
+
+static int bulk_crlf_convert( FILE *ofile, gz_input_t *ifile, int *n_read)
+{
+   char *ibuff = (char *)malloc( BULK_SIZE + MAX_PIECE);
+   char *obuff = (char *)malloc( BULK_SIZE + MAX_PIECE + 2);
+   size_t carry = 0, olen = 0;
+   int n_written = 0;
+   bool at_eof = false;
+
+   if( !ibuff || !obuff)
+      {
+      fprintf( stderr, "Out of memory\n");
+      exit( -1);
+      }
+   while( !at_eof)
+      {
+      const size_t len = carry + gz_input_read( ibuff + carry, BULK_SIZE, ifile);
+      size_t pos = 0;
+
+      at_eof = (len == carry);
+      while( pos < len)
+         {
+         const char *line = ibuff + pos;
+         const char *eol = (const char *)memchr( line, '\n', len - pos);
+         const char *nul;
+         size_t piece, str_len;
+
+         if( eol)
+            piece = eol + 1 - line;
+         else if( at_eof || len - pos >= MAX_PIECE)
+            piece = len - pos;
+         else        /* incomplete line;  carry it to the next block */
+            break;
+         if( piece > MAX_PIECE)
+            piece = MAX_PIECE;
+         nul = (const char *)memchr( line, '\0', piece);
+         str_len = (nul ? (size_t)( nul - line) : piece);
+         if( str_len > 200 && line[29] == '.' && line[95] == '.')
+            {
+            const size_t out_len = first_control_char( line,
+                           (line[piece - 1] == '\n' ? piece - 1 : piece));
+
+            memcpy( obuff + olen, line, out_len);
+            olen += out_len;
+            obuff[olen++] = 13;
+            obuff[olen++] = 10;
+            n_written++;
+            if( olen >= BULK_SIZE)
+               {
+               fwrite( obuff, olen, 1, ofile);
+               olen = 0;
+               }
+            }
+         pos += piece;
+         }
+      carry = len - pos;
+      memmove( ibuff, ibuff + pos, carry);
+      }
+   fwrite( obuff, olen, 1, ofile);
+   free( ibuff);
+   free( obuff);
+   *n_read = n_written;
+   return( n_written);
+}
+
+/* Filters are 'compiled' once,  at startup,  into an array of predicates.
+Each says which field it tests,  the comparison,  its constant(s),  and
+which columns of the MPCORB line that field depends on.  Columns are
+decoded (with atof) only when a predicate first needs them,  and each
+record is rejected at the first predicate it fails.  So a filter on H
+alone never looks at the orbital elements,  and most records are rejected
+after decoding one or two columns.  */
+
+#define COL_A              0
+#define COL_ECC            1
+#define COL_H              2
+#define COL_MEAN_MOTION    3
+#define COL_LAST_OBS       4
+#define COL_NODE           5
+#define COL_PERIH          6
+#define COL_INCL           7
+#define N_COLUMNS          8
+
+static const int column_offsets[N_COLUMNS] = { 91, 69, 8, 80, 194, 48, 37, 59 };
+
+#define MAX_PREDICATES   100
+
+typedef struct
+{
+   char field;          /* a,  q,  H,  etc.;  see 'show_error_message()' */
+   char op;             /* '<',  '>',  ':' for a range,  or 0 for none */
+   double low, high;
+   const char *desig;   /* for 'd' (provisional desig) filters */
+   size_t desig_len;
+} predicate_t;
+
+typedef struct
+{
+   const char *buff;
+   int line_no;
+   unsigned decoded;    /* bit mask of columns decoded so far */
+   double column[N_COLUMNS];
+} orbit_rec_t;
+
+static double get_column( orbit_rec_t *rec, const int col)
+{
+   if( !(rec->decoded & (1u << col)))
+      {
+      rec->column[col] = atof( rec->buff + column_offsets[col]);
+      rec->decoded |= (1u << col);
+      }
+   return( rec->column[col]);
+}
+
+static double field_value( orbit_rec_t *rec, const char field)
+{
+   double a;
+
+   switch( field)
+      {
+      case 'a':
+         return( get_column( rec, COL_A));
+      case 'P':
+         a = get_column( rec, COL_A);
+         return( a * sqrt( a));
+      case 'q':
+         return( get_column( rec, COL_A) * (1. - get_column( rec, COL_ECC)));
+      case 'Q':
+         return( get_column( rec, COL_A) * (1. + get_column( rec, COL_ECC)));
+      case 'H':
+         return( get_column( rec, COL_H));
+      case 'n':    /* mean motion */
+         return( get_column( rec, COL_MEAN_MOTION));
+      case 'O':    /* date last observed */
+         return( get_column( rec, COL_LAST_OBS));
+      case 'A':    /* ascending node */
+         return( get_column( rec, COL_NODE));
+      case 'p':    /* arg perih */
+         return( get_column( rec, COL_PERIH));
+      case 'N':     /* line #; = asteroid # for numbered objs */
+         return( (double)rec->line_no);
+      case 'e':
+         return( get_column( rec, COL_ECC));
+      case 'i':
+         return( get_column( rec, COL_INCL));
+      }
+   return( 0.);
+}
+
+/* Rough relative cost of evaluating a predicate:  line number and desig
+tests need no decoding,  and P,  q,  Q need two columns (or a sqrt).  */
+
+static int predicate_cost( const predicate_t *pred)
+{
+   if( pred->field == 'N' || pred->field == 'd')
+      return( 0);
+   return( strchr( "PqQ", pred->field) ? 2 : 1);
+}
+
+/* Arguments that aren't filters (options,  unknown fields) are skipped,
+as are ranges that can't be parsed.  Predicates are then (stably) sorted
+so the cheapest are tried first;  since all must pass,  the order doesn't
+change the result.  Returns the number of predicates. */
+
+static int compile_filters( const int argc, const char **argv,
+                                           predicate_t *preds)
+{
+   int i, n_preds = 0;
+
+   for( i = 1; i < argc; i++)
+      {
+      const char *arg = argv[i];
+      predicate_t pred;
+
+      if( !arg[0] || !strchr( "aPqQHnOApNdei", arg[0]))
+         continue;
+      memset( &pred, 0, sizeof( pred));
+      if( strchr( "<({l", arg[1]))
+         pred.op = '<';
+      else if( strchr( ">)}g", arg[1]))
+         pred.op = '>';
+      else if( arg[1] == ':')
+         pred.op = ':';
+      else
+         continue;
+      pred.field = arg[0];
+      if( pred.field == 'd')
+         {
+         pred.desig = arg + 2;
+         pred.desig_len = strlen( arg + 2);
+         }
+      else if( pred.op == ':')
+         {
+         if( sscanf( arg + 2, "%lf,%lf", &pred.low, &pred.high) != 2)
+            pred.op = 0;
+         }
+      else
+         pred.low = pred.high = atof( arg + 2);
+      if( n_preds == MAX_PREDICATES)
+         {
+         fprintf( stderr, "Too many filters\n");
+         exit( -1);
+         }
+      preds[n_preds++] = pred;
+      }
+   for( i = 1; i < n_preds; i++)
+      {
+      const predicate_t temp = preds[i];
+      int j = i;
+
+      while( j && predicate_cost( preds + j - 1) > predicate_cost( &temp))
+         {
+         preds[j] = preds[j - 1];
+         j--;
+         }
+      preds[j] = temp;
+      }
+   return( n_preds);
+}
+
+static bool passes_filters( const predicate_t *preds, const int n_preds,
+                            const char *buff, const int line_no)
+{
+   orbit_rec_t rec = { buff, line_no, 0, { 0. } };
+   int i;
+
+   for( i = 0; i < n_preds; i++)
+      {
+      const predicate_t *pred = preds + i;
+      double val;
+
+      if( pred->field == 'd')     /* filter by provisional designation */
+         {
+         const int compare = memcmp( buff, pred->desig, pred->desig_len);
+
+         if( pred->desig_len && buff[pred->desig_len - 1] == ' ')
+            return( false);
+         if( pred->op == '<' && compare > 0)
+            return( false);
+         if( pred->op == '>' && compare < 0)
+            return( false);
+         continue;
+         }
+      if( pred->field == 'H' && buff[10] == ' ')
+         return( false);      /* consider non-blank H values only */
+      if( !pred->op)
+         continue;
+      val = field_value( &rec, pred->field);
+      if( pred->op != '>' && val > pred->high)
+         return( false);
+      if( pred->op != '<' && val < pred->low)
+         return( false);
+      }
+   return( true);
+}
+
+/* Sorted output ('-s(field)' or '-S(field)' for descending order),
+optionally keeping only the first k records ('-k(k)').  Only the sort key,
+line number,  and byte offset of each record that passes the filters are
+kept;  the lines themselves are re-read from the input when output.
+With '-k',  a heap of the k best records so far is kept,  so memory use
+is proportional to k,  not to the number of records passing the filters.
+Ties are broken by line number (i.e.,  the sort is stable),  and objects
+without a value (blank H) always go last.  Gzipped input can't be re-read
+that way,  so for it,  copies of the retained lines are kept instead.  */
+
+typedef struct
+{
+   double key;
+   int line_no;
+   long offset;
+   char *line;          /* used only for gzipped input */
+} sort_entry_t;
+
+typedef struct
+{
+   sort_entry_t *entries;
+   int n, n_alloced, max_n;      /* max_n = k,  or 0 = keep all */
+   char field;
+   bool descending, keep_lines;
+} sorted_output_t;
+
+static int compare_entries( const sort_entry_t *a, const sort_entry_t *b,
+                            const bool descending)
+{
+   const bool a_nan = (a->key != a->key), b_nan = (b->key != b->key);
+
+   if( a_nan != b_nan)
+      return( a_nan ? 1 : -1);
+   if( !a_nan && a->key != b->key)
+      return( (a->key < b->key) == !descending ? -1 : 1);
+   return( a->line_no < b->line_no ? -1 : (a->line_no > b->line_no));
+}
+
+static int compare_ascending( const void *a, const void *b)
+{
+   return( compare_entries( (const sort_entry_t *)a,
+                            (const sort_entry_t *)b, false));
+}
+
+static int compare_descending( const void *a, const void *b)
+{
+   return( compare_entries( (const sort_entry_t *)a,
+                            (const sort_entry_t *)b, true));
+}
+
+/* In top-k mode,  'entries' is a heap with the worst retained record at
+the root.   */
+
+static void sift_down( sort_entry_t *heap, const int n, const bool descending)
+{
+   int i = 0;
+
+   for( ;;)
+      {
+      int child = i * 2 + 1;
+      sort_entry_t temp;
+
+      if( child >= n)
+         return;
+      if( child + 1 < n &&
+               compare_entries( heap + child + 1, heap + child, descending) > 0)
+         child++;
+      if( compare_entries( heap + child, heap + i, descending) <= 0)
+         return;
+      temp = heap[i];
+      heap[i] = heap[child];
+      heap[child] = temp;
+      i = child;
+      }
+}
+
+static void add_sorted_record( sorted_output_t *so, const double key,
+              const int line_no, const long offset, const char *line)
+{
+   sort_entry_t entry;
+
+   entry.key = key;
+   entry.line_no = line_no;
+   entry.offset = offset;
+   entry.line = NULL;
+   if( so->max_n && so->n == so->max_n)
+      {
+      if( compare_entries( &entry, so->entries, so->descending) < 0)
+         {
+         free( so->entries[0].line);
+         if( so->keep_lines)
+            entry.line = strdup( line);
+         so->entries[0] = entry;
+         sift_down( so->entries, so->n, so->descending);
+         }
+      return;
+      }
+   if( so->n == so->n_alloced)
+      {
+      so->n_alloced = (so->max_n ? so->max_n
+                          : (so->n_alloced ? so->n_alloced * 2 : 65536));
+      so->entries = (sort_entry_t *)realloc( so->entries,
+                          so->n_alloced * sizeof( sort_entry_t));
+      if( !so->entries)
+         {
+         fprintf( stderr, "Out of memory\n");
+         exit( -1);
+         }
+      }
+   if( so->keep_lines)
+      entry.line = strdup( line);
+   so->entries[so->n] = entry;
+   if( so->max_n)          /* sift up */
+      {
+      int i = so->n;
+
+      while( i && compare_entries( so->entries + (i - 1) / 2,
+                                   so->entries + i, so->descending) < 0)
+         {
+         const sort_entry_t temp = so->entries[i];
+
+         so->entries[i] = so->entries[(i - 1) / 2];
+         so->entries[(i - 1) / 2] = temp;
+         i = (i - 1) / 2;
+         }
+      }
+   so->n++;
+}
+
+static double sort_key( const char *buff, const int line_no, const char field)
+{
+   orbit_rec_t rec = { buff, line_no, 0, { 0. } };
+
+   if( field == 'H' && buff[10] == ' ')
+      return( nan( ""));
+   return( field_value( &rec, field));
+}
+
+/* Sorts the retained records,  then reads each from the input file (or
+the saved copy) and writes it out.  Returns the number of lines written. */
+
+static int output_sorted_records( FILE *ofile, FILE *ifile,
+                                  sorted_output_t *so, const int use_cr)
+{
+   int i;
+   char buff[300];
+
+   qsort( so->entries, so->n, sizeof( sort_entry_t),
+            (so->descending ? compare_descending : compare_ascending));
+   for( i = 0; i < so->n; i++)
+      if( so->entries[i].line)
+         {
+         output_line( ofile, so->entries[i].line, use_cr);
+         free( so->entries[i].line);
+         }
+      else
+         {
+         fseek( ifile, so->entries[i].offset, SEEK_SET);
+         if( fgets( buff, sizeof( buff), ifile))
+            output_line( ofile, buff, use_cr);
+         }
+   free( so->entries);
+   return( so->n);
+}
+
+#ifndef _WIN32
+
+/* With '-t',  MPCORB.DAT is memory-mapped and split into chunks of about
+CHUNK_SIZE bytes (ending at line boundaries),  which worker threads
+filter into per-chunk output buffers.  The main thread writes those out
+in order as they complete;  workers stay at most 'max_ahead' chunks in
+front of it,  so memory use is bounded even for large extracts.  If an
+'N' (line number) filter is used,  a first pass counts the records in
+each chunk,  so each chunk knows the line number it starts at.   */
+
+#define CHUNK_SIZE (4 << 20)
+
+typedef struct
+{
+   const char *start, *end;
+   int first_line_no, n_records, n_output;
+   char *obuff;
+   size_t olen, oalloc;
+   bool done;
+} chunk_t;
+
+typedef struct
+{
+   chunk_t *chunks;
+   int n_chunks, next_chunk, n_written, max_ahead;
+   const predicate_t *preds;
+   int n_preds;
+   bool use_cr, count_only;
+   FILE *ofile;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+} parallel_filter_t;
+
+static void chunk_output( chunk_t *chunk, const char *line, const bool use_cr)
+{
+   size_t len = 0;
+
+   while( line[len] >= ' ')
+      len++;
+   if( chunk->olen + len + 2 > chunk->oalloc)
+      {
+      chunk->oalloc = (chunk->oalloc + len + 2) * 2;
+      chunk->obuff = (char *)realloc( chunk->obuff, chunk->oalloc);
+      if( !chunk->obuff)
+         {
+         fprintf( stderr, "Out of memory\n");
+         exit( -1);
+         }
+      }
+   memcpy( chunk->obuff + chunk->olen, line, len);
+   chunk->olen += len;
+   if( use_cr)
+      chunk->obuff[chunk->olen++] = 13;
+   chunk->obuff[chunk->olen++] = 10;
+}
+
+/* Mirrors the serial loop:  a record is a line of more than 200 bytes
+(counting the line feed) with decimal points in columns 30 and 96.   */
+
+static void filter_chunk( const parallel_filter_t *pf, chunk_t *chunk)
+{
+   const char *tptr = chunk->start;
+   int line_no = chunk->first_line_no;
+
+   chunk->n_records = chunk->n_output = 0;
+   while( tptr < chunk->end)
+      {
+      const char *eol = (const char *)memchr( tptr, '\n', chunk->end - tptr);
+      const size_t len = (eol ? (size_t)( eol + 1 - tptr)
+                              : (size_t)( chunk->end - tptr));
+
+      if( len > 200 && tptr[29] == '.' && tptr[95] == '.')
+         {
+         chunk->n_records++;
+         line_no++;
+         if( !pf->count_only)
+            {
+            char buff[300];
+            const char *line = tptr;
+
+            if( !eol)      /* last line,  without a line feed;  copy */
+               {          /* it so it's properly terminated */
+               const size_t n = (len < sizeof( buff) ? len : sizeof( buff) - 1);
+
+               memcpy( buff, tptr, n);
+               buff[n] = '\0';
+               line = buff;
+               }
+            if( passes_filters( pf->preds, pf->n_preds, line, line_no))
+               {
+               chunk->n_output++;
+               chunk_output( chunk, line, pf->use_cr);
+               }
+            }
+         }
+      tptr += len;
+      }
+}
+
+static void *filter_thread( void *arg)
+{
+   parallel_filter_t *pf = (parallel_filter_t *)arg;
+
+   for( ;;)
+      {
+      int idx;
+
+      pthread_mutex_lock( &pf->mutex);
+      while( !pf->count_only && pf->next_chunk < pf->n_chunks
+                  && pf->next_chunk - pf->n_written >= pf->max_ahead)
+         pthread_cond_wait( &pf->cond, &pf->mutex);
+      idx = pf->next_chunk;
+      if( idx < pf->n_chunks)
+         pf->next_chunk++;
+      pthread_mutex_unlock( &pf->mutex);
+      if( idx >= pf->n_chunks)
+         return( NULL);
+      filter_chunk( pf, pf->chunks + idx);
+      pthread_mutex_lock( &pf->mutex);
+      pf->chunks[idx].done = true;
+      pthread_cond_broadcast( &pf->cond);
+      pthread_mutex_unlock( &pf->mutex);
+      }
+}
+
+static void run_filter_threads( parallel_filter_t *pf, const int n_threads)
+{
+   pthread_t *threads = (pthread_t *)calloc( n_threads, sizeof( pthread_t));
+   int i, n_started = 0;
+
+   pf->next_chunk = pf->n_written = 0;
+   for( i = 0; i < n_threads; i++)
+      if( !pthread_create( threads + n_started, NULL, filter_thread, pf))
+         n_started++;
+   if( !n_started)      /* couldn't make threads;  do it ourselves */
+      filter_thread( pf);
+   if( !pf->count_only)       /* write out chunks in order */
+      for( i = 0; i < pf->n_chunks; i++)
+         {
+         chunk_t *chunk = pf->chunks + i;
+
+         pthread_mutex_lock( &pf->mutex);
+         while( !chunk->done)
+            pthread_cond_wait( &pf->cond, &pf->mutex);
+         pthread_mutex_unlock( &pf->mutex);
+         fwrite( chunk->obuff, chunk->olen, 1, pf->ofile);
+         free( chunk->obuff);
+         chunk->obuff = NULL;
+         pthread_mutex_lock( &pf->mutex);
+         pf->n_written++;
+         pthread_cond_broadcast( &pf->cond);
+         pthread_mutex_unlock( &pf->mutex);
+         }
+   for( i = 0; i < n_started; i++)
+      pthread_join( threads[i], NULL);
+   free( threads);
+}
+
+/* Filters the records from byte 'offset' to the end of the file,  and
+returns the number of lines written (or -1 if the file couldn't be
+mapped).  'line_no' is set to the number of records read.  */
+
+static int parallel_filter( FILE *ofile, const char *filename,
+            const size_t offset, const predicate_t *preds, const int n_preds,
+            const bool use_cr, int n_threads, int *line_no)
+{
+   const int fd = open( filename, O_RDONLY);
+   parallel_filter_t pf;
+   const char *map;
+   size_t filesize, pos;
+   int i, n_output = 0;
+
+   if( fd < 0)
+      return( -1);
+   filesize = (size_t)lseek( fd, 0, SEEK_END);
+   map = (filesize > offset ? (const char *)mmap( NULL, filesize, PROT_READ,
+                                  MAP_PRIVATE, fd, 0) : NULL);
+   close( fd);
+   if( map == (const char *)MAP_FAILED)
+      return( -1);
+   *line_no = 0;
+   if( !map)         /* no records at all */
+      return( 0);
+   madvise( (void *)map, filesize, MADV_SEQUENTIAL);
+   if( n_threads <= 0)
+      n_threads = (int)sysconf( _SC_NPROCESSORS_ONLN);
+   if( n_threads <= 0)
+      n_threads = 1;
+   memset( &pf, 0, sizeof( pf));
+   pf.chunks = (chunk_t *)calloc( (filesize - offset) / CHUNK_SIZE + 1,
+                                          sizeof( chunk_t));
+   for( pos = offset; pos < filesize; pf.n_chunks++)
+      {
+      const char *eol;
+      chunk_t *chunk = pf.chunks + pf.n_chunks;
+
+      chunk->start = map + pos;
+      pos += CHUNK_SIZE;
+      if( pos >= filesize)
+         pos = filesize;
+      else if( (eol = (const char *)memchr( map + pos, '\n', filesize - pos)) != NULL)
+         pos = eol + 1 - map;
+      else
+         pos = filesize;
+      chunk->end = map + pos;
+      }
+   pf.preds = preds;
+   pf.n_preds = n_preds;
+   pf.use_cr = use_cr;
+   pf.ofile = ofile;
+   pf.max_ahead = n_threads * 4;
+   pthread_mutex_init( &pf.mutex, NULL);
+   pthread_cond_init( &pf.cond, NULL);
+   for( i = 0; i < n_preds; i++)
+      if( preds[i].field == 'N')
+         pf.count_only = true;
+   if( pf.count_only)        /* need line numbers at the start of each chunk */
+      {
+      run_filter_threads( &pf, n_threads);
+      for( i = 1; i < pf.n_chunks; i++)
+         pf.chunks[i].first_line_no = pf.chunks[i - 1].first_line_no
+                                    + pf.chunks[i - 1].n_records;
+      for( i = 0; i < pf.n_chunks; i++)
+         pf.chunks[i].done = false;
+      pf.count_only = false;
+      }
+   run_filter_threads( &pf, n_threads);
+   for( i = 0; i < pf.n_chunks; i++)
+      {
+      *line_no += pf.chunks[i].n_records;
+      n_output += pf.chunks[i].n_output;
+      }
+   pthread_mutex_destroy( &pf.mutex);
+   pthread_cond_destroy( &pf.cond);
+   free( pf.chunks);
+   munmap( (void *)map, filesize);
+   return( n_output);
+}
+#endif      /* #ifndef _WIN32 */
+
+#ifndef _WIN32
+
+/* Columnar cache ('-x(filename)').  Re-parsing 1.4 million text lines for
+each query is slow.  So on first use,  the orbital elements,  H,  and
+last-observed date are decoded once and stored as arrays of doubles
+(one array per quantity),  along with the byte offset of each record in
+MPCORB.DAT.  Queries then evaluate each predicate over blocks of records
+as a simple loop over one or two arrays,  which the compiler vectorizes;
+on x86-64 Linux,  an AVX2 version is also built and picked at run time.
+Matching lines are copied from the (memory-mapped) MPCORB.DAT.
+
+   The cache stores the size,  modification time,  and a checksum of the
+MPCORB.DAT it was made from.  If the size or time differ,  the checksum
+is recomputed;  if that differs too,  the cache is rebuilt.  Values are
+exactly those atof() gives for the text,  so results are identical to
+those from the text path.  A blank H is stored as a NaN.  */
+
+#define CACHE_MAGIC       "MPCORBX1"
+#define COL_MEAN_ANOM      8
+#define COL_EPOCH          9
+#define N_CACHE_COLUMNS   10
+#define CACHE_BLOCK     4096
+
+#if defined( __GNUC__) && defined( __x86_64__) && defined( __linux__)
+   #define SIMD_CLONES __attribute__((target_clones( "avx2", "default")))
+#else
+   #define SIMD_CLONES
+#endif
+
+typedef struct
+{
+   char magic[8];
+   uint64_t source_size, checksum, n_records;
+   int64_t source_mtime;
+   uint64_t reserved[3];
+} cache_header_t;
+
+typedef struct
+{
+   void *map;
+   size_t map_size;
+   cache_header_t *hdr;
+   const uint64_t *offsets;
+   const double *column[N_CACHE_COLUMNS];
+} column_cache_t;
+
+static uint64_t source_checksum( const char *data, const size_t len)
+{
+   uint64_t rval = 0x9e3779b97f4a7c15u, word;
+   size_t i;
+
+   for( i = 0; i + 8 <= len; i += 8)
+      {
+      memcpy( &word, data + i, 8);
+      rval = (rval ^ word) * 0x100000001b3u;
+      rval ^= rval >> 29;
+      }
+   for( ; i < len; i++)
+      rval = (rval ^ (unsigned char)data[i]) * 0x100000001b3u;
+   return( rval);
+}
+
+/* Converts a packed epoch such as 'K2555' to YYYYMMDD.   */
+
+static double packed_epoch( const char *packed)
+{
+   const char *digits = "0123456789ABCDEFGHIJKLMNOPQRSTUV";
+   const char *month = strchr( digits, packed[3]);
+   const char *day = strchr( digits, packed[4]);
+   const int year = (packed[0] - 'A' + 10) * 100
+                  + (packed[1] - '0') * 10 + packed[2] - '0';
+
+   if( !month || !day || packed[0] < 'I' || packed[0] > 'L')
+      return( 0.);
+   return( (double)year * 10000. + (double)( month - digits) * 100.
+                                 + (double)( day - digits));
+}
+
+static void *map_file( const char *filename, size_t *size)
+{
+   const int fd = open( filename, O_RDONLY);
+   void *rval = NULL;
+
+   if( fd >= 0)
+      {
+      *size = (size_t)lseek( fd, 0, SEEK_END);
+      if( *size)
+         rval = mmap( NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if( rval == MAP_FAILED)
+         rval = NULL;
+      close( fd);
+      }
+   return( rval);
+}
+
+static void set_cache_pointers( column_cache_t *cache)
+{
+   const char *base = (const char *)cache->map + sizeof( cache_header_t);
+   const size_t n = (size_t)cache->hdr->n_records;
+   int i;
+
+   cache->offsets = (const uint64_t *)base;
+   for( i = 0; i < N_CACHE_COLUMNS; i++)
+      cache->column[i] = (const double *)( base + (i + 1) * n * sizeof( double));
+}
+
+/* Records begin at 'offset' (i.e.,  after the header),  and are found
+exactly as in the text path.  The cache is written to a temporary file,
+then renamed,  so a concurrent query never sees a partial cache.  */
+
+static int build_column_cache( const char *cache_name, const char *source,
+                   const size_t source_size, const size_t offset,
+                   const struct stat *source_stat)
+{
+   const int offsets[N_CACHE_COLUMNS] = { 91, 69, 8, 80, 194, 48, 37, 59, 26, 20 };
+   cache_header_t hdr;
+   uint64_t *rec_offsets = NULL;
+   double *columns[N_CACHE_COLUMNS];
+   size_t pos = offset, n = 0, alloced = 0;
+   char temp_name[300];
+   FILE *ofile;
+   int i, rval = 0;
+
+   memset( columns, 0, sizeof( columns));
+   while( pos < source_size)
+      {
+      const char *line = source + pos;
+      const char *eol = (const char *)memchr( line, '\n', source_size - pos);
+      const size_t len = (eol ? (size_t)( eol + 1 - line) : source_size - pos);
+
+      if( len > 200 && line[29] == '.' && line[95] == '.')
+         {
+         char buff[300];
+
+         if( n == alloced)
+            {
+            alloced = (alloced ? alloced * 2 : 65536);
+            rec_offsets = (uint64_t *)realloc( rec_offsets, alloced * sizeof( uint64_t));
+            for( i = 0; i < N_CACHE_COLUMNS; i++)
+               columns[i] = (double *)realloc( columns[i], alloced * sizeof( double));
+            if( !rec_offsets || !columns[N_CACHE_COLUMNS - 1])
+               {
+               fprintf( stderr, "Out of memory\n");
+               exit( -1);
+               }
+            }
+         memcpy( buff, line, (len < sizeof( buff) ? len : sizeof( buff) - 1));
+         buff[len < sizeof( buff) ? len : sizeof( buff) - 1] = '\0';
+         rec_offsets[n] = (uint64_t)pos;
+         for( i = 0; i < N_CACHE_COLUMNS; i++)
+            columns[i][n] = (i == COL_EPOCH ? packed_epoch( buff + 20)
+                                            : atof( buff + offsets[i]));
+         if( buff[10] == ' ')
+            columns[COL_H][n] = nan( "");
+         n++;
+         }
+      pos += len;
+      }
+   memset( &hdr, 0, sizeof( hdr));
+   memcpy( hdr.magic, CACHE_MAGIC, 8);
+   hdr.source_size = (uint64_t)source_size;
+   hdr.source_mtime = (int64_t)source_stat->st_mtime;
+   hdr.checksum = source_checksum( source, source_size);
+   hdr.n_records = (uint64_t)n;
+   snprintf( temp_name, sizeof( temp_name), "%s.tmp%d", cache_name, (int)getpid( ));
+   ofile = fopen( temp_name, "wb");
+   if( !ofile)
+      rval = -1;
+   else
+      {
+      if( fwrite( &hdr, sizeof( hdr), 1, ofile) != 1
+               || fwrite( rec_offsets, sizeof( uint64_t), n, ofile) != n)
+         rval = -1;
+      for( i = 0; !rval && i < N_CACHE_COLUMNS; i++)
+         if( fwrite( columns[i], sizeof( double), n, ofile) != n)
+            rval = -1;
+      if( fclose( ofile))
+         rval = -1;
+      if( !rval && rename( temp_name, cache_name))
+         rval = -1;
+      if( rval)
+         unlink( temp_name);
+      }
+   free( rec_offsets);
+   for( i = 0; i < N_CACHE_COLUMNS; i++)
+      free( columns[i]);
+   return( rval);
+}
+
+/* Maps the cache,  (re)building it first if it's missing or out of date.
+Returns 0 on success.  */
+
+static int open_column_cache( column_cache_t *cache, const char *cache_name,
+                   const char *source, const size_t source_size,
+                   const size_t offset, const struct stat *source_stat)
+{
+   int pass;
+
+   for( pass = 0; pass < 2; pass++)
+      {
+      cache->map = map_file( cache_name, &cache->map_size);
+      if( cache->map && cache->map_size >= sizeof( cache_header_t))
+         {
+         cache->hdr = (cache_header_t *)cache->map;
+         if( !memcmp( cache->hdr->magic, CACHE_MAGIC, 8)
+               && cache->hdr->source_size == (uint64_t)source_size
+               && cache->map_size == sizeof( cache_header_t) + (size_t)
+                     cache->hdr->n_records * (N_CACHE_COLUMNS + 1) * 8
+               && (cache->hdr->source_mtime == (int64_t)source_stat->st_mtime
+                   || cache->hdr->checksum == source_checksum( source, source_size)))
+            {
+            set_cache_pointers( cache);
+            return( 0);
+            }
+         }
+      if( cache->map)
+         munmap( cache->map, cache->map_size);
+      cache->map = NULL;
+      if( !pass)
+         {
+         fprintf( stderr, "Building columnar cache '%s'\n", cache_name);
+         if( build_column_cache( cache_name, source, source_size, offset,
+                              source_stat))
+            return( -1);
+         }
+      }
+   return( -1);
+}
+
+/* Clears mask[i] unless low <= x[i] <= high (or x[i] is a NaN,  as for
+the text path;  blank H values are excluded separately).   */
+
+static void SIMD_CLONES range_mask( unsigned char *mask, const double *x,
+                          const int n, const double low, const double high)
+{
+   int i;
+
+   for( i = 0; i < n; i++)
+      mask[i] &= (unsigned char)(!(x[i] > high) & !(x[i] < low));
+}
+
+static void SIMD_CLONES non_nan_mask( unsigned char *mask, const double *x,
+                          const int n)
+{
+   int i;
+
+   for( i = 0; i < n; i++)
+      mask[i] &= (unsigned char)( x[i] == x[i]);
+}
+
+static void SIMD_CLONES derived_values( double *ovals, const char field,
+                          const double *a, const double *ecc, const int n,
+                          const int first_line_no)
+{
+   int i;
+
+   switch( field)
+      {
+      case 'P':
+         for( i = 0; i < n; i++)
+            ovals[i] = a[i] * sqrt( a[i]);
+         break;
+      case 'q':
+         for( i = 0; i < n; i++)
+            ovals[i] = a[i] * (1. - ecc[i]);
+         break;
+      case 'Q':
+         for( i = 0; i < n; i++)
+            ovals[i] = a[i] * (1. + ecc[i]);
+         break;
+      case 'N':
+         for( i = 0; i < n; i++)
+            ovals[i] = (double)( first_line_no + i);
+         break;
+      }
+}
+
+static int field_column( const char field)
+{
+   const char *fields = "aeHnOApi";
+   const char *tptr = strchr( fields, field);
+
+   return( tptr ? (int)( tptr - fields) : -1);
+}
+
+static double cache_sort_key( const column_cache_t *cache, const char field,
+                              const int idx)
+{
+   const int col = field_column( field);
+   double val;
+
+   if( col >= 0)
+      return( cache->column[col][idx]);
+   derived_values( &val, field, cache->column[COL_A] + idx,
+                                cache->column[COL_ECC] + idx, 1, idx + 1);
+   return( val);
+}
+
+/* Evaluates the predicates over the cache in blocks of CACHE_BLOCK
+records,  and writes out matching lines (or adds them to 'so',  if the
+output is to be sorted).  Returns the number of matches.  */
+
+static int cache_filter( FILE *ofile, const column_cache_t *cache,
+               const char *source, const size_t source_size,
+               const predicate_t *preds, const int n_preds, const bool use_cr,
+               sorted_output_t *so)
+{
+   const int n_records = (int)cache->hdr->n_records;
+   unsigned char mask[CACHE_BLOCK];
+   double vals[CACHE_BLOCK];
+   int block, i, j, n_output = 0;
+
+   for( block = 0; block < n_records; block += CACHE_BLOCK)
+      {
+      const int n = (n_records - block < CACHE_BLOCK ? n_records - block
+                                                     : CACHE_BLOCK);
+      bool any_left = true;
+
+      memset( mask, 1, n);
+      for( i = 0; i < n_preds && any_left; i++)
+         {
+         const predicate_t *pred = preds + i;
+         const double *x;
+         const int col = field_column( pred->field);
+
+         if( pred->field == 'd')
+            {
+            for( j = 0; j < n; j++)
+               if( mask[j])
+                  {
+                  const char *line = source + cache->offsets[block + j];
+                  const int compare = memcmp( line, pred->desig, pred->desig_len);
+
+                  if( pred->desig_len && line[pred->desig_len - 1] == ' ')
+                     mask[j] = 0;
+                  else if( pred->op == '<' && compare > 0)
+                     mask[j] = 0;
+                  else if( pred->op == '>' && compare < 0)
+                     mask[j] = 0;
+                  }
+            }
+         else
+            {
+            if( pred->field == 'H')
+               non_nan_mask( mask, cache->column[COL_H] + block, n);
+            if( !pred->op)
+               continue;
+            if( col >= 0)
+               x = cache->column[col] + block;
+            else
+               {
+               derived_values( vals, pred->field, cache->column[COL_A] + block,
+                               cache->column[COL_ECC] + block, n, block + 1);
+               x = vals;
+               }
+            range_mask( mask, x, n, (pred->op == '<' ? -HUGE_VAL : pred->low),
+                                    (pred->op == '>' ? HUGE_VAL : pred->high));
+            }
+         any_left = (memchr( mask, 1, n) != NULL);
+         }
+      for( j = 0; any_left && j < n; j++)
+         if( mask[j] && so)
+            {
+            add_sorted_record( so, cache_sort_key( cache, so->field, block + j),
+                     block + j + 1, (long)cache->offsets[block + j], NULL);
+            n_output++;
+            }
+         else if( mask[j])
+            {
+            const char *line = source + cache->offsets[block + j];
+            size_t len = 0;
+
+            while( line + len < source + source_size && line[len] >= ' ')
+               len++;
+            fwrite( line, len, 1, ofile);
+            fwrite( "\r\n" + !use_cr, 1 + use_cr, 1, ofile);
+            n_output++;
+            }
+      }
+   return( n_output);
+}
+
+/* Filters records via the cache.  Returns the number of lines written,
+or -1 if the cache couldn't be opened or made.  */
+
+static int columnar_filter( FILE *ofile, const char *filename,
+            const char *cache_name, const size_t offset,
+            const predicate_t *preds, const int n_preds,
+            const bool use_cr, sorted_output_t *so, int *line_no)
+{
+   size_t source_size;
+   char *source = (char *)map_file( filename, &source_size);
+   struct stat source_stat;
+   column_cache_t cache;
+   int rval = -1;
+
+   *line_no = 0;
+   if( !source || stat( filename, &source_stat))
+      return( -1);
+   if( !open_column_cache( &cache, cache_name, source, source_size, offset,
+                           &source_stat))
+      {
+      *line_no = (int)cache.hdr->n_records;
+      rval = cache_filter( ofile, &cache, source, source_size,
+                           preds, n_preds, use_cr, so);
+      munmap( cache.map, cache.map_size);
+      }
+   munmap( source, source_size);
+   return( rval);
+}
+#endif      /* #ifndef _WIN32 */
+
 int main( const int argc, const char **argv)
 {
    const char *input_file_name = "MPCORB.DAT";
-   FILE *output_file = stdout, *ifile;
+   FILE *output_file = stdout;
+   gz_input_t *ifile;
    char buff[300];
    int i, use_cr = 0, line_no = 0, n_lines_output = 0;
-   int n_lines = 0;
-   size_t filesize;
+   bool records_done = false;
    time_t t0 = time( NULL);
+   predicate_t preds[MAX_PREDICATES];
+   int n_preds, n_threads = 1;
+   const char *cache_name = NULL;
+   sorted_output_t sorted;
+   long offset = 0;
 
+   memset( &sorted, 0, sizeof( sorted));
    for( i = 1; i < argc; i++)
       if( argv[i][0] == '-')
          switch( argv[i][1])
@@ -102,6 +1225,29 @@ int main( const int argc, const char **argv)
             case 'i':
                input_file_name = argv[i] + 2;
                break;
+            case 't':
+               n_threads = atoi( argv[i] + 2);
+               break;
+            case 'x':
+               cache_name = argv[i] + 2;
+               break;
+            case 's': case 'S':
+               sorted.field = argv[i][2];
+               sorted.descending = (argv[i][1] == 'S');
+               if( !sorted.field || !strchr( "aPqQHnOApNei", sorted.field))
+                  {
+                  printf( "'%s':  can't sort on that field\n", argv[i]);
+                  return( -3);
+                  }
+               break;
+            case 'k':
+               sorted.max_n = atoi( argv[i] + 2);
+               if( sorted.max_n < 0)
+                  {
+                  printf( "'%s':  count can't be negative\n", argv[i]);
+                  return( -3);
+                  }
+               break;
             default:
                printf( "'%s' not recognized\n", argv[i]);
                show_error_message( );
@@ -109,16 +1255,31 @@ int main( const int argc, const char **argv)
                break;
             }
 
-   ifile = fopen( input_file_name, "rb");
+   if( sorted.max_n && !sorted.field)
+      {
+      printf( "'-k' requires sorting on a field (-s or -S)\n");
+      return( -3);
+      }
+   if( sorted.field)       /* sorting is done in one thread */
+      n_threads = 1;
+   n_preds = compile_filters( argc, argv, preds);
+   ifile = gz_input_open( input_file_name);
    if( !ifile)
       {
       printf( "'%s' not opened\n", input_file_name);
       show_error_message( );
       return( -2);
       }
-   fseek( ifile, 0L, SEEK_END);
-   filesize = ftell( ifile);
-   fseek( ifile, 0L, SEEK_SET);
+   if( !gz_input_file( ifile))      /* gzipped input */
+      {
+      if( cache_name)
+         {
+         printf( "'-x' requires uncompressed input\n");
+         return( -3);
+         }
+      n_threads = 1;       /* inflation is already on its own thread */
+      sorted.keep_lines = true;
+      }
 
    if( argc == 1)   /* No command-line args:  just converting to CR/LF */
       {
@@ -129,7 +1290,7 @@ int main( const int argc, const char **argv)
          /* Read in and output header,  unaltered: */
    *buff = '\0';
    while( memcmp( buff, "A brief header", 14) &&
-                        fgets( buff, sizeof( buff), ifile))
+                        gz_input_gets( buff, sizeof( buff), ifile))
       output_line( output_file, buff, use_cr);
 
 
@@ -149,129 +1310,77 @@ int main( const int argc, const char **argv)
       }
 
          /* Output remainder of the header:  */
-   while( memcmp( buff, "------", 6) && fgets( buff, sizeof( buff), ifile))
+   while( memcmp( buff, "------", 6) && gz_input_gets( buff, sizeof( buff), ifile))
       output_line( output_file, buff, use_cr);
 
                /* Now we're ready to read asteroid records: */
-   while( fgets( buff, sizeof( buff), ifile))
+   if( argc == 1)
+      {
+      n_lines_output = bulk_crlf_convert( output_file, ifile, &line_no);
+      records_done = true;
+      }
+#ifndef _WIN32
+   if( cache_name)
+      {
+      n_lines_output = columnar_filter( output_file, input_file_name,
+                  cache_name, (size_t)gz_input_tell( ifile), preds, n_preds,
+                  use_cr != 0, (sorted.field ? &sorted : NULL), &line_no);
+      if( n_lines_output < 0)
+         {
+         fprintf( stderr, "Couldn't use cache '%s'\n", cache_name);
+         return( -2);
+         }
+      records_done = true;
+      }
+   else if( n_threads != 1)
+      {
+      n_lines_output = parallel_filter( output_file, input_file_name,
+                  (size_t)gz_input_tell( ifile), preds, n_preds, use_cr != 0,
+                  n_threads, &line_no);
+      if( n_lines_output < 0)
+         {
+         fprintf( stderr, "Couldn't map '%s'\n", input_file_name);
+         return( -2);
+         }
+      records_done = true;
+      }
+#else
+   (void)n_threads;        /* Windows builds filter in one thread */
+#endif
+   if( sorted.field)
+      offset = (long)gz_input_tell( ifile);
+   while( !records_done && gz_input_gets( buff, sizeof( buff), ifile))
+      {
+      const long line_offset = offset;
+
+      if( sorted.field)
+         offset += (long)strlen( buff);
       if( strlen( buff) > 200 && buff[29] == '.' && buff[95] == '.')
          {
          bool show_it = true;
-         int i;
 
          line_no++;
-         if( !n_lines)
-            n_lines = 1 + (filesize - ftell( ifile)) / strlen( buff);
-         for( i = 1; i < argc && show_it; i++)
-            {
-            const bool less_than    = (NULL != strchr( "<({l", argv[i][1]));
-            const bool greater_than = (NULL != strchr( ">)}g", argv[i][1]));
-
-            if( greater_than || less_than || argv[i][1] == ':')
-               {
-               const double DUMMY_VAL = -31.4159207;
-               double val = DUMMY_VAL;
-               const char *semimajor = buff + 91;
-               const char *ecc = buff + 69;
-
-               switch( argv[i][0])
-                  {
-                  case 'a':
-                      val = atof( semimajor);
-                      break;
-                  case 'P':
-                      {
-                      const double a = atof( semimajor);
-
-                      val = a * sqrt( a);
-                      }
-                      break;
-                  case 'q':
-                      val = atof( semimajor) * (1. - atof( ecc));
-                      break;
-                  case 'Q':
-                      val = atof( semimajor) * (1. + atof( ecc));
-                      break;
-                  case 'H':     /* Consider non-blank H values only */
-                      if( buff[10] != ' ')
-                         val = atof( buff + 8);
-                      else
-                        show_it = false;
-                      break;
-                  case 'n':    /* mean motion */
-                      val = atof( buff + 80);
-                      break;
-                  case 'O':    /* date last observed */
-                      val = atof( buff + 194);
-                      break;
-                  case 'A':    /* ascending node */
-                      val = atof( buff + 48);
-                      break;
-                  case 'p':    /* arg perih */
-                      val = atof( buff + 37);
-                      break;
-                  case 'N':     /* line #; = asteroid # for numbered objs */
-                      val = (double)line_no;
-                      break;
-                  case 'd':     /* filter by provisional designation */
-                     {
-                     const int len = strlen( argv[i] + 2);
-                     const int compare = memcmp( buff, argv[i] + 2, len);
-
-                     if( buff[len - 1] == ' ')
-                        show_it = false;
-                     else
-                        {
-                        if( less_than && compare > 0)
-                           show_it = false;
-                        if( greater_than && compare < 0)
-                           show_it = false;
-                        }
-                     }
-                     break;
-                  case 'e':
-                      val = atof( ecc);
-                      break;
-                  case 'i':
-                      val = atof( buff + 59);
-                      break;
-                  default:
-                      break;
-                  }
-               if( val != DUMMY_VAL)
-                  {
-                  if( argv[i][1] == ':')
-                     {
-                     double low_range, high_range;
-
-                     if( sscanf( argv[i] + 2, "%lf,%lf", &low_range, &high_range) == 2)
-                        if( val < low_range || val > high_range)
-                           show_it = false;
-                     }
-                  else
-                     {
-                     const double comparison = atof( argv[i] + 2);
-
-                     if( less_than && val > comparison)
-                         show_it = false;
-                     if( greater_than && val < comparison)
-                         show_it = false;
-                     }
-                  }
-               }
-            }
-         if( show_it)
+         if( !passes_filters( preds, n_preds, buff, line_no))
+            show_it = false;
+         if( show_it && sorted.field)
+            add_sorted_record( &sorted, sort_key( buff, line_no, sorted.field),
+                               line_no, line_offset, buff);
+         else if( show_it)
              {
              n_lines_output++;
              output_line( output_file, buff, use_cr);
              }
          }
-   fclose( ifile);
+      }
+   if( sorted.field)
+      n_lines_output = output_sorted_records( output_file,
+                             gz_input_file( ifile), &sorted, use_cr);
+   i = gz_input_close( ifile);
    if( output_file != stdout)
       {
       printf( "%d lines read in; %d lines written\n",
                   line_no, n_lines_output);
       fclose( output_file);
       }
-   return( 0);
+   return( i);
 }
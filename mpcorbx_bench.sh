@@ -0,0 +1,75 @@
+#!/bin/sh
+# Times a set of 'mpcorbx' queries against the full MPCORB.DAT (about
+# 1.4 million objects),  and optionally checks the output against another
+# build of mpcorbx (say,  one built from an older commit).  Usage :
+#
+# ./mpcorbx_bench.sh (MPCORB.DAT) [reference mpcorbx]
+#
+# MPCORB.DAT can be had from
+#
+# https://www.minorplanetcenter.net/iau/MPCORB/MPCORB.DAT.gz
+#
+# For each query,  the number of lines written and wall time are shown
+# (plus the reference time,  and whether the output matched,  if a
+# reference was given).  The 'mpcorbx version (date),  run on (time)'
+# line is ignored in the comparison.  The queries can be changed by
+# setting BENCH_QUERIES,  one set of arguments per line;  BIN gives the
+# directory containing 'mpcorbx' (default is the current directory).
+
+if [ -z "$1" ] || [ ! -f "$1" ]; then
+   echo "Usage: mpcorbx_bench.sh (MPCORB.DAT) [reference mpcorbx]"
+   exit 1
+fi
+MPCORB=$1
+REF=$2
+BIN=${BIN:-$(pwd)}
+
+if [ -z "$BENCH_QUERIES" ]; then
+   BENCH_QUERIES="H(10
+a(1.3 a)1.
+q(1.3
+Q(8.1 e).7
+P)1.6 i)10 i(16
+n(.5 A)181 p(43
+O(19900810
+d)K10K42Q
+N(1700 H(15
+a:2.1,3.3 e:0,.1 i:0,5 H:14,17
+q(1.017 H(22 O)20200101"
+fi
+
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+
+now()
+{
+   date +%s.%N
+}
+
+printf "%9s %9s %9s %5s  %s\n" lines seconds ref_sec same args
+echo "$BENCH_QUERIES" | while read -r ARGS; do
+   if [ -z "$ARGS" ]; then
+      continue
+   fi
+   T0=$(now)
+   "$BIN/mpcorbx" -i"$MPCORB" $ARGS | grep -v "^mpcorbx version" > "$SCRATCH/new.txt"
+   T1=$(now)
+   LINES=$(wc -l < "$SCRATCH/new.txt")
+   if [ -n "$REF" ]; then
+      "$REF" -i"$MPCORB" $ARGS | grep -v "^mpcorbx version" > "$SCRATCH/ref.txt"
+      T2=$(now)
+      if cmp -s "$SCRATCH/new.txt" "$SCRATCH/ref.txt"; then
+         SAME=yes
+      else
+         SAME=NO
+      fi
+   else
+      T2=$T1
+      SAME=-
+   fi
+   echo "$LINES $T0 $T1 $T2 $SAME $ARGS" | awk \
+        '{ printf( "%9d %9.3f %9.3f %5s ", $1, $3 - $2, $4 - $3, $5);
+           for( i = 6; i <= NF; i++)
+              printf( " %s", $i);
+           printf( "\n") }'
+done
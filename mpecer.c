@@ -19,12 +19,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <stdio.h>
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include "url_fetch.h"
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <time.h>
+#include "dl_cache.h"
 
 /* Code to download MPEC headers for a given year to create an index.  See
 
@@ -38,9 +40,9 @@ wants to update those indices.
    When run with the (four-digit) year as a command line arguments,  the
 code looks through the _existing_ 'YYYY.htm' file to find the last MPEC in
 it.   Let's say you're running it for 2017,  and the last MPEC listed in
-'2017.htm' is 2017-C42;  the code will grab the first 20000 bytes of the
-assumed next MPEC,  2017-C43,  and get a summary for it. Then for C44,
-and so on.
+'2017.htm' is 2017-C42;  the code will grab the assumed next MPEC,
+2017-C43 (only as much of it as is needed;  see below),  and get a
+summary for it. Then for C44,  and so on.
 
    Eventually,  this will fail to access anything,  and the code looks for
 2017-D01,  D02, ...
@@ -53,45 +55,101 @@ is unharmed.
    If you run the code frequently,  it'll usually just access a few recent
 MPECs and fail when it tries to get the first MPEC of the next half-month.
 If you haven't run it for four months,  though,  it'll get data for eight
-half-months.         */
+half-months.
+
+   MPECs that were successfully found are kept in the shared download
+cache (see 'dl_cache.c'),  so re-running the code (e.g.,  after a failure
+partway through) doesn't re-fetch them.  MPECs that weren't found are
+not cached,  so we'll look for them again next time.
+
+   Each MPEC is parsed line by line as it arrives,  inside the libcurl
+write callback,  rather than being saved to a scratch file and read
+back.  Once we have everything that goes into the index (title,  'Issued'
+date,  and the orbital elements,  which come after the observations used
+for the station list),  the callback returns zero,  which stops the
+transfer.  That means we usually get much less than the 20000 bytes we
+used to ask for.  But we also no longer ask for a byte range,  so that
+long MPECs whose elements come after byte 20000 are no longer truncated.
+MAX_MPEC_BYTES is a backstop for MPECs (editorials,  for example) that
+have no elements at all;  Daily Orbit Updates,  which are huge and from
+which we only want the title,  are still cut off at 20000 bytes.   */
 
 size_t total_written;
 
 int verbose = 0;
 
-static size_t write_data(void *ptr, size_t size, size_t nmemb, FILE *stream) {
-    size_t written;
+#define MAX_MPEC_BYTES 400000
 
-    written = fwrite(ptr, size, nmemb, stream);
-    total_written += written;
-    return written;
+/* MPECs are fetched 'max_parallel' at a time,  using libcurl's 'multi'
+interface,  with at most that many connections to MPC open at once (to
+be polite to their server).  The results are then written out in MPEC
+order,  so the output is the same as if they'd been fetched one at a
+time;  any fetched beyond the first missing MPEC of a half-month are
+discarded.  When starting a new half-month,  only its first MPEC is
+requested,  since usually (when run often) that's the one that will fail.
+-p(n) sets 'max_parallel';  -p1 gets you the old one-at-a-time behavior.
+
+   Since several MPECs are being parsed at once,  each one's parsing
+state lives in an mpec_fetch_t,  and its output is accumulated there
+until it can be written in order.   */
+
+static int max_parallel = 4;
+
+typedef struct
+{
+   char url[200], cache_key[220];
+   char half_month;
+   int mpec_no;
+   CURL *curl;
+   bool from_cache, done, needs_retry;
+   char *raw;                 /* bytes received so far */
+   size_t raw_len, raw_alloced;
+   char line[200];            /* partial line,  as fgets() would see it */
+   size_t line_len;
+               /* parsing state : */
+   int rval, found_name, title_state, elements_lines_left;
+   char name[400], issued[200], elements[300], stns[100];
+   double semimajor_axis, eccentricity, perihelion_dist, earth_moid;
+   int n_written, n_stns_found;
+   bool is_daily_orbit_update, discovery_found;
+} mpec_fetch_t;
+
+static void set_mpec_url( char *url, const char *year, const char half_month,
+                                    const int mpec_no)
+{
+   sprintf( url, "https://www.minorplanetcenter.net/mpec/%s/%s%cx%d.html",
+                        year, year, half_month, mpec_no % 10);
+   assert( mpec_no > 0 && mpec_no < 620);
+   if( mpec_no < 100)
+      url[47] = '0' + mpec_no / 10;
+   else if( mpec_no < 360)
+      url[47] = 'A' + mpec_no / 10 - 10;
+   else
+      url[47] = 'a' + mpec_no / 10 - 36;
+}
+
+static void fix_html_literals( char *buff)
+{
+   const char *fixes[] = { "&&amp;", "<&lt;", ">&gt;", "\"&quot;",
+                  " &nbsp;", "'&apos;", NULL };
+   char *tptr;
+   size_t i;
+
+   for( i = 0; fixes[i]; i++)
+      while( NULL != (tptr = strstr( buff, fixes[i] + 1)))
+         {
+         *tptr = fixes[i][0];
+         memmove( tptr + 1, tptr + strlen( fixes[i]) - 1, strlen( tptr));
+         }
 }
 
-static int grab_file( const char *url, const char *outfilename,
-                                    const bool append)
+static bool is_observation_line( const char *buff)
 {
-    CURL *curl = curl_easy_init();
-
-    assert( curl);
-    if (curl) {
-        FILE *fp = fopen( outfilename, (append ? "ab" : "wb"));
-        CURLcode res;
-        char errbuff[CURL_ERROR_SIZE];
-
-        assert( fp);
-        curl_easy_setopt( curl, CURLOPT_URL, url);
-        curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, write_data);
-        curl_easy_setopt( curl, CURLOPT_WRITEDATA, fp);
-        curl_easy_setopt( curl, CURLOPT_RANGE, "0-20000");
-        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuff);
-        res = curl_easy_perform(curl);
-        if( res)
-           fprintf( stderr, "res = %d (%s)\n", res, errbuff);
-        assert( !res);
-        curl_easy_cleanup(curl);
-        fclose(fp);
-    }
-    return 0;
+   const bool rval = ( strlen( buff) == 81
+               && (buff[44] == '+' || buff[44] == '-')
+               && buff[25] == '.' && buff[22] == ' ' && buff[40] == '.');
+
+   return( rval);
 }
 
 /* In some cases,  such as MPECs 2019-055, 2020-O10,  etc.,  the title isn't
@@ -100,112 +158,139 @@ given on the first line with an <h2> tag.  It'll instead look like,  e.g.,
 <h2>MPEC 2020-O10 : </h2>
 
     In such cases,  you have to search a bit further down in the MPEC
-to find it,  then rewind back to where you were.  Return value is -1 if
-we couldn't find the ISSN text that ought to be present;  -2 if we found
-that text,  but no </b> tag in the following five lines;  -3 if we found
-that </b> tag,  but no <b> tag before it;  and 0 if we actually found
-the title we were looking for.  */
+to find it.  'title_state' is 1 until we've found such a line;  -1 while
+we're looking for the ISSN text that ought to be present;  -2 if we found
+that text,  but no </b> tag yet;  -3 if we found that </b> tag,  but no
+<b> tag before it;  and 0 if we actually found the title we were looking
+for (or never needed to look).  */
 
-static int look_for_mpec_title( FILE *ifile, char *title)
+static void look_for_mpec_title( mpec_fetch_t *f, const char *line)
 {
-   const long curr_loc = ftell( ifile);
    char buff[200], *tptr;
-   int rval = -1;
 
-   while( rval == -1 && fgets( buff, sizeof( buff), ifile))
-      if( strstr( buff, "ISSN 1523-6714"))
-         rval = -2;
-   while( rval == -2 && fgets( buff, sizeof( buff), ifile))
+   if( f->title_state == -1)
+      {
+      if( strstr( line, "ISSN 1523-6714"))
+         f->title_state = -2;
+      }
+   else if( f->title_state == -2)
+      {
+      strcpy( buff, line);
       if( (tptr = strstr( buff, "</b>")) != NULL)
          {
          *tptr = '\0';
          tptr = strstr( buff, "<b>");
          if( tptr)
             {
-            strcpy( title, tptr + 3);
-            rval = 0;
+            strcat( f->name, tptr + 3);
+            f->title_state = 0;
             }
          else
-            rval = -3;
+            f->title_state = -3;
          }
-   fseek( ifile, curr_loc, SEEK_SET);
-   if( rval)
-      fprintf( stderr, "Couldn't find MPEC title : %d\n", rval);
-   return( rval);
+      }
 }
 
-static void fix_html_literals( char *buff)
+/* Called for each of the nine lines following 'Orbital elements:' */
+
+static void parse_element_line( mpec_fetch_t *f, const char *buff)
 {
-   const char *fixes[] = { "&&amp;", "<&lt;", ">&gt;", "\"&quot;",
-                  " &nbsp;", "'&apos;", NULL };
-   char *tptr;
-   size_t i;
+   const char *tptr;
+   char *tbuff = f->elements;
+   int j;
+
+   tptr = strstr( buff, "MOID</a>");
+   if( tptr)
+      f->earth_moid = atof( tptr + 11);
+   tptr = strstr( buff, "Earth MOID = ");
+   if( tptr)
+      f->earth_moid = atof( tptr + 13);
+   if( strchr( "aeq", *buff) && buff[1] == ' ')
+      {
+      j = 1;
+      while( buff[j] == ' ')
+         j++;
+      f->n_written += sprintf( tbuff + strlen( tbuff), " %s%c=%.5s",
+                  (f->n_written ? "" : "("), *buff, buff + j);
+      if( *buff == 'a')
+         f->semimajor_axis = atof( buff + j);
+      if( *buff == 'e')
+         f->eccentricity = atof( buff + j);
+      if( *buff == 'q')
+         f->perihelion_dist = atof( buff + j);
+      }
+   if( strlen( buff) > 24 && !memcmp( buff + 19, "Incl.", 5))
+      f->n_written += sprintf( tbuff + strlen( tbuff), " %si=%.5s",
+                  (f->n_written ? "" : "("), buff + 26);
+   if( strlen( buff) > 23 && !memcmp( buff + 19, "H   ", 4))
+      {
+      const char *format = (strlen( buff) > 27 && buff[27] == ' ' ?
+                              " %sH=%.4s" : " %sH=%.5s");
 
-   for( i = 0; fixes[i]; i++)
-      while( NULL != (tptr = strstr( buff, fixes[i] + 1)))
-         {
-         *tptr = fixes[i][0];
-         memmove( tptr + 1, tptr + strlen( fixes[i]) - 1, strlen( tptr));
-         }
+      f->n_written += sprintf( tbuff + strlen( tbuff), format,
+                  (f->n_written ? "" : "("), buff + 23);
+      }
 }
 
-static bool is_observation_line( const char *buff)
+static void finish_elements( mpec_fetch_t *f)
 {
-   const bool rval = ( strlen( buff) == 81
-               && (buff[44] == '+' || buff[44] == '-')
-               && buff[25] == '.' && buff[22] == ' ' && buff[40] == '.');
+   char *tbuff = f->elements;
 
-   return( rval);
+   if( f->semimajor_axis && f->eccentricity && !f->perihelion_dist)
+      {
+      f->perihelion_dist = f->semimajor_axis * (1. - f->eccentricity);
+      sprintf( tbuff + strlen( tbuff), " q=%.3f", f->perihelion_dist);
+      }
+   if( f->n_written && f->earth_moid >= 0.)
+      sprintf( tbuff + strlen( tbuff), " MOID=%.4f", f->earth_moid);
+   if( f->n_written)
+      sprintf( tbuff + strlen( tbuff), ") %s", f->stns);
+   f->elements_lines_left = 0;
+   f->done = true;
 }
 
-static int grab_mpec( FILE *ofile, const char *year, const char half_month, const int mpec_no)
+   /* We're done once the elements are parsed,  and we either have the
+      title or have given up on finding it.  */
+
+static bool have_everything( const mpec_fetch_t *f)
 {
-   char buff[200], url[200], *tptr;
-   FILE *ifile;
-   int i, rval = -1, found_name = 0;
-   double semimajor_axis = 0.;
-   double eccentricity = 0.;
-   double perihelion_dist = 0.;
-   double earth_moid = -1.;
-   char stns[100];
-   int n_stns_found = 0;
-   bool is_daily_orbit_update = false;
-   bool discovery_found = false;
+   return( f->done && (f->title_state >= 0 || f->title_state == -3));
+}
 
-   sprintf( url, "https://www.minorplanetcenter.net/mpec/%s/%s%cx%d.html",
-                        year, year, half_month, mpec_no % 10);
-   assert( mpec_no > 0 && mpec_no < 620);
-   if( mpec_no < 100)
-      url[47] = '0' + mpec_no / 10;
-   else if( mpec_no < 360)
-      url[47] = 'A' + mpec_no / 10 - 10;
-   else
-      url[47] = 'a' + mpec_no / 10 - 36;
-   grab_file( url, "zz", 0);
-   ifile = fopen( "zz", "rb");
-   assert( ifile);
-   while( rval && fgets( buff, sizeof( buff), ifile))
+static void parse_mpec_line( mpec_fetch_t *f, char *buff)
+{
+   char *tptr;
+
+   if( f->title_state < 0 && f->title_state > -3)
+      look_for_mpec_title( f, buff);
+   if( f->elements_lines_left)
+      {
+      parse_element_line( f, buff);
+      if( !--f->elements_lines_left)
+         finish_elements( f);
+      }
+   else if( f->done)
+      ;
+   else if( f->rval)       /* still looking for title and 'Issued' line */
+      {
       if( !memcmp( buff, "<h2>", 4))
          {
          tptr = strstr( buff, "</h2>");
          assert( tptr);
-         assert( !found_name);
-         if( mpec_no == 1)
-            fprintf( ofile, "<br>\n<a name=\"%c\"> </a>\n", half_month);
+         assert( !f->found_name);
          *tptr = '\0';
+         strcpy( f->name, buff + 4);
          if( !strcmp( tptr - 3, " : "))
-            look_for_mpec_title( ifile, tptr);
-         fprintf( ofile, "<a href=\"%s\"> %s </a>", url, buff + 4);
-         printf( "%s ", buff + 4);
+            f->title_state = -1;
          if( strstr( buff + 4, "DAILY ORBIT"))
-            is_daily_orbit_update = true;
-         found_name = 1;
+            f->is_daily_orbit_update = true;
+         f->found_name = 1;
          }
       else if( (tptr = strstr( buff, "Issued")) != NULL)
          {
          char *ut = strstr( tptr + 6, " UT");
 
-         assert( found_name);
+         assert( f->found_name);
                   /* MPEC 2000-G03 is damaged,  needs this repair : */
          if( !ut && !memcmp( tptr, "Issued 2000 Apr.  2.298, 07:09", 30))
             strcpy( tptr, "Issued 2000 Apr. 2,  07:09");
@@ -214,107 +299,261 @@ static int grab_mpec( FILE *ofile, const char *year, const char half_month, cons
             assert( ut);
             *ut = '\0';
             }
-         fprintf( ofile, "%s", tptr + 6);
-         rval = 0;
+         strcpy( f->issued, tptr + 6);
+         f->rval = 0;
          }
-   *stns = '\0';
-   if( !rval)
+      }
+   else
       {
-      while( fgets( buff, sizeof( buff), ifile))
+      fix_html_literals( buff);
+      if( !memcmp( buff, "Orbital elements:", 17))
+         f->elements_lines_left = 9;
+      else if( is_observation_line( buff) && !f->is_daily_orbit_update)
          {
-         fix_html_literals( buff);
-         if( !memcmp( buff, "Orbital elements:", 17))
+         buff[80] = '\0';
+         if( verbose > 2)
+            printf( "Got observation line %s", buff);
+         if( !strstr( f->stns, buff + 77) && f->n_stns_found < 4)
             {
-            int n_written = 0, j;
-            char tbuff[100];
+            if( f->stns[0])
+               strcat( f->stns, " ");
+            strcat( f->stns, buff + 77);
+            f->n_stns_found++;
+            }
+         if( buff[12] == '*' && !f->discovery_found)
+            {                       /* show discovery stn in bold */
+            tptr = strstr( f->stns, buff + 77);
 
-            *tbuff = '\0';
-            for( i = 0; i < 9 && fgets( buff, sizeof( buff), ifile); i++)
+            if( tptr)
                {
-               tptr = strstr( buff, "MOID</a>");
-               if( tptr)
-                  earth_moid = atof( tptr + 11);
-               tptr = strstr( buff, "Earth MOID = ");
-               if( tptr)
-                  earth_moid = atof( tptr + 13);
-               if( strchr( "aeq", *buff) && buff[1] == ' ')
-                  {
-                  j = 1;
-                  while( buff[j] == ' ')
-                     j++;
-                  n_written += sprintf( tbuff + strlen( tbuff), " %s%c=%.5s",
-                              (n_written ? "" : "("), *buff, buff + j);
-                  if( *buff == 'a')
-                     semimajor_axis = atof( buff + j);
-                  if( *buff == 'e')
-                     eccentricity = atof( buff + j);
-                  if( *buff == 'q')
-                     perihelion_dist = atof( buff + j);
-                  }
-               if( !memcmp( buff + 19, "Incl.", 5))
-                  n_written += sprintf( tbuff + strlen( tbuff), " %si=%.5s",
-                              (n_written ? "" : "("), buff + 26);
-               if( !memcmp( buff + 19, "H   ", 4))
-                  {
-                  const char *format = (buff[27] == ' ' ?
-                                          " %sH=%.4s" : " %sH=%.5s");
-
-                  n_written += sprintf( tbuff + strlen( tbuff), format,
-                              (n_written ? "" : "("), buff + 23);
-                  }
-               memset( buff, 0, sizeof( buff));
+               memmove( tptr + 7, tptr + 3, strlen( tptr + 2));
+               memcpy( tptr + 3, "</b>", 4);
+               memmove( tptr + 3, tptr, strlen( tptr) + 1);
+               memcpy( tptr, "<b>", 3);
+               f->discovery_found = true;
                }
-            if( semimajor_axis && eccentricity && !perihelion_dist)
+            }
+         }
+      else if( verbose > 2)
+         printf( "Got unrecognized line %s", buff);
+      }
+}
+
+/* Data is split into lines exactly as fgets( buff, 200, ifile) would
+have done,  and each line is parsed.  Returns true once we have all we
+need from this MPEC.   */
+
+static bool feed_mpec_data( mpec_fetch_t *f, const char *data, size_t n_bytes)
+{
+   while( n_bytes-- && !have_everything( f))
+      {
+      const char c = *data++;
+
+      f->line[f->line_len++] = c;
+      if( c == '\n' || f->line_len == sizeof( f->line) - 1)
+         {
+         f->line[f->line_len] = '\0';
+         f->line_len = 0;
+         parse_mpec_line( f, f->line);
+         }
+      }
+   return( have_everything( f));
+}
+
+static size_t mpec_write_callback( char *ptr, size_t size, size_t nmemb,
+                                    void *context_ptr)
+{
+   mpec_fetch_t *f = (mpec_fetch_t *)context_ptr;
+   const size_t n_bytes = size * nmemb;
+
+   total_written += n_bytes;
+   if( f->raw_len + n_bytes > f->raw_alloced)
+      {
+      f->raw_alloced = (f->raw_len + n_bytes) * 2;
+      f->raw = (char *)realloc( f->raw, f->raw_alloced);
+      assert( f->raw);
+      }
+   memcpy( f->raw + f->raw_len, ptr, n_bytes);
+   f->raw_len += n_bytes;
+   if( feed_mpec_data( f, ptr, n_bytes) || f->raw_len > MAX_MPEC_BYTES)
+      return( 0);       /* got what we need;  abort transfer */
+   if( f->is_daily_orbit_update && f->raw_len > 20000)
+      return( 0);       /* DOUs are huge,  and we only need the header */
+   return( n_bytes);
+}
+
+static void free_mpec_fetch( mpec_fetch_t *f)
+{
+   free( f->raw);
+   f->raw = NULL;
+}
+
+static void init_mpec_fetch( mpec_fetch_t *f)
+{
+   f->curl = NULL;
+   f->from_cache = f->done = f->needs_retry = false;
+   f->raw = NULL;
+   f->raw_len = f->raw_alloced = f->line_len = 0;
+   f->rval = -1;
+   f->found_name = f->n_written = f->n_stns_found = 0;
+   f->title_state = 1;
+   f->elements_lines_left = 0;
+   *f->name = *f->issued = *f->elements = *f->stns = '\0';
+   f->semimajor_axis = f->eccentricity = f->perihelion_dist = 0.;
+   f->earth_moid = -1.;
+   f->is_daily_orbit_update = f->discovery_found = false;
+}
+
+/* Sets up parsers for 'n_fetches' MPECs,  feeds them whatever we have
+cached,  and downloads the rest concurrently.  Handles come from
+'url_fetch.c',  so they share one connection pool (and,  if MPC's server
+allows it,  are multiplexed over HTTP/2).  MPECs that fail with a
+transient error are reset and tried again in another round,  after an
+exponential backoff delay,  up to URL_FETCH_MAX_RETRIES times.  */
+
+static void start_mpec_transfer( CURLM *multi, mpec_fetch_t *f)
+{
+   f->curl = url_fetch_new_handle( );
+   url_fetch_set_url( f->curl, f->url);
+   curl_easy_setopt( f->curl, CURLOPT_WRITEFUNCTION, mpec_write_callback);
+   curl_easy_setopt( f->curl, CURLOPT_WRITEDATA, f);
+   curl_easy_setopt( f->curl, CURLOPT_PRIVATE, f);
+   curl_multi_add_handle( multi, f->curl);
+}
+
+static int fetch_mpecs( mpec_fetch_t *fetches, const int n_fetches)
+{
+   CURLM *multi = curl_multi_init( );
+   int i, still_running, n_msgs, attempt, n_to_retry = 0;
+   CURLMsg *msg;
+
+   assert( multi);
+   curl_multi_setopt( multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)max_parallel);
+   curl_multi_setopt( multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)max_parallel);
+#if LIBCURL_VERSION_NUM >= 0x072b00        /* CURLPIPE_MULTIPLEX is 7.43.0 */
+   curl_multi_setopt( multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+   for( i = 0; i < n_fetches; i++)
+      {
+      mpec_fetch_t *f = fetches + i;
+      char *cached;
+      size_t cached_len;
+
+      init_mpec_fetch( f);
+      snprintf( f->cache_key, sizeof( f->cache_key), "%s summary", f->url);
+      cached = dl_cache_load( f->cache_key, DL_CACHE_TTL_MPEC, &cached_len);
+      if( cached)
+         {
+         f->from_cache = true;
+         feed_mpec_data( f, cached, cached_len);
+         free( cached);
+         }
+      else
+         start_mpec_transfer( multi, f);
+      }
+   for( attempt = 0; !attempt || n_to_retry; attempt++)
+      {
+      if( n_to_retry)
+         {
+         url_fetch_sleep_ms( url_fetch_retry_delay_ms( attempt - 1));
+         for( i = 0; i < n_fetches; i++)
+            if( fetches[i].needs_retry)
                {
-               perihelion_dist = semimajor_axis * (1. - eccentricity);
-               sprintf( tbuff + strlen( tbuff), " q=%.3f", perihelion_dist);
+               free_mpec_fetch( fetches + i);
+               init_mpec_fetch( fetches + i);
+               start_mpec_transfer( multi, fetches + i);
                }
-            if( n_written && earth_moid >= 0.)
-               sprintf( tbuff + strlen( tbuff), " MOID=%.4f", earth_moid);
-            if( n_written)
-               sprintf( tbuff + strlen( tbuff), ") %s", stns);
-            fprintf( ofile, "%s", tbuff);
-            printf( "%s", tbuff);
-            fseek( ifile, 0L, SEEK_END);
+         }
+      n_to_retry = 0;
+      still_running = 1;
+      while( still_running)
+         {
+         CURLMcode mc = curl_multi_perform( multi, &still_running);
+
+         if( !mc && still_running)
+#if LIBCURL_VERSION_NUM >= 0x074200        /* curl_multi_poll() is 7.66.0 */
+            mc = curl_multi_poll( multi, NULL, 0, 1000, NULL);
+#else
+            mc = curl_multi_wait( multi, NULL, 0, 1000, NULL);
+#endif
+         if( mc)
+            {
+            fprintf( stderr, "curl_multi error %d (%s)\n", (int)mc,
+                                 curl_multi_strerror( mc));
+            break;
             }
-         else if( is_observation_line( buff) && !is_daily_orbit_update)
+         }
+      while( (msg = curl_multi_info_read( multi, &n_msgs)) != NULL)
+         if( msg->msg == CURLMSG_DONE)
             {
-            buff[80] = '\0';
-            if( verbose > 2)
-               printf( "Got observation line %s", buff);
-            if( !strstr( stns, buff + 77) && n_stns_found < 4)
+            const CURLcode res = msg->data.result;
+            mpec_fetch_t *f;
+
+            curl_easy_getinfo( msg->easy_handle, CURLINFO_PRIVATE, (char **)&f);
+            if( url_fetch_is_transient( msg->easy_handle, res)
+                        && attempt < URL_FETCH_MAX_RETRIES)
                {
-               if( stns[0])
-                  strcat( stns, " ");
-               strcat( stns, buff + 77);
-               n_stns_found++;
+               fprintf( stderr, "%s failed (%s);  will retry\n", f->url,
+                           (res ? curl_easy_strerror( res) : "server error"));
+               curl_multi_remove_handle( multi, f->curl);
+               curl_easy_cleanup( f->curl);
+               f->curl = NULL;
+               f->needs_retry = true;
+               n_to_retry++;
                }
-            if( buff[12] == '*' && !discovery_found)
-               {                       /* show discovery stn in bold */
-               char *tptr = strstr( stns, buff + 77);
-
-               if( tptr)
-                  {
-                  memmove( tptr + 7, tptr + 3, strlen( tptr + 2));
-                  memcpy( tptr + 3, "</b>", 4);
-                  memmove( tptr + 3, tptr, strlen( tptr) + 1);
-                  memcpy( tptr, "<b>", 3);
-                  discovery_found = true;
-                  }
+            else if( res && res != CURLE_WRITE_ERROR)
+               {        /* write 'errors' are just us stopping early */
+               fprintf( stderr, "res = %d (%s)\n", (int)res,
+                                 curl_easy_strerror( res));
+               assert( !res);
                }
             }
-         else if( verbose > 2)
-            printf( "Got unrecognized line %s", buff);
+      }
+   for( i = 0; i < n_fetches; i++)
+      {
+      mpec_fetch_t *f = fetches + i;
+
+      if( f->curl)
+         {
+         curl_multi_remove_handle( multi, f->curl);
+         curl_easy_cleanup( f->curl);
+         f->curl = NULL;
+         }
+      if( f->line_len)        /* last line had no line feed */
+         {
+         f->line[f->line_len] = '\0';
+         f->line_len = 0;
+         parse_mpec_line( f, f->line);
          }
+      if( f->elements_lines_left)
+         finish_elements( f);
       }
+   curl_multi_cleanup( multi);
+   return( 0);
+}
 
-   if( !rval)
+/* Writes out the summary of an MPEC after it's been parsed.  Returns -1
+if it doesn't appear to exist. */
+
+static int write_mpec_summary( FILE *ofile, mpec_fetch_t *f)
+{
+   if( f->found_name)
       {
-      fprintf( ofile, "<br>\n");
-      printf( "\n");
+      if( f->mpec_no == 1)
+         fprintf( ofile, "<br>\n<a name=\"%c\"> </a>\n", f->half_month);
+      if( f->title_state < 0)
+         fprintf( stderr, "Couldn't find MPEC title : %d\n", f->title_state);
+      fprintf( ofile, "<a href=\"%s\"> %s </a>", f->url, f->name);
+      printf( "%s ", f->name);
       }
-   fclose( ifile);
-   return( rval);
+   if( !f->rval)
+      {
+      fprintf( ofile, "%s%s<br>\n", f->issued, f->elements);
+      printf( "%s\n", f->elements);
+      if( !f->from_cache)
+         dl_cache_store( f->cache_key, f->raw, f->raw_len);
+      }
+   return( f->rval);
 }
 
 /* Used in situations where failure to open a file is a fatal error */
@@ -344,6 +583,7 @@ int main( const int argc, const char **argv)
    const char *end_marker = "<a name=\"the_end\"> </a>";
    const char *temp_file_name = "temp.htm";
    bool found_end = false;
+   mpec_fetch_t *fetches;
 
    for( i = 2; i < argc; i++)
       if( argv[i][0] == '-')
@@ -355,6 +595,11 @@ int main( const int argc, const char **argv)
             case 'n':
                n_to_get = atoi( argv[i] + 2);
                break;
+            case 'p':
+               max_parallel = atoi( argv[i] + 2);
+               if( max_parallel < 1)
+                  max_parallel = 1;
+               break;
             default:
                printf( "Unrecognized command line option '%s'\n", argv[i]);
                return( -1);
@@ -363,6 +608,7 @@ int main( const int argc, const char **argv)
       {
       printf( "'mpecer' needs the (four-digit) year as a command line argument\n"
               "Options are -n(number) to set a maximum number of MPECs to check,\n"
+              "-p(number) to set the number fetched at once (default 4),\n"
               "and -v(number) to set verbose output\n");
       return( -1);
       }
@@ -399,18 +645,52 @@ int main( const int argc, const char **argv)
       }
    assert( found_end);
    sprintf( mpcized_year, "%c%02d", 'A' + year / 100 - 10, year % 100);
+   fetches = (mpec_fetch_t *)calloc( max_parallel, sizeof( mpec_fetch_t));
+   assert( fetches);
    for( ; n_to_get && half_month <= 'Y'; half_month++)
       if( half_month != 'I')
          {
-         while( n_to_get && !grab_mpec( ofile, mpcized_year, half_month, mpec_no))
+         bool found_missing = false;
+
+         while( n_to_get && !found_missing)
             {
-            n_to_get--;
-            mpec_no++;
+            int n_fetches = (mpec_no == 1 ? 1 : max_parallel);
+
+            if( n_fetches > n_to_get)
+               n_fetches = n_to_get;
+            if( n_fetches > 620 - mpec_no)
+               n_fetches = 620 - mpec_no;
+            if( n_fetches <= 0)
+               break;
+            for( i = 0; i < n_fetches; i++)
+               {
+               set_mpec_url( fetches[i].url, mpcized_year, (char)half_month,
+                                          mpec_no + i);
+               fetches[i].half_month = (char)half_month;
+               fetches[i].mpec_no = mpec_no + i;
+               }
+            fetch_mpecs( fetches, n_fetches);
+            for( i = 0; i < n_fetches; i++)
+               {
+               if( !found_missing)
+                  {
+                  if( write_mpec_summary( ofile, fetches + i))
+                     found_missing = true;
+                  else
+                     {
+                     n_to_get--;
+                     mpec_no++;
+                     }
+                  }
+               free_mpec_fetch( fetches + i);
+               }
             }
          if( mpec_no == 1)         /* didn't find anything for this  */
             half_month = 'Y';       /* half-month; we're done */
          mpec_no = 1;
          }
+   free( fetches);
+   url_fetch_cleanup( );
    fprintf( ofile, "%s\n", end_marker);
    while( fgets( buff, sizeof( buff), ifile))
       fputs( buff, ofile);
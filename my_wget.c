@@ -24,8 +24,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include "url_fetch.h"
 #if defined( __linux__) || defined( __unix__) || defined( __APPLE__)
    #include <sys/time.h>         /* these allow resource limiting */
    #include <sys/resource.h>     /* see 'avoid_runaway_process'   */
@@ -68,6 +72,11 @@ typedef struct
    const char *password;
 } file_fetch_t;
 
+/* Fetching threads update progress and 'is_done' fields,  which the main
+thread reads;  this mutex protects them.  */
+
+static pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /* Older cURL libraries don't have a progress function option  */
 #if defined( CURLOPT_XFERINFOFUNCTION) && defined( CURLOPT_XFERINFODATA)
 int progress_callback( void *clientp, curl_off_t dltotal, curl_off_t dlnow,
@@ -75,17 +84,38 @@ int progress_callback( void *clientp, curl_off_t dltotal, curl_off_t dlnow,
 {
    file_fetch_t *f = (file_fetch_t *)clientp;
 
+   pthread_mutex_lock( &progress_mutex);
    f->bytes_xferred = (size_t)dlnow;
    f->total_bytes = (size_t)dltotal;
    f->ultotal = (size_t)ultotal;
    f->ulnow   = (size_t)ulnow;
+   pthread_mutex_unlock( &progress_mutex);
    return( 0);       /* return non-zero value to abort xfer */
 }
 #endif
 
+/* On a retry,  we go back to where the file was when we started,  so
+that partial data from the failed attempt isn't kept.  */
+
+typedef struct
+{
+   FILE *fp;
+   long starting_loc;
+} retry_info_t;
+
+static void reset_for_retry( void *context)
+{
+   retry_info_t *r = (retry_info_t *)context;
+
+   fflush( r->fp);
+   fseek( r->fp, r->starting_loc, SEEK_SET);
+   if( ftruncate( fileno( r->fp), (off_t)r->starting_loc))
+      perror( "Couldn't truncate partial data");
+}
+
 void *fetch_a_file( void *args)
 {
-   CURL *curl = curl_easy_init();
+   CURL *curl = url_fetch_new_handle( );
    file_fetch_t *f = (file_fetch_t *)args;
 
    printf( "In working func: %s, %s\n", f->url, f->filename);
@@ -93,7 +123,6 @@ void *fetch_a_file( void *args)
    if( curl)
       {
       FILE *fp = fopen( f->filename, (f->flags & 1) ? "ab" : "wb");
-/*    const long starting_loc = ftell( fp);   */
 
       if( !fp)
          {
@@ -105,8 +134,12 @@ void *fetch_a_file( void *args)
       else
          {
          CURLcode res;
+         retry_info_t r;
 
-         curl_easy_setopt( curl, CURLOPT_URL, f->url);
+         fseek( fp, 0L, SEEK_END);
+         r.fp = fp;
+         r.starting_loc = ftell( fp);
+         url_fetch_set_url( curl, f->url);
          curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, fwrite);
          curl_easy_setopt( curl, CURLOPT_WRITEDATA, fp);
          if( f->password)
@@ -126,7 +159,7 @@ void *fetch_a_file( void *args)
             }
          else if( f->offset)
             curl_easy_setopt( curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)f->offset);
-         res = curl_easy_perform( curl);
+         res = url_fetch_perform( curl, reset_for_retry, &r);
          if( res)
             {
             printf( "libcurl error %d occurred\n", res);
@@ -137,7 +170,9 @@ void *fetch_a_file( void *args)
          }
       curl_easy_cleanup( curl);
       }
+   pthread_mutex_lock( &progress_mutex);
    f->is_done = true;
+   pthread_mutex_unlock( &progress_mutex);
    return( NULL);
 }
 
@@ -156,12 +191,397 @@ static int threaded_fetch_a_file( file_fetch_t *f)
    return( rval);
 }
 
+/* Segmented downloads.  With '-n(N)',  a large file (NumObs.txt.gz,  say)
+is split into N byte ranges,  each fetched on its own thread with its own
+connection,  and written with pwrite() directly into its place in an
+output file that has been preallocated to the full size.
+
+   Progress is kept in '(filename).part',  a small text file rewritten
+(to a temp file,  then renamed) about once a second.  Its first line gives
+the total file size and number of segments;  each following line gives a
+segment's starting and ending byte and the number of bytes done.  Only
+bytes already written to the output are counted.  So if the run is
+interrupted,  running the same command again fetches only what's missing.
+When all segments are complete,  the file length is checked (and the
+CRC-32 as well,  if '-c(crc)' was given),  and the .part file removed.
+
+   Each segment is also limited to MAX_SEGMENT_CPU seconds of CPU time
+(checked in the progress callback),  so the 'runaway process' limit
+applies per segment;  the process-wide rlimit is scaled up to match.
+
+   The segment threads update 'done' and 'is_done',  which the main
+thread reads (under 'progress_mutex') to report and save progress.  */
+
+#define MAX_SEGMENTS 64
+#define MAX_SEGMENT_CPU 60
+
+typedef struct
+{
+   const char *url, *password;
+   CURL *curl;
+   char range[60];
+   int fd, error_code;
+   long long start, end, done;      /* 'end' is inclusive */
+   bool is_done, is_http;
+} segment_t;
+
+static double thread_cpu_seconds( void)
+{
+   struct timespec t;
+
+   if( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &t))
+      return( 0.);
+   return( (double)t.tv_sec + (double)t.tv_nsec * 1e-9);
+}
+
+/* CURLOPT_XFERINFOFUNCTION is an enum value,  not a #define,  so we
+check the version (7.32.0 added it) rather than its existence.  */
+
+#if LIBCURL_VERSION_NUM >= 0x072000
+static int segment_progress_callback( void *clientp, curl_off_t dltotal,
+                  curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+   (void)clientp;
+   (void)dltotal;
+   (void)dlnow;
+   (void)ultotal;
+   (void)ulnow;
+   return( thread_cpu_seconds( ) > (double)MAX_SEGMENT_CPU);
+}
+#endif
+
+/* Data is written at its place within the file.  If the server sends
+more than the range asked for (e.g.,  it ignored the Range: header and
+is sending the whole file),  we abort rather than overwrite other
+segments.  For HTTP,  only a 206 (partial content) body is written;  the
+body of a 5xx or other error is discarded,  so that it doesn't end up
+in the file (and counted in 'done') before url_fetch_perform( ) retries.
+A 200 means the whole file is coming,  so we abort.  */
+
+static size_t segment_write( char *ptr, size_t size, size_t nmemb, void *context)
+{
+   segment_t *seg = (segment_t *)context;
+   size_t n_bytes = size * nmemb, n_written = 0;
+
+   if( seg->is_http)
+      {
+      long response_code = 0;
+
+      curl_easy_getinfo( seg->curl, CURLINFO_RESPONSE_CODE, &response_code);
+      if( response_code == 200)
+         return( 0);
+      if( response_code != 206)
+         return( n_bytes);
+      }
+   if( seg->start + seg->done + (long long)n_bytes > seg->end + 1)
+      return( 0);
+   while( n_written < n_bytes)
+      {
+      const ssize_t rval = pwrite( seg->fd, ptr + n_written, n_bytes - n_written,
+                                   (off_t)( seg->start + seg->done));
+
+      if( rval <= 0)
+         return( 0);
+      n_written += (size_t)rval;
+      pthread_mutex_lock( &progress_mutex);
+      seg->done += (long long)rval;
+      pthread_mutex_unlock( &progress_mutex);
+      }
+   return( n_bytes);
+}
+
+/* A retried segment picks up where the failed attempt left off,  since
+everything already received has been written to the right place.  */
+
+static void set_segment_range( void *args)
+{
+   segment_t *seg = (segment_t *)args;
+
+   snprintf( seg->range, sizeof( seg->range), "%lld-%lld",
+                        seg->start + seg->done, seg->end);
+   curl_easy_setopt( seg->curl, CURLOPT_RANGE, seg->range);
+}
+
+static void *fetch_a_segment( void *args)
+{
+   segment_t *seg = (segment_t *)args;
+   CURL *curl = url_fetch_new_handle( );
+   CURLcode res;
+   long response_code = 0;
+
+   seg->curl = curl;
+   seg->is_http = !strncmp( seg->url, "http", 4);
+   set_segment_range( seg);
+   url_fetch_set_url( curl, seg->url);
+   curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, segment_write);
+   curl_easy_setopt( curl, CURLOPT_WRITEDATA, seg);
+   if( seg->password)
+      curl_easy_setopt( curl, CURLOPT_USERPWD, seg->password);
+#if LIBCURL_VERSION_NUM >= 0x072000
+   curl_easy_setopt( curl, CURLOPT_NOPROGRESS, 0);
+   curl_easy_setopt( curl, CURLOPT_XFERINFOFUNCTION, segment_progress_callback);
+   curl_easy_setopt( curl, CURLOPT_XFERINFODATA, seg);
+#endif
+   res = url_fetch_perform( curl, set_segment_range, seg);
+   curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &response_code);
+   if( res)
+      {
+      printf( "libcurl error %d on bytes %s (%s)\n", res, seg->range,
+                           curl_easy_strerror( res));
+      seg->error_code = res;
+      }
+   else if( response_code && response_code != 206 && response_code != 350)
+      {           /* 206 = HTTP partial content;  350 = FTP REST accepted */
+      printf( "Server didn't honor range %s (response %ld)\n", seg->range,
+                           response_code);
+      seg->error_code = -2;
+      }
+   else if( seg->start + seg->done != seg->end + 1)
+      {
+      printf( "Short segment %s\n", seg->range);
+      seg->error_code = -3;
+      }
+   curl_easy_cleanup( curl);
+   seg->curl = NULL;
+   pthread_mutex_lock( &progress_mutex);
+   seg->is_done = true;
+   pthread_mutex_unlock( &progress_mutex);
+   return( NULL);
+}
+
+/* Gets the file size (-1 if it can't be determined) without downloading
+the file itself.   */
+
+static long long remote_file_size( const char *url, const char *password)
+{
+   CURL *curl = url_fetch_new_handle( );
+   curl_off_t len = -1;
+
+   url_fetch_set_url( curl, url);
+   curl_easy_setopt( curl, CURLOPT_NOBODY, 1L);
+   if( password)
+      curl_easy_setopt( curl, CURLOPT_USERPWD, password);
+   if( url_fetch_perform( curl, NULL, NULL) || curl_easy_getinfo( curl,
+                CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &len))
+      len = -1;
+   curl_easy_cleanup( curl);
+   return( (long long)len);
+}
+
+static int save_progress( const char *part_name, const segment_t *segs,
+                  const int n_segs, const long long total_size)
+{
+   char tname[310];
+   FILE *ofile;
+   int i;
+
+   snprintf( tname, sizeof( tname), "%s.tmp", part_name);
+   ofile = fopen( tname, "wb");
+   if( !ofile)
+      return( -1);
+   fprintf( ofile, "%lld %d\n", total_size, n_segs);
+   for( i = 0; i < n_segs; i++)
+      fprintf( ofile, "%lld %lld %lld\n", segs[i].start, segs[i].end,
+                                          segs[i].done);
+   if( fclose( ofile))
+      return( -1);
+   return( rename( tname, part_name));
+}
+
+/* Returns the number of segments from a previous run,  or zero if there
+wasn't one (or it was for a different-sized file).  */
+
+static int load_progress( const char *part_name, segment_t *segs,
+                  const long long total_size)
+{
+   FILE *ifile = fopen( part_name, "rb");
+   long long prev_size;
+   int n_segs = 0, i;
+
+   if( !ifile)
+      return( 0);
+   if( fscanf( ifile, "%lld %d", &prev_size, &n_segs) != 2
+               || prev_size != total_size || n_segs < 1 || n_segs > MAX_SEGMENTS)
+      n_segs = 0;
+   for( i = 0; i < n_segs; i++)
+      if( fscanf( ifile, "%lld %lld %lld", &segs[i].start, &segs[i].end,
+                           &segs[i].done) != 3 || segs[i].done < 0
+                  || segs[i].done > segs[i].end - segs[i].start + 1)
+         n_segs = 0;
+   fclose( ifile);
+   return( n_segs);
+}
+
+/* Standard (IEEE 802.3,  as used by zip,  gzip,  etc.) CRC-32.  */
+
+static unsigned long file_crc32( const int fd, const long long len)
+{
+   static unsigned long table[256];
+   unsigned char buff[65536];
+   unsigned long crc = 0xfffffffful;
+   long long pos = 0;
+   unsigned i, j;
+
+   for( i = 0; i < 256; i++)
+      {
+      unsigned long c = i;
+
+      for( j = 0; j < 8; j++)
+         c = (c & 1) ? 0xedb88320ul ^ (c >> 1) : c >> 1;
+      table[i] = c;
+      }
+   while( pos < len)
+      {
+      const ssize_t n_read = pread( fd, buff, sizeof( buff), (off_t)pos);
+
+      if( n_read <= 0)
+         break;
+      for( i = 0; i < (unsigned)n_read; i++)
+         crc = table[(crc ^ buff[i]) & 0xff] ^ (crc >> 8);
+      pos += n_read;
+      }
+   return( crc ^ 0xfffffffful);
+}
+
+static int segmented_fetch( const char *url, const char *filename,
+               int n_segs, const char *password, const char *crc_text)
+{
+   const long long total_size = remote_file_size( url, password);
+   segment_t segs[MAX_SEGMENTS], snapshot[MAX_SEGMENTS];
+   pthread_t threads[MAX_SEGMENTS];
+   bool started[MAX_SEGMENTS];
+   char part_name[300];
+   int i, fd, n_running, rval = 0;
+   struct stat st;
+
+   if( total_size <= 0)
+      {
+      printf( "Couldn't get the size of %s\n", url);
+      return( -1);
+      }
+   snprintf( part_name, sizeof( part_name), "%s.part", filename);
+   memset( segs, 0, sizeof( segs));
+   i = load_progress( part_name, segs, total_size);
+   if( i && !stat( filename, &st) && (long long)st.st_size == total_size)
+      {
+      n_segs = i;
+      printf( "Resuming download of %s\n", filename);
+      fd = open( filename, O_RDWR | O_CREAT, 0644);
+      }
+   else
+      {
+      const long long seg_size = (total_size + n_segs - 1) / n_segs;
+
+      for( i = 0; i < n_segs; i++)
+         {
+         segs[i].start = (long long)i * seg_size;
+         segs[i].end = segs[i].start + seg_size - 1;
+         if( segs[i].end >= total_size)
+            segs[i].end = total_size - 1;
+         segs[i].done = 0;
+         }
+      while( segs[n_segs - 1].start >= total_size)
+         n_segs--;          /* tiny file;  fewer segments than asked for */
+      fd = open( filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if( fd >= 0)
+         {
+#ifdef __linux__
+         if( posix_fallocate( fd, 0, (off_t)total_size))
+#endif
+            if( ftruncate( fd, (off_t)total_size))
+               {
+               close( fd);
+               fd = -1;
+               }
+         }
+      }
+   if( fd < 0)
+      {
+      printf( "Couldn't create %s\n", filename);
+      perror( NULL);
+      return( -1);
+      }
+   avoid_runaway_process( MAX_SEGMENT_CPU * (n_segs + 1));
+   for( i = 0; i < n_segs; i++)
+      {
+      segs[i].url = url;
+      segs[i].password = password;
+      segs[i].fd = fd;
+      segs[i].is_done = (segs[i].done == segs[i].end - segs[i].start + 1);
+      started[i] = false;
+      if( !segs[i].is_done)
+         {
+         if( pthread_create( threads + i, NULL, fetch_a_segment, segs + i))
+            {
+            segs[i].error_code = -1;
+            segs[i].is_done = true;
+            }
+         else
+            started[i] = true;
+         }
+      }
+   do
+      {
+      long long n_done = 0;
+
+      sleep( 1);
+      pthread_mutex_lock( &progress_mutex);
+      memcpy( snapshot, segs, n_segs * sizeof( segment_t));
+      pthread_mutex_unlock( &progress_mutex);
+      for( i = n_running = 0; i < n_segs; i++)
+         {
+         n_done += snapshot[i].done;
+         if( !snapshot[i].is_done)
+            n_running++;
+         }
+      save_progress( part_name, snapshot, n_segs, total_size);
+      printf( "%lld/%lld bytes;  %d segments active\n", n_done, total_size,
+                        n_running);
+      }
+      while( n_running);
+   for( i = 0; i < n_segs; i++)
+      {
+      if( segs[i].error_code)
+         rval = -2;
+      else if( segs[i].done != segs[i].end - segs[i].start + 1)
+         rval = -3;
+      if( started[i])
+         pthread_join( threads[i], NULL);
+      }
+   if( !rval && (fstat( fd, &st) || (long long)st.st_size != total_size))
+      {
+      printf( "File is the wrong length\n");
+      rval = -4;
+      }
+   if( !rval && crc_text)
+      {
+      const unsigned long crc = file_crc32( fd, total_size);
+
+      if( crc != strtoul( crc_text, NULL, 16))
+         {
+         printf( "CRC-32 mismatch : got %08lx,  expected %s\n", crc, crc_text);
+         rval = -5;
+         }
+      else
+         printf( "CRC-32 %08lx verified\n", crc);
+      }
+   if( close( fd))
+      rval = -6;
+   if( !rval)
+      unlink( part_name);
+   else if( rval > -4)
+      printf( "Download incomplete;  run again to fetch the rest\n");
+   else        /* a verification failure;  starting over makes more sense */
+      unlink( part_name);
+   return( rval);
+}
+
 int main( const int argc, const char **argv)
 {
    file_fetch_t f;
-   int i;
+   int i, n_segments = 0;
+   const char *crc_text = NULL;
 
-   avoid_runaway_process( 60);
    assert( argc >= 3);
    f.url = argv[1];
    f.filename = argv[2];
@@ -184,12 +604,38 @@ int main( const int argc, const char **argv)
             case 'p':
                f.password = arg;
                break;
+            case 'n':
+               n_segments = atoi( arg);
+               if( n_segments > MAX_SEGMENTS)
+                  n_segments = MAX_SEGMENTS;
+               break;
+            case 'c':
+               crc_text = arg;
+               break;
             }
          }
+   if( n_segments > 0)
+      {
+      int rval;
+
+      rval = segmented_fetch( f.url, f.filename, n_segments, f.password,
+                              crc_text);
+      url_fetch_cleanup( );
+      printf( "Err code %d\n", rval);
+      return( rval ? 1 : 0);
+      }
+   avoid_runaway_process( 60);
    threaded_fetch_a_file( &f);
-   while( !f.is_done)
+   for( ;;)
       {
-      printf( "Still here...%ld/%ld\n", (long)f.bytes_xferred, (long)f.total_bytes);
+      file_fetch_t curr;
+
+      pthread_mutex_lock( &progress_mutex);
+      curr = f;
+      pthread_mutex_unlock( &progress_mutex);
+      if( curr.is_done)
+         break;
+      printf( "Still here...%ld/%ld\n", (long)curr.bytes_xferred, (long)curr.total_bytes);
       sleep( 1);
       }
    printf( "Err code %d\n", f.error_code);
@@ -0,0 +1,489 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include "neo_hist.h"
+
+/* 'neocp.old' just grows as a text file,  and finding out when a given
+tracklet first appeared (and what happened to it afterward) means
+grepping through gigabytes of it.  'neocp2' therefore also logs each
+line it sees appear or disappear here,  as fixed-length binary records.
+
+   Records go into 'segments' named (base).000,  (base).001,  etc.,  each
+holding at most NEO_HIST_SEGMENT_RECS records,  so no single file gets
+unmanageably large.  Consecutive records for the same designation/trksub
+are described by one entry in (base).idx,  giving the segment,  the
+first record within it,  and the number of records.  Both files are
+only ever appended to.
+
+   The index gains an entry per object on every run of neocp2,  so it
+grows without limit,  and reading it through for every query would get
+steadily slower.  So (base).six holds the same entries sorted by
+designation (each entry twice,  keyed by the full 12 bytes and by
+columns 6-12,  since either can be queried),  and a query binary-searches
+it,  then seeks directly to the matching records.  The sorted file
+records how many index entries it covers;  if that's not the current
+count (because neocp2 added entries),  it's rebuilt by neo_hist_close( )
+or,  failing that,  by the next query.
+
+   Compiled with -DTEST_MAIN,  this becomes a query tool :
+
+./neo_hist (desig or trksub) [-b base_name]
+
+   which lists the complete logged history of that object.  */
+
+#define NEO_HIST_SEGMENT_RECS 1000000u
+
+struct neo_hist
+{
+   FILE *idx_file, *seg_file;
+   char *base_name;
+   neo_hist_idx_t curr;       /* index entry being accumulated */
+   uint32_t segment, n_in_segment;
+   uint32_t n_added;          /* records added since opening */
+   int err;
+};
+
+static FILE *open_segment( const char *base_name, const uint32_t segment,
+                            const char *permits)
+{
+   char *filename = (char *)malloc( strlen( base_name) + 20);
+   FILE *rval;
+
+   snprintf( filename, strlen( base_name) + 20, "%s.%03u", base_name,
+                           (unsigned)segment);
+   rval = fopen( filename, permits);
+   free( filename);
+   return( rval);
+}
+
+static FILE *open_base_file( const char *base_name, const char *ext,
+                            const char *permits)
+{
+   char *filename = (char *)malloc( strlen( base_name) + strlen( ext) + 1);
+   FILE *rval;
+
+   strcpy( filename, base_name);
+   strcat( filename, ext);
+   rval = fopen( filename, permits);
+   free( filename);
+   return( rval);
+}
+
+static FILE *open_index( const char *base_name, const char *permits)
+{
+   return( open_base_file( base_name, ".idx", permits));
+}
+
+/* On opening,  we look at the last index entry to figure out which
+segment is current,  and the segment's size to figure out how many
+records it already holds.  If a previous run was interrupted partway
+through writing an index entry or record,  the partial entry/record is
+truncated away,  so that new ones are appended in alignment.    */
+
+static long truncate_partial( FILE *fp, const size_t item_size)
+{
+   long file_size;
+
+   fseek( fp, 0L, SEEK_END);
+   file_size = ftell( fp);
+   if( file_size % (long)item_size)
+      {
+      file_size -= file_size % (long)item_size;
+      fflush( fp);
+      if( ftruncate( fileno( fp), (off_t)file_size))
+         return( -1);
+      fseek( fp, 0L, SEEK_END);
+      }
+   return( file_size);
+}
+
+neo_hist_t *neo_hist_open( const char *base_name)
+{
+   neo_hist_t *rval = (neo_hist_t *)calloc( 1, sizeof( neo_hist_t));
+   long file_size;
+
+   assert( rval);
+   rval->idx_file = open_index( base_name, "a+b");
+   if( !rval->idx_file)
+      {
+      free( rval);
+      return( NULL);
+      }
+   rval->base_name = (char *)malloc( strlen( base_name) + 1);
+   strcpy( rval->base_name, base_name);
+   file_size = truncate_partial( rval->idx_file, sizeof( neo_hist_idx_t));
+   if( file_size >= (long)sizeof( neo_hist_idx_t))
+      {
+      neo_hist_idx_t last;
+
+      fseek( rval->idx_file, file_size - (long)sizeof( neo_hist_idx_t), SEEK_SET);
+      if( fread( &last, sizeof( last), 1, rval->idx_file) == 1)
+         rval->segment = last.segment;
+      fseek( rval->idx_file, 0L, SEEK_END);     /* required between read & write */
+      }
+   rval->seg_file = (file_size < 0 ? NULL
+                       : open_segment( base_name, rval->segment, "ab"));
+   if( rval->seg_file)
+      file_size = truncate_partial( rval->seg_file, sizeof( neo_hist_rec_t));
+   if( !rval->seg_file || file_size < 0)
+      {
+      if( rval->seg_file)
+         fclose( rval->seg_file);
+      fclose( rval->idx_file);
+      free( rval->base_name);
+      free( rval);
+      return( NULL);
+      }
+   rval->n_in_segment = (uint32_t)( file_size / (long)sizeof( neo_hist_rec_t));
+   return( rval);
+}
+
+static int flush_index_entry( neo_hist_t *hist)
+{
+   if( hist->curr.n_recs)
+      {
+      if( fwrite( &hist->curr, sizeof( neo_hist_idx_t), 1, hist->idx_file) != 1)
+         hist->err = NEO_HIST_ERR_WRITE;
+      hist->curr.n_recs = 0;
+      }
+   return( hist->err);
+}
+
+int neo_hist_add( neo_hist_t *hist, const char *line, const char event,
+                              const int64_t t)
+{
+   neo_hist_rec_t rec;
+
+   if( hist->curr.n_recs && memcmp( hist->curr.desig, line, 12))
+      flush_index_entry( hist);
+   if( hist->n_in_segment >= NEO_HIST_SEGMENT_RECS)
+      {
+      flush_index_entry( hist);
+      fclose( hist->seg_file);
+      hist->segment++;
+      hist->n_in_segment = 0;
+      hist->seg_file = open_segment( hist->base_name, hist->segment, "ab");
+      if( !hist->seg_file)
+         return( hist->err = NEO_HIST_ERR_OPEN);
+      }
+   if( !hist->curr.n_recs)
+      {
+      memcpy( hist->curr.desig, line, 12);
+      hist->curr.segment = hist->segment;
+      hist->curr.first_rec = hist->n_in_segment;
+      }
+   memset( &rec, 0, sizeof( rec));
+   rec.t = t;
+   memcpy( rec.line, line, 80);
+   rec.event = event;
+   if( fwrite( &rec, sizeof( rec), 1, hist->seg_file) != 1)
+      return( hist->err = NEO_HIST_ERR_WRITE);
+   hist->curr.n_recs++;
+   hist->n_in_segment++;
+   hist->n_added++;
+   return( 0);
+}
+
+/* Designations/trksubs can be given either as the full 12 bytes of
+columns 1-12,  or just as the part in columns 6-12,  with spaces
+trimmed in either case.  */
+
+static void trim_copy( char *obuff, const char *ibuff, size_t len)
+{
+   while( len && *ibuff == ' ')
+      {
+      ibuff++;
+      len--;
+      }
+   while( len && ibuff[len - 1] == ' ')
+      len--;
+   memcpy( obuff, ibuff, len);
+   obuff[len] = '\0';
+}
+
+#define SORTED_MAGIC    "NEOHSIX1"
+
+typedef struct
+{
+   char magic[8];
+   uint32_t n_idx;            /* number of (base).idx entries covered */
+   uint32_t n_sorted;         /* number of sorted_idx_t entries following */
+} sorted_hdr_t;
+
+typedef struct
+{
+   char key[12];              /* trimmed desig/trksub,  NUL-padded */
+   uint32_t seq;              /* position of the entry in (base).idx */
+   uint32_t segment, first_rec, n_recs;
+} sorted_idx_t;
+
+static void make_key( char *key, const char *desig, const size_t len)
+{
+   char buff[13];
+
+   trim_copy( buff, desig, len);
+   memset( key, 0, 12);
+   memcpy( key, buff, strlen( buff));
+}
+
+   /* Sorted by key,  then by position in the index (i.e.,  the order   */
+   /* in which they were logged) :                                      */
+
+static int sorted_idx_compare( const void *a, const void *b)
+{
+   const sorted_idx_t *aptr = (const sorted_idx_t *)a;
+   const sorted_idx_t *bptr = (const sorted_idx_t *)b;
+   const int rval = memcmp( aptr->key, bptr->key, 12);
+
+   if( rval)
+      return( rval);
+   return( aptr->seq < bptr->seq ? -1 : (aptr->seq > bptr->seq ? 1 : 0));
+}
+
+static uint32_t index_count( FILE *idx_file)
+{
+   fseek( idx_file, 0L, SEEK_END);
+   return( (uint32_t)( ftell( idx_file) / (long)sizeof( neo_hist_idx_t)));
+}
+
+/* Reads all of (base).idx,  returning its entries sorted by key,  and
+writes them to (base).six (through a temporary file,  so a query never
+sees a partial one) if it can.  Failure to write isn't an error;  the
+caller can search the returned array.   */
+
+static sorted_idx_t *build_sorted_index( const char *base_name,
+                           FILE *idx_file, uint32_t *n_sorted)
+{
+   const uint32_t n_idx = index_count( idx_file);
+   sorted_idx_t *rval = (sorted_idx_t *)malloc(
+                              (2 * (size_t)n_idx + 1) * sizeof( sorted_idx_t));
+   char *temp_name = (char *)malloc( strlen( base_name) + 9);
+   neo_hist_idx_t entry;
+   sorted_hdr_t hdr;
+   uint32_t i, n = 0;
+   FILE *ofile;
+
+   assert( rval);
+   assert( temp_name);
+   fseek( idx_file, 0L, SEEK_SET);
+   for( i = 0; i < n_idx && fread( &entry, sizeof( entry), 1, idx_file) == 1; i++)
+      {
+      sorted_idx_t *tptr = rval + n++;
+
+      make_key( tptr->key, entry.desig, 12);
+      tptr->seq = i;
+      tptr->segment = entry.segment;
+      tptr->first_rec = entry.first_rec;
+      tptr->n_recs = entry.n_recs;
+      rval[n] = *tptr;
+      make_key( rval[n].key, entry.desig + 5, 7);
+      if( memcmp( rval[n].key, tptr->key, 12))
+         n++;
+      }
+   qsort( rval, n, sizeof( sorted_idx_t), sorted_idx_compare);
+   *n_sorted = n;
+   memcpy( hdr.magic, SORTED_MAGIC, 8);
+   hdr.n_idx = i;
+   hdr.n_sorted = n;
+   strcpy( temp_name, base_name);
+   strcat( temp_name, ".six.tmp");
+   ofile = fopen( temp_name, "wb");
+   if( ofile)
+      {
+      int err = (fwrite( &hdr, sizeof( hdr), 1, ofile) != 1
+                  || fwrite( rval, sizeof( sorted_idx_t), n, ofile) != n);
+      char *sorted_name = temp_name;
+
+      if( fclose( ofile))
+         err = 1;
+      if( !err)
+         {
+         sorted_name = (char *)malloc( strlen( base_name) + 5);
+         strcpy( sorted_name, base_name);
+         strcat( sorted_name, ".six");
+         err = rename( temp_name, sorted_name);
+         free( sorted_name);
+         }
+      if( err)
+         remove( temp_name);
+      }
+   free( temp_name);
+   return( rval);
+}
+
+int neo_hist_close( neo_hist_t *hist)
+{
+   int rval;
+
+   flush_index_entry( hist);
+   if( fclose( hist->seg_file))
+      hist->err = NEO_HIST_ERR_WRITE;
+   if( fclose( hist->idx_file))
+      hist->err = NEO_HIST_ERR_WRITE;
+   if( !hist->err && hist->n_added)      /* bring (base).six up to date */
+      {
+      FILE *idx_file = open_index( hist->base_name, "rb");
+
+      if( idx_file)
+         {
+         uint32_t n_sorted;
+
+         free( build_sorted_index( hist->base_name, idx_file, &n_sorted));
+         fclose( idx_file);
+         }
+      }
+   rval = hist->err;
+   free( hist->base_name);
+   free( hist);
+   return( rval);
+}
+
+/* Gets the i-th sorted entry,  either from the array (if the sorted
+file had to be rebuilt) or from the sorted file.  */
+
+static int get_sorted_entry( FILE *sorted_file, const sorted_idx_t *sorted,
+                              const uint32_t i, sorted_idx_t *entry)
+{
+   if( sorted)
+      *entry = sorted[i];
+   else if( fseek( sorted_file, (long)sizeof( sorted_hdr_t)
+                        + (long)i * (long)sizeof( sorted_idx_t), SEEK_SET)
+               || fread( entry, sizeof( sorted_idx_t), 1, sorted_file) != 1)
+      return( NEO_HIST_ERR_READ);
+   return( 0);
+}
+
+int neo_hist_query( const char *base_name, const char *desig,
+          void (*callback)( const neo_hist_rec_t *rec, void *context),
+          void *context)
+{
+   FILE *idx_file = open_index( base_name, "rb"), *seg_file = NULL;
+   FILE *sorted_file;
+   sorted_idx_t *sorted = NULL, entry;
+   sorted_hdr_t hdr;
+   char key[12];
+   uint32_t lo = 0, hi, n_sorted = 0, curr_segment = (uint32_t)-1;
+   int rval = 0;
+
+   if( !idx_file)
+      return( NEO_HIST_ERR_OPEN);
+   make_key( key, desig, (strlen( desig) > 12 ? 12 : strlen( desig)));
+   sorted_file = open_base_file( base_name, ".six", "rb");
+   if( sorted_file && fread( &hdr, sizeof( hdr), 1, sorted_file) == 1
+               && !memcmp( hdr.magic, SORTED_MAGIC, 8)
+               && hdr.n_idx == index_count( idx_file))
+      n_sorted = hdr.n_sorted;
+   else
+      sorted = build_sorted_index( base_name, idx_file, &n_sorted);
+   fclose( idx_file);
+   hi = n_sorted;
+   while( rval >= 0 && lo < hi)      /* find first entry with key >= ours */
+      {
+      const uint32_t mid = lo + (hi - lo) / 2;
+
+      rval = get_sorted_entry( sorted_file, sorted, mid, &entry);
+      if( !rval && memcmp( entry.key, key, 12) < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+      }
+   for( ; rval >= 0 && lo < n_sorted; lo++)
+      {
+      uint32_t j;
+      neo_hist_rec_t rec;
+
+      if( get_sorted_entry( sorted_file, sorted, lo, &entry))
+         rval = NEO_HIST_ERR_READ;
+      else if( memcmp( entry.key, key, 12))
+         break;
+      else if( curr_segment != entry.segment)
+         {
+         if( seg_file)
+            fclose( seg_file);
+         curr_segment = entry.segment;
+         seg_file = open_segment( base_name, curr_segment, "rb");
+         if( !seg_file)
+            rval = NEO_HIST_ERR_OPEN;
+         }
+      if( rval >= 0 && fseek( seg_file, (long)entry.first_rec
+                                * (long)sizeof( neo_hist_rec_t), SEEK_SET))
+         rval = NEO_HIST_ERR_READ;
+      for( j = 0; rval >= 0 && j < entry.n_recs; j++)
+         if( fread( &rec, sizeof( rec), 1, seg_file) != 1)
+            rval = NEO_HIST_ERR_READ;
+         else
+            {
+            callback( &rec, context);
+            rval++;
+            }
+      }
+   if( seg_file)
+      fclose( seg_file);
+   if( sorted_file)
+      fclose( sorted_file);
+   free( sorted);
+   return( rval);
+}
+
+#ifdef TEST_MAIN
+
+#define INTENTIONALLY_UNUSED_PARAMETER( param) (void)(param)
+
+static void show_record( const neo_hist_rec_t *rec, void *context)
+{
+   const time_t t0 = (time_t)rec->t;
+   char time_buff[30];
+
+   INTENTIONALLY_UNUSED_PARAMETER( context);
+   strftime( time_buff, sizeof( time_buff), "%Y-%m-%dT%H:%M:%S",
+                                 gmtime( &t0));
+   printf( "%s %s %.80s\n", time_buff,
+            (rec->event == NEO_HIST_ADDED ? "added  " : "removed"), rec->line);
+}
+
+int main( const int argc, const char **argv)
+{
+   const char *base_name = "neohist";
+   int i, n_found;
+
+   if( argc < 2)
+      {
+      fprintf( stderr, "Usage:  neo_hist (desig or trksub) [-b base_name]\n");
+      return( -1);
+      }
+   for( i = 2; i < argc; i++)
+      if( argv[i][0] == '-' && argv[i][1] == 'b')
+         {
+         if( argv[i][2])
+            base_name = argv[i] + 2;
+         else if( i < argc - 1)
+            base_name = argv[++i];
+         }
+   n_found = neo_hist_query( base_name, argv[1], show_record, NULL);
+   if( n_found < 0)
+      fprintf( stderr, "Couldn't read history '%s' (%d)\n", base_name, n_found);
+   else
+      printf( "%d records found\n", n_found);
+   return( n_found < 0 ? -1 : 0);
+}
+#endif
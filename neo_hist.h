@@ -0,0 +1,59 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdint.h>
+
+/* Append-only history of NEOCP observations.  See 'neo_hist.c' for
+details.  Records are fixed-length,  so they can be fetched directly
+once the (small) index says where they are.    */
+
+#define NEO_HIST_ADDED        'A'
+#define NEO_HIST_REMOVED      'R'
+
+typedef struct
+{
+   int64_t t;              /* Unix time of the event */
+   char line[80];          /* 80-column obs,  including first-seen tag */
+   char event;             /* NEO_HIST_ADDED or NEO_HIST_REMOVED */
+   char reserved[7];
+} neo_hist_rec_t;
+
+typedef struct
+{
+   char desig[12];         /* first 12 bytes of the obs:  desig/trksub */
+   uint32_t segment, first_rec, n_recs;
+} neo_hist_idx_t;
+
+typedef struct neo_hist neo_hist_t;
+
+neo_hist_t *neo_hist_open( const char *base_name);
+int neo_hist_add( neo_hist_t *hist, const char *line, const char event,
+                              const int64_t t);
+int neo_hist_close( neo_hist_t *hist);
+
+   /* Calls 'callback' for each record whose designation/trksub
+      matches 'desig' (leading/trailing spaces ignored),  in the order
+      in which they were logged.  Returns the number of records found,
+      or a negative value if the history can't be read.  */
+
+int neo_hist_query( const char *base_name, const char *desig,
+          void (*callback)( const neo_hist_rec_t *rec, void *context),
+          void *context);
+
+#define NEO_HIST_ERR_OPEN        -1
+#define NEO_HIST_ERR_WRITE       -2
+#define NEO_HIST_ERR_READ        -3
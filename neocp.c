@@ -27,6 +27,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <time.h>
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include "url_fetch.h"
 #if defined( __linux__) || defined( __unix__) || defined( __APPLE__)
    #include <sys/time.h>         /* these allow resource limiting */
    #include <sys/resource.h>     /* see 'avoid_runaway_process'   */
@@ -191,47 +192,49 @@ size_t curl_buff_write( char *ptr, size_t size, size_t nmemb, void *context_ptr)
    return( bytes_to_write);
 }
 
+static void reset_curl_buff( void *context)
+{
+   ((curl_buff_t *)context)->loc = 0;
+}
+
+/* All fetches go through one persistent handle (see 'url_fetch.c'),  so
+the connection to MPC is reused for the list and for each object's
+astrometry,  and transient failures are retried.   */
+
 static unsigned fetch_a_file( const char *url, char *obuff,
                               const size_t max_len)
 {
-   CURL *curl = curl_easy_init();
-   unsigned rval = 0;
-
-   assert( curl);
-   if( curl)
-      {
-      CURLcode res;
-      curl_buff_t context;
-      char errbuf[CURL_ERROR_SIZE];
-
-      context.loc = 0;
-      context.obuff = obuff;
-      context.max_len = max_len;
-      curl_easy_setopt( curl, CURLOPT_URL, url);
-      curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, curl_buff_write);
-      curl_easy_setopt( curl, CURLOPT_WRITEDATA, &context);
-      curl_easy_setopt( curl, CURLOPT_ERRORBUFFER, errbuf);
-      *errbuf = '\0';
+   CURL *curl = url_fetch_default_handle( );
+   CURLcode res;
+   curl_buff_t context;
+   char errbuf[CURL_ERROR_SIZE];
+
+   context.loc = 0;
+   context.obuff = obuff;
+   context.max_len = max_len;
+   url_fetch_set_url( curl, url);
+   curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, curl_buff_write);
+   curl_easy_setopt( curl, CURLOPT_WRITEDATA, &context);
+   curl_easy_setopt( curl, CURLOPT_ERRORBUFFER, errbuf);
+   *errbuf = '\0';
 #ifdef NOT_CURRENTLY_USED
-      if( flags & 2)
-         {
-         curl_easy_setopt( curl, CURLOPT_NOBODY, 1);
-         curl_easy_setopt( curl, CURLOPT_HEADER, 1);
-         }
+   if( flags & 2)
+      {
+      curl_easy_setopt( curl, CURLOPT_NOBODY, 1);
+      curl_easy_setopt( curl, CURLOPT_HEADER, 1);
+      }
 #endif
-      res = curl_easy_perform( curl);
-      if( res)
-         {
-         fprintf( stderr, "libcurl error %d occurred\n", res);
-         fprintf( stderr, "%s\n",
-                       (*errbuf ? errbuf : curl_easy_strerror( res)));
-         printf( "url %s\n", url);
-         exit( -1);
-         }
-      curl_easy_cleanup( curl);
-      rval = (unsigned)context.loc;
+   res = url_fetch_perform( curl, reset_curl_buff, &context);
+   curl_easy_setopt( curl, CURLOPT_ERRORBUFFER, NULL);
+   if( res)
+      {
+      fprintf( stderr, "libcurl error %d occurred\n", res);
+      fprintf( stderr, "%s\n",
+                    (*errbuf ? errbuf : curl_easy_strerror( res)));
+      printf( "url %s\n", url);
+      exit( -1);
       }
-   return( rval);
+   return( (unsigned)context.loc);
 }
 
 /* Lines in the MPC's plaintext summary of which objects are currently on
@@ -676,6 +679,7 @@ int main( const int argc, const char **argv)
     unlink( "neocp.txt");
     rename( "neocp.tmp", "neocp.txt");
     free( tbuff);
+    url_fetch_cleanup( );
     return 0;
 }
 
@@ -27,6 +27,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <time.h>
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include "neo_hist.h"
+#include "url_fetch.h"
 #if defined( __linux__) || defined( __unix__) || defined( __APPLE__)
    #include <sys/time.h>         /* these allow resource limiting */
    #include <sys/resource.h>     /* see 'avoid_runaway_process'   */
@@ -55,7 +57,13 @@ file that we didn't match get added to 'neocp.old'.
 
    We also write out an 'neocp.new' that contains the data
 from the new 'neocp.txt' for any object that changed,  i.e.,
-has the current time stamp on it.            */
+has the current time stamp on it.
+
+   Lines that are new,  and lines that get moved to 'neocp.old',  are
+also logged to the binary history 'neohist.*' (see 'neo_hist.c'),  so
+that one can quickly find out when a tracklet first appeared and what
+happened to it after that.  -h (base name) changes that name;  -h- turns
+the history log off.         */
 
    /* Limit the program to a certain amount of CPU time.  In this
       case,  if it's taking more than 200 seconds,  something
@@ -123,65 +131,151 @@ static void time_tag( char *tag)
    tag[4] = int_to_mutant_hex_char( tm.tm_min);
 }
 
+/* The bulk NEOCP file is read into a growable 'arena',  rather than
+into a fixed buffer that's hoped to be big enough.  As data arrives
+(whether from libcurl or from a local file),  each completed line is
+checked to be exactly 81 bytes and its offset recorded,  so that we
+don't need separate passes afterward to count and find lines.  Offsets
+are used rather than pointers,  since the arena may be realloc()ed;
+ilines[] is built from them once everything is in.  The data is also
+written to 'neocpnew.txt' as it arrives,  when 'ofile' is non-NULL.  */
+
 typedef struct
 {
-   char *obuff;
-   size_t loc, max_len;
-} curl_buff_t;
+   char *buff;
+   size_t loc, alloced, scanned;
+   size_t *offsets, n_lines, offsets_alloced;
+   size_t bad_line;           /* 1-based line number of first bad line */
+   CURL *curl;
+   FILE *ofile;
+} neocp_arena_t;
+
+#define NEOCP_LINE_LEN 81
 
-size_t curl_buff_write( char *ptr, size_t size, size_t nmemb, void *context_ptr)
+static void arena_reserve( neocp_arena_t *arena, const size_t n_bytes)
 {
-   curl_buff_t *context = (curl_buff_t *)context_ptr;
-   size_t bytes_to_write = size * nmemb;
-
-   if( bytes_to_write > context->max_len - context->loc)
-      bytes_to_write = context->max_len - context->loc;
-   memcpy( context->obuff + context->loc, ptr, bytes_to_write);
-   context->loc += bytes_to_write;
-   return( bytes_to_write);
+   if( arena->loc + n_bytes > arena->alloced)
+      {
+      size_t new_size = (arena->alloced ? arena->alloced * 2 : 1000000);
+
+      while( new_size < arena->loc + n_bytes)
+         new_size *= 2;
+      arena->buff = (char *)realloc( arena->buff, new_size);
+      assert( arena->buff);
+      arena->alloced = new_size;
+      }
 }
 
-static unsigned fetch_a_file( const char *url, char *obuff,
-                              const size_t max_len)
+static void arena_add( neocp_arena_t *arena, const char *data,
+                                       const size_t n_bytes)
 {
-   CURL *curl = curl_easy_init();
-   unsigned rval = 0;
+   const char *tptr;
 
-   assert( curl);
-   if( curl)
+   arena_reserve( arena, n_bytes);
+   memcpy( arena->buff + arena->loc, data, n_bytes);
+   arena->loc += n_bytes;
+   while( (tptr = (const char *)memchr( arena->buff + arena->scanned, '\n',
+                        arena->loc - arena->scanned)) != NULL)
       {
-      CURLcode res;
-      curl_buff_t context;
-      char errbuf[CURL_ERROR_SIZE];
-
-      context.loc = 0;
-      context.obuff = obuff;
-      context.max_len = max_len;
-      curl_easy_setopt( curl, CURLOPT_URL, url);
-      curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, curl_buff_write);
-      curl_easy_setopt( curl, CURLOPT_WRITEDATA, &context);
-      curl_easy_setopt( curl, CURLOPT_ERRORBUFFER, errbuf);
-      *errbuf = '\0';
-#ifdef NOT_CURRENTLY_USED
-      if( flags & 2)
+      const size_t line_start = (arena->n_lines ?
+             arena->offsets[arena->n_lines - 1] + NEOCP_LINE_LEN : 0);
+      const size_t line_end = (size_t)( tptr - arena->buff) + 1;
+
+      if( line_end - line_start != NEOCP_LINE_LEN && !arena->bad_line)
+         arena->bad_line = arena->n_lines + 1;
+      if( arena->n_lines == arena->offsets_alloced)
          {
-         curl_easy_setopt( curl, CURLOPT_NOBODY, 1);
-         curl_easy_setopt( curl, CURLOPT_HEADER, 1);
+         arena->offsets_alloced = (arena->offsets_alloced ?
+                                   arena->offsets_alloced * 2 : 16384);
+         arena->offsets = (size_t *)realloc( arena->offsets,
+                              arena->offsets_alloced * sizeof( size_t));
+         assert( arena->offsets);
          }
+      arena->offsets[arena->n_lines++] = line_start;
+      arena->scanned = line_end;
+      if( arena->bad_line)    /* can't trust line boundaries after this */
+         arena->scanned = arena->loc;
+      }
+}
+
+size_t curl_arena_write( char *ptr, size_t size, size_t nmemb, void *context_ptr)
+{
+   neocp_arena_t *arena = (neocp_arena_t *)context_ptr;
+   const size_t n_bytes = size * nmemb;
+
+   if( !arena->loc)     /* first data:  presize arena if we know the size */
+      {
+      curl_off_t content_length;
+
+      if( !curl_easy_getinfo( arena->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                          &content_length) && content_length > 0)
+         arena_reserve( arena, (size_t)content_length);
+      }
+   arena_add( arena, ptr, n_bytes);
+   if( arena->ofile)
+      fwrite( ptr, n_bytes, 1, arena->ofile);
+   return( n_bytes);
+}
+
+/* Before a retry,  we discard whatever arrived from the failed attempt,
+both in the arena and in 'neocpnew.txt'.   */
+
+static void reset_arena( void *context)
+{
+   neocp_arena_t *arena = (neocp_arena_t *)context;
+
+   arena->loc = arena->scanned = arena->n_lines = arena->bad_line = 0;
+   if( arena->ofile)
+      {
+      fflush( arena->ofile);
+      rewind( arena->ofile);
+      if( ftruncate( fileno( arena->ofile), 0))
+         fprintf( stderr, "Couldn't truncate partial download\n");
+      }
+}
+
+/* Returns zero on success,  or a libcurl error code.  Transient failures
+are retried first (see 'url_fetch.c').  */
+
+static int fetch_a_file( const char *url, neocp_arena_t *arena)
+{
+   CURL *curl = url_fetch_default_handle( );
+   CURLcode res;
+   char errbuf[CURL_ERROR_SIZE];
+
+   arena->curl = curl;
+   url_fetch_set_url( curl, url);
+   curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, curl_arena_write);
+   curl_easy_setopt( curl, CURLOPT_WRITEDATA, arena);
+   curl_easy_setopt( curl, CURLOPT_ERRORBUFFER, errbuf);
+   *errbuf = '\0';
+#ifdef NOT_CURRENTLY_USED
+   if( flags & 2)
+      {
+      curl_easy_setopt( curl, CURLOPT_NOBODY, 1);
+      curl_easy_setopt( curl, CURLOPT_HEADER, 1);
+      }
 #endif
-      res = curl_easy_perform( curl);
-      if( res)
-         {
-         fprintf( stderr, "libcurl error %d occurred\n", res);
-         fprintf( stderr, "%s\n",
-                       (*errbuf ? errbuf : curl_easy_strerror( res)));
-         printf( "url %s\n", url);
-         exit( -1);
-         }
-      curl_easy_cleanup( curl);
-      rval = (unsigned)context.loc;
+   res = url_fetch_perform( curl, reset_arena, arena);
+   if( res)
+      {
+      fprintf( stderr, "libcurl error %d occurred\n", res);
+      fprintf( stderr, "%s\n",
+                    (*errbuf ? errbuf : curl_easy_strerror( res)));
+      printf( "url %s\n", url);
       }
-   return( rval);
+   curl_easy_setopt( curl, CURLOPT_ERRORBUFFER, NULL);
+   arena->curl = NULL;
+   return( (int)res);
+}
+
+static void read_a_file( FILE *ifile, neocp_arena_t *arena)
+{
+   char buff[65536];
+   size_t n_read;
+
+   while( (n_read = fread( buff, 1, sizeof( buff), ifile)) > 0)
+      arena_add( arena, buff, n_read);
 }
 
 static bool is_valid_astrometry_line( const char *buff)
@@ -207,15 +301,17 @@ static bool is_valid_astrometry_line( const char *buff)
    return( is_mpc_line);
 }
 
-#define MAX_ILEN 81000000
-
 int main( const int argc, const char **argv)
 {
-   unsigned bytes_read, i, j, n_new_lines = 0, n_lines = 0;
+   unsigned i, j, n_new_lines = 0;
    int n_to_old = 0;
    FILE *ofile, *ifile;
-   char *tbuff, buff[100], tag[6], old_neocp[12];
+   char buff[100], tag[6], old_neocp[12];
+   neocp_arena_t arena;
    char **ilines;
+   const char *hist_base_name = "neohist";
+   neo_hist_t *hist = NULL;
+   const time_t t_now = time( NULL);
    const char *bulk_neocp_url =
            "https://www.minorplanetcenter.net//cgi-bin/bulk_neocp.cgi?what=obs";
 
@@ -229,39 +325,63 @@ int main( const int argc, const char **argv)
                bulk_neocp_url = NULL;
                printf( "Working offline\n");
                break;
+            case 'h':
+               if( argv[i][2] == '-')
+                  hist_base_name = NULL;
+               else if( argv[i][2])
+                  hist_base_name = argv[i] + 2;
+               else if( i < (unsigned)argc - 1)
+                  hist_base_name = argv[++i];
+               break;
             default:
                printf( "Command-line option '%s' unknown\n", argv[i]);
                return( 0);
             }
 
-   tbuff = (char *)malloc( MAX_ILEN);
+   memset( &arena, 0, sizeof( arena));
    if( bulk_neocp_url)
       {
-      bytes_read = fetch_a_file( bulk_neocp_url, tbuff, MAX_ILEN);
-      ofile = err_fopen( "neocpnew.txt", "wb");
-      fwrite( tbuff, bytes_read, 1, ofile);
-      fclose( ofile);
+      int err;
+
+      arena.ofile = err_fopen( "neocpnew.txt", "wb");
+      err = fetch_a_file( bulk_neocp_url, &arena);
+      fclose( arena.ofile);
+      arena.ofile = NULL;
+      url_fetch_cleanup( );
+      if( err)
+         {           /* leave neocp.txt,  neocp.old,  etc. untouched */
+         printf( "Download failed;  nothing updated\n");
+         free( arena.buff);
+         free( arena.offsets);
+         return( -1);
+         }
       }
    else
       {
       ifile = err_fopen( "neocpnew.txt", "rb");
-      bytes_read = fread( tbuff, 1, MAX_ILEN, ifile);
+      read_a_file( ifile, &arena);
       fclose( ifile);
       }
-   printf( "%u bytes read; %u lines\n", bytes_read, bytes_read / 81U);
-   if( bytes_read % 81)
+   printf( "%u bytes read; %u lines\n", (unsigned)arena.loc,
+                                         (unsigned)arena.n_lines);
+   if( !arena.bad_line && arena.loc != arena.n_lines * NEOCP_LINE_LEN)
+      arena.bad_line = arena.n_lines + 1;       /* incomplete last line */
+   if( arena.bad_line)
       {
-      printf( "NOT A MULTIPLE OF 81\n");
+      printf( "NOT A MULTIPLE OF 81 (line %u)\n", (unsigned)arena.bad_line);
       return( -1);
       }
-   for( i = n_lines = 0; i < bytes_read; i++)
-      if( !i || tbuff[i - 1] == 10)
-         n_lines++;
-   ilines = (char **)calloc( n_lines + 1, sizeof( char *));
-   for( i = n_lines = 0; i < bytes_read; i++)
-      if( !i || tbuff[i - 1] == 10)
-         ilines[n_lines++] = tbuff + i;
+   ilines = (char **)calloc( arena.n_lines + 1, sizeof( char *));
+   for( i = 0; i < arena.n_lines; i++)
+      ilines[i] = arena.buff + arena.offsets[i];
+   free( arena.offsets);
 
+   if( hist_base_name)
+      {
+      hist = neo_hist_open( hist_base_name);
+      if( !hist)
+         printf( "Couldn't open history '%s'\n", hist_base_name);
+      }
    ifile = err_fopen( "neocp.txt", "rb");
    ofile = err_fopen( "neocp.old", "ab");
    memset( old_neocp, ' ', 12);
@@ -280,12 +400,10 @@ int main( const int argc, const char **argv)
          if( !match_found)
             {
             if( !n_to_old)
-               {
-               const time_t t0 = time( NULL);
-
-               fprintf( ofile, "# New objs added %.24s UTC\n", asctime( gmtime( &t0)));
-               }
+               fprintf( ofile, "# New objs added %.24s UTC\n", asctime( gmtime( &t_now)));
             fprintf( ofile, "%s", buff);
+            if( hist)
+               neo_hist_add( hist, buff, NEO_HIST_REMOVED, (int64_t)t_now);
             if( memcmp( old_neocp, buff, 12))
                {
                printf( "%.12s removed\n", buff);
@@ -304,11 +422,15 @@ int main( const int argc, const char **argv)
       if( !memcmp( ilines[i] + 59, "     ", 5))
          {
          memcpy( ilines[i] + 59, tag, 5);
+         if( hist)
+            neo_hist_add( hist, ilines[i], NEO_HIST_ADDED, (int64_t)t_now);
          n_new_lines++;
          }
+   if( hist && neo_hist_close( hist))
+      printf( "Error writing to history '%s'\n", hist_base_name);
    printf( "%u new lines found\n", n_new_lines);
    ofile = err_fopen( "neocp.txt", "wb");
-   fwrite( tbuff, bytes_read, 1, ofile);
+   fwrite( arena.buff, arena.loc, 1, ofile);
    fclose( ofile);
 
    ofile = NULL;
@@ -337,7 +459,7 @@ int main( const int argc, const char **argv)
             }
    if( ofile)
       fclose( ofile);
-   free( tbuff);
+   free( arena.buff);
    free( ilines);
    return 0;
 }
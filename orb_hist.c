@@ -0,0 +1,586 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "gz_input.h"
+
+/* Generalization of 'incl_a.c' (q.v.).  That makes a fixed 30x60 table
+of object counts by inclination and semimajor axis from MPCORB.DAT,  for
+Find_Orb's orbit evaluation.  This builds a histogram over any number of
+dimensions,  each one a quantity (a,  e,  i,  H,  q,  Q,  Tisserand
+parameter with respect to Jupiter,  etc.) with either uniform bins or
+explicitly given bin edges.  For example,
+
+orb_hist -da:0,6,60 -de:0,1,20 -di:0,60,30 -bpop.bin
+
+   would make a 60x20x30 histogram over (a, e, i).  With no dimensions
+given,  the incl_a grid (i:0,60,30 and a:0,6,60) is used,  and (given the
+same scale) the strings are the same as those incl_a makes.
+
+   Output is the 'compressed' form Find_Orb uses :  a C array of strings,
+one per combination of all but the last dimension,  with one character
+per bin of the last dimension,  ' ' + (int)( scale * log( count + 1)).
+Optionally (-b),  a dense binary form is also written;  see
+'write_binary()' below for its layout.
+
+   The input (which may be gzipped) is read in blocks of whole lines by
+the main thread,  and worker threads bin the records in each block into
+their own tables (so no locking per record);  the tables are summed at
+the end.  The tables together are limited to MAX_CELLS cells (1 GByte),
+so with very many bins,  fewer threads are used.  Objects outside the range of any dimension (or with a blank H,
+if H is a dimension) are not counted.
+
+Options :
+
+-d(q):min,max,n   Dimension for quantity q,  n uniform bins from min to max
+-e(q):e0,e1,...   Dimension for quantity q,  with bins e0 to e1,  e1 to e2...
+-i(filename)      Input file (default MPCORB.DAT)
+-b(filename)      Also write dense binary histogram to (filename)
+-s(scale)         Scale for the character output (default is the largest
+                  scale for which the most populated bin fits)
+-n(name)          Name for the C array (default 'incl_vs_a_scattergram')
+-t(n)             Use n threads (default is one per CPU)
+
+   Quantities are a,  e,  i,  H,  q,  Q,  T (Tisserand parameter),  n (mean
+motion),  p (argument of perihelion),  and A (ascending node).  */
+
+#define MAX_DIMS          8
+#define MAX_CELLS   (1 << 28)
+#define BLOCK_SIZE  (1 << 20)
+#define MAX_LINE        300
+
+typedef struct
+{
+   char quantity;
+   int n_bins;
+   bool uniform;
+   double min, max, scale;     /* scale = n_bins / (max - min) */
+   double *edges;              /* n_bins + 1 of them */
+} hist_dim_t;
+
+typedef struct
+{
+   char *data;
+   size_t len;
+} block_t;
+
+typedef struct
+{
+   const hist_dim_t *dims;
+   int n_dims;
+   size_t n_cells;
+   block_t *blocks;
+   int n_blocks, n_filled, next_filled, next_free;
+   int *filled, *free_list;   /* rings of block indices */
+   int n_free;
+   bool done;
+   pthread_mutex_t mutex;
+   pthread_cond_t filled_cond, free_cond;
+} hist_work_t;
+
+typedef struct
+{
+   hist_work_t *work;
+   uint32_t *counts;
+   long n_records, n_counted;
+} hist_thread_t;
+
+static const char *quantities = "aeiHqQTnpA";
+
+static void error_exit( const char *message, const char *arg)
+{
+   fprintf( stderr, message, arg);
+   fprintf( stderr, "\nRun 'orb_hist' with '-?' for usage;  see 'orb_hist.c' for details.\n");
+   exit( -1);
+}
+
+/* Parses '-da:0,6,60' (uniform bins) or '-ea:0,1.3,2,6' (explicit edges). */
+
+static void parse_dimension( hist_dim_t *dim, const char *arg)
+{
+   const bool uniform = (arg[1] == 'd');
+   double vals[1000];
+   int n_vals = 0, i, n_bytes;
+   const char *tptr = arg + 4;
+
+   if( !strchr( quantities, arg[2]) || arg[3] != ':')
+      error_exit( "'%s' isn't a valid dimension", arg);
+   while( n_vals < 1000 && sscanf( tptr, "%lf%n", vals + n_vals, &n_bytes) == 1)
+      {
+      n_vals++;
+      tptr += n_bytes;
+      if( *tptr != ',')
+         break;
+      tptr++;
+      }
+   memset( dim, 0, sizeof( hist_dim_t));
+   dim->quantity = arg[2];
+   dim->uniform = uniform;
+   if( uniform)
+      {
+      if( n_vals != 3 || vals[2] < 1. || vals[1] <= vals[0])
+         error_exit( "'%s' should be (q):min,max,n_bins", arg);
+      dim->n_bins = (int)vals[2];
+      dim->min = vals[0];
+      dim->max = vals[1];
+      dim->scale = (double)dim->n_bins / (dim->max - dim->min);
+      }
+   else
+      {
+      if( n_vals < 2)
+         error_exit( "'%s' needs at least two bin edges", arg);
+      for( i = 1; i < n_vals; i++)
+         if( vals[i] <= vals[i - 1])
+            error_exit( "'%s' : bin edges must increase", arg);
+      dim->n_bins = n_vals - 1;
+      dim->min = vals[0];
+      dim->max = vals[n_vals - 1];
+      }
+   dim->edges = (double *)malloc( (dim->n_bins + 1) * sizeof( double));
+   for( i = 0; i <= dim->n_bins; i++)
+      dim->edges[i] = (uniform ? dim->min + (double)i / dim->scale : vals[i]);
+}
+
+/* Returns false if the quantity can't be computed (blank H).  */
+
+static bool get_quantity( const char *line, const char quantity, double *val)
+{
+   const double jupiter_a = 5.2026;
+   double a, ecc;
+
+   switch( quantity)
+      {
+      case 'a':
+         *val = atof( line + 91);
+         break;
+      case 'e':
+         *val = atof( line + 69);
+         break;
+      case 'i':
+         *val = atof( line + 59);
+         break;
+      case 'H':
+         if( line[10] == ' ')
+            return( false);
+         *val = atof( line + 8);
+         break;
+      case 'q': case 'Q':
+         a = atof( line + 91);
+         ecc = atof( line + 69);
+         *val = a * (quantity == 'q' ? 1. - ecc : 1. + ecc);
+         break;
+      case 'T':
+         a = atof( line + 91);
+         ecc = atof( line + 69);
+         *val = jupiter_a / a + 2. * cos( atof( line + 59) * M_PI / 180.)
+                           * sqrt( a / jupiter_a * (1. - ecc * ecc));
+         break;
+      case 'n':
+         *val = atof( line + 80);
+         break;
+      case 'p':
+         *val = atof( line + 37);
+         break;
+      case 'A':
+         *val = atof( line + 48);
+         break;
+      }
+   return( true);
+}
+
+static int find_bin( const hist_dim_t *dim, const double x)
+{
+   int lo = 0, hi = dim->n_bins;
+
+   if( !(x >= dim->min) || x >= dim->max)
+      return( -1);
+   if( dim->uniform)
+      {
+      const int rval = (int)( (x - dim->min) * dim->scale);
+
+      return( rval < dim->n_bins ? rval : -1);
+      }
+   while( hi - lo > 1)        /* edges[lo] <= x < edges[hi] */
+      {
+      const int mid = (lo + hi) / 2;
+
+      if( x < dim->edges[mid])
+         hi = mid;
+      else
+         lo = mid;
+      }
+   return( lo);
+}
+
+static void bin_block( hist_thread_t *t, const char *data, const size_t len)
+{
+   const hist_work_t *work = t->work;
+   const char *end = data + len;
+
+   while( data < end)
+      {
+      const char *eol = (const char *)memchr( data, '\n', end - data);
+      const size_t line_len = (eol ? (size_t)( eol + 1 - data)
+                                   : (size_t)( end - data));
+
+      if( line_len > 200 && data[29] == '.' && data[95] == '.')
+         {
+         size_t cell = 0;
+         int i;
+
+         t->n_records++;
+         for( i = 0; i < work->n_dims; i++)
+            {
+            double val = 0.;
+            int bin;
+
+            if( !get_quantity( data, work->dims[i].quantity, &val))
+               break;
+            bin = find_bin( work->dims + i, val);
+            if( bin < 0)
+               break;
+            cell = cell * (size_t)work->dims[i].n_bins + (size_t)bin;
+            }
+         if( i == work->n_dims)
+            {
+            t->counts[cell]++;
+            t->n_counted++;
+            }
+         }
+      data += line_len;
+      }
+}
+
+static void *hist_thread( void *arg)
+{
+   hist_thread_t *t = (hist_thread_t *)arg;
+   hist_work_t *work = t->work;
+
+   for( ;;)
+      {
+      int idx;
+
+      pthread_mutex_lock( &work->mutex);
+      while( !work->n_filled && !work->done)
+         pthread_cond_wait( &work->filled_cond, &work->mutex);
+      if( !work->n_filled)
+         {
+         pthread_mutex_unlock( &work->mutex);
+         return( NULL);
+         }
+      idx = work->filled[work->next_filled];
+      work->next_filled = (work->next_filled + 1) % work->n_blocks;
+      work->n_filled--;
+      pthread_mutex_unlock( &work->mutex);
+      bin_block( t, work->blocks[idx].data, work->blocks[idx].len);
+      pthread_mutex_lock( &work->mutex);
+      work->free_list[(work->next_free + work->n_free) % work->n_blocks] = idx;
+      work->n_free++;
+      pthread_cond_signal( &work->free_cond);
+      pthread_mutex_unlock( &work->mutex);
+      }
+}
+
+/* The main thread reads the input in blocks ending at line boundaries
+(the partial line at the end of each read is carried over to the next
+block),  and queues them for the worker threads.  */
+
+static void read_blocks( hist_work_t *work, gz_input_t *ifile)
+{
+   char carry[MAX_LINE * 4];
+   size_t n_carry = 0;
+   bool at_eof = false;
+
+   while( !at_eof)
+      {
+      block_t *block;
+      size_t len, i;
+      int idx;
+
+      pthread_mutex_lock( &work->mutex);
+      while( !work->n_free)
+         pthread_cond_wait( &work->free_cond, &work->mutex);
+      idx = work->free_list[work->next_free];
+      work->next_free = (work->next_free + 1) % work->n_blocks;
+      work->n_free--;
+      pthread_mutex_unlock( &work->mutex);
+      block = work->blocks + idx;
+      memcpy( block->data, carry, n_carry);
+      len = n_carry + gz_input_read( block->data + n_carry,
+                                     BLOCK_SIZE - n_carry, ifile);
+      at_eof = (len < BLOCK_SIZE);
+      i = len;
+      if( at_eof)       /* in case the last line lacks a line feed */
+         block->data[len] = '\0';
+      else
+         {
+         while( i && block->data[i - 1] != '\n' && len - i < sizeof( carry))
+            i--;
+         if( !i || len - i == sizeof( carry))   /* absurdly long line */
+            i = len;
+         }
+      n_carry = len - i;
+      memcpy( carry, block->data + i, n_carry);
+      block->len = i;
+      pthread_mutex_lock( &work->mutex);
+      work->filled[(work->next_filled + work->n_filled) % work->n_blocks] = idx;
+      work->n_filled++;
+      if( at_eof)
+         work->done = true;
+      pthread_cond_broadcast( &work->filled_cond);
+      pthread_mutex_unlock( &work->mutex);
+      }
+}
+
+/* Dense binary form.  All values are in native byte order :
+
+   8 bytes   "ORBHIST1"
+   uint32    number of dimensions
+   for each dimension :
+      uint32   quantity letter (a, e, i, etc.)
+      uint32   number of bins
+      double   (number of bins + 1) bin edges
+   uint32    counts,  last dimension varying fastest
+
+   i.e.,  the same order as for the character output.  */
+
+static int write_binary( const char *filename, const hist_dim_t *dims,
+               const int n_dims, const uint32_t *counts, const size_t n_cells)
+{
+   FILE *ofile = fopen( filename, "wb");
+   uint32_t tval = (uint32_t)n_dims;
+   int i, rval = 0;
+
+   if( !ofile)
+      return( -1);
+   fwrite( "ORBHIST1", 8, 1, ofile);
+   fwrite( &tval, sizeof( tval), 1, ofile);
+   for( i = 0; i < n_dims; i++)
+      {
+      tval = (uint32_t)dims[i].quantity;
+      fwrite( &tval, sizeof( tval), 1, ofile);
+      tval = (uint32_t)dims[i].n_bins;
+      fwrite( &tval, sizeof( tval), 1, ofile);
+      fwrite( dims[i].edges, sizeof( double), dims[i].n_bins + 1, ofile);
+      }
+   if( fwrite( counts, sizeof( uint32_t), n_cells, ofile) != n_cells)
+      rval = -1;
+   if( fclose( ofile))
+      rval = -1;
+   return( rval);
+}
+
+static void write_char_array( const char *name, const hist_dim_t *dims,
+                 const int n_dims, const uint32_t *counts,
+                 const size_t n_cells, double scale, const long n_counted)
+{
+   const int row_len = dims[n_dims - 1].n_bins;
+   const size_t n_rows = n_cells / (size_t)row_len;
+   uint32_t max_count = 0;
+   size_t row, i;
+   int j, n_clipped = 0;
+
+   for( i = 0; i < n_cells; i++)
+      if( max_count < counts[i])
+         max_count = counts[i];
+   if( !scale)          /* nothing in range -> any finite scale will do */
+      scale = (max_count ? floor( 1000. * 94. / log( (double)max_count + 1.)) / 1000. : 1.);
+   printf( "/* orb_hist : %ld objects;  bin = ' ' + (int)( %g * log( count + 1))\n",
+                  n_counted, scale);
+   for( j = 0; j < n_dims; j++)
+      printf( "   %c : %g to %g,  %d bins%s\n", dims[j].quantity, dims[j].min,
+               dims[j].max, dims[j].n_bins, (dims[j].uniform ? "" : " (uneven)"));
+   printf( "*/\n");
+   if( n_dims == 2 && dims[1].quantity == 'a' && dims[1].uniform)
+      {                 /* header line as for incl_a */
+      printf( "/*           %g AU", dims[1].min);
+      for( j = 10; j <= row_len; j += 10)
+         printf( "%*g", (j == 10 ? 7 : 10), dims[1].edges[j]);
+      printf( " */\n");
+      }
+   printf( "static const char *%s[%lu] = {\n", name, (unsigned long)n_rows);
+   for( row = 0; row < n_rows; row++)
+      {
+      size_t idx = row;
+      char label[80], *lptr = label + sizeof( label) - 1;
+
+      *lptr = '\0';           /* label = lower edges of the bins */
+      for( j = n_dims - 2; j >= 0; j--)
+         {
+         char tbuff[30];
+         const size_t len = (size_t)snprintf( tbuff, sizeof( tbuff), " %c=%g",
+                dims[j].quantity, dims[j].edges[idx % (size_t)dims[j].n_bins]);
+
+         idx /= (size_t)dims[j].n_bins;
+         if( lptr - label > (int)len)
+            {
+            lptr -= len;
+            memcpy( lptr, tbuff, len);
+            }
+         }
+      printf( "/*%-9s*/ \"", lptr);
+      for( j = 0; j < row_len; j++)
+         {
+         const double zval = log( (double)counts[row * row_len + j] + 1.);
+         int ochar = ' ' + (int)( scale * zval);
+
+         if( ochar > 126)
+            {
+            ochar = 126;
+            n_clipped++;
+            }
+         if( ochar == '"' || ochar == '\\')      /* sidestep disallowed values */
+            ochar++;
+         printf( "%c", ochar);
+         }
+      printf( "\"%s\n", (row == n_rows - 1 ? " };" : ","));
+      }
+   if( n_clipped)
+      fprintf( stderr, "%d bins clipped;  a smaller scale is needed\n", n_clipped);
+}
+
+int main( const int argc, const char **argv)
+{
+   const char *ifilename = "MPCORB.DAT", *binary_filename = NULL;
+   const char *array_name = "incl_vs_a_scattergram";
+   hist_dim_t dims[MAX_DIMS];
+   int n_dims = 0, n_threads = 0, i;
+   size_t n_cells = 1, j;
+   double scale = 0.;
+   hist_work_t work;
+   hist_thread_t *threads;
+   pthread_t *thread_ids;
+   gz_input_t *ifile;
+   long n_records = 0, n_counted = 0;
+
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-')
+         switch( argv[i][1])
+            {
+            case 'd': case 'e':
+               if( n_dims == MAX_DIMS)
+                  error_exit( "Too many dimensions (max %s)", "8");
+               parse_dimension( dims + n_dims++, argv[i]);
+               break;
+            case 'i':
+               ifilename = argv[i] + 2;
+               break;
+            case 'b':
+               binary_filename = argv[i] + 2;
+               break;
+            case 's':
+               scale = atof( argv[i] + 2);
+               break;
+            case 'n':
+               array_name = argv[i] + 2;
+               break;
+            case 't':
+               n_threads = atoi( argv[i] + 2);
+               break;
+            default:
+               error_exit( "'%s' is not a recognized option", argv[i]);
+            }
+   if( !n_dims)      /* default to incl_a's grid */
+      {
+      parse_dimension( dims, "-di:0,60,30");
+      parse_dimension( dims + 1, "-da:0,6,60");
+      n_dims = 2;
+      }
+   for( i = 0; i < n_dims; i++)
+      {
+      n_cells *= (size_t)dims[i].n_bins;
+      if( n_cells > MAX_CELLS)
+         error_exit( "Too many bins in total%s", "");
+      }
+   ifile = gz_input_open( ifilename);
+   if( !ifile)
+      error_exit( "'%s' not opened", ifilename);
+   if( n_threads <= 0)
+      n_threads = (int)sysconf( _SC_NPROCESSORS_ONLN);
+   if( n_threads <= 0)
+      n_threads = 1;
+   if( (size_t)n_threads * n_cells > MAX_CELLS)    /* limit total table size */
+      n_threads = (int)( MAX_CELLS / n_cells);
+
+   memset( &work, 0, sizeof( work));
+   work.dims = dims;
+   work.n_dims = n_dims;
+   work.n_cells = n_cells;
+   work.n_blocks = work.n_free = n_threads * 2 + 1;
+   work.blocks = (block_t *)calloc( work.n_blocks, sizeof( block_t));
+   work.filled = (int *)calloc( work.n_blocks, sizeof( int));
+   work.free_list = (int *)calloc( work.n_blocks, sizeof( int));
+   for( i = 0; i < work.n_blocks; i++)
+      {
+      work.blocks[i].data = (char *)malloc( BLOCK_SIZE);
+      if( !work.blocks[i].data)
+         error_exit( "Out of memory%s", "");
+      work.free_list[i] = i;
+      }
+   pthread_mutex_init( &work.mutex, NULL);
+   pthread_cond_init( &work.filled_cond, NULL);
+   pthread_cond_init( &work.free_cond, NULL);
+   threads = (hist_thread_t *)calloc( n_threads, sizeof( hist_thread_t));
+   thread_ids = (pthread_t *)calloc( n_threads, sizeof( pthread_t));
+   for( i = 0; i < n_threads; i++)
+      {
+      threads[i].work = &work;
+      threads[i].counts = (uint32_t *)calloc( n_cells, sizeof( uint32_t));
+      if( !threads[i].counts)
+         error_exit( "Out of memory%s", "");
+      if( pthread_create( thread_ids + i, NULL, hist_thread, threads + i))
+         error_exit( "Couldn't create threads%s", "");
+      }
+   read_blocks( &work, ifile);
+   for( i = 0; i < n_threads; i++)
+      {
+      pthread_join( thread_ids[i], NULL);
+      n_records += threads[i].n_records;
+      n_counted += threads[i].n_counted;
+      if( i)
+         for( j = 0; j < n_cells; j++)
+            threads[0].counts[j] += threads[i].counts[j];
+      }
+   if( gz_input_close( ifile))
+      return( -1);
+   fprintf( stderr, "%ld records read;  %ld in range\n", n_records, n_counted);
+   write_char_array( array_name, dims, n_dims, threads[0].counts, n_cells,
+                                       scale, n_counted);
+   if( binary_filename && write_binary( binary_filename, dims, n_dims,
+                                        threads[0].counts, n_cells))
+      {
+      fprintf( stderr, "Couldn't write '%s'\n", binary_filename);
+      return( -1);
+      }
+   for( i = 0; i < n_threads; i++)
+      free( threads[i].counts);
+   for( i = 0; i < work.n_blocks; i++)
+      free( work.blocks[i].data);
+   free( work.blocks);
+   free( work.filled);
+   free( work.free_list);
+   free( threads);
+   free( thread_ids);
+   return( 0);
+}
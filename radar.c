@@ -63,6 +63,11 @@ into a single MPC observation.  The MPC format lets you do that,  but it's not
 a requirement (and keeping them separate does make it easier to exclude one
 observation but not the other.)
 
+   Regenerating everything each time JPL adds a few observations is
+wasteful.  Running with '-iradar.ast' (the previous output) converts only
+records modified since that file was made,  merges them into it,  and
+writes the result to stdout;  see 'load_previous_ast()' below.
+
    Also note that another program in this repository,  'getradar.c' (q.v.),  can
 be used to extract data for a specific object.  (The CGI-ified version is used
 for the on-line service mentioned above.)     */
@@ -146,23 +151,44 @@ typedef struct
 
 static bool show_unknown_names = false;
 
+/* Names from 'rnames.txt' are looked up (case-insensitively) in a hash
+table built when the file is read,  rather than compared against every
+entry in turn.  Should a name appear twice,  the first entry wins,  as it
+did with the linear search.   */
+
+static size_t name_hash( const char *name)
+{
+   size_t rval = 2166136261u;
+
+   while( *name)
+      rval = (rval ^ (size_t)tolower( (unsigned char)*name++)) * 16777619u;
+   return( rval);
+}
+
 static void substitute_name( char *oname, const char *iname, const char *desig, const char *time_observed)
 {
    static char **subs = NULL;
-   static size_t n_subs = 0;
+   static size_t n_subs = 0, hash_size = 0;
+   static int *hash_table = NULL;
    size_t i;
 
    if( !subs)
       {
       char buff[150];
       FILE *ifile = fopen( "rnames.txt", "rb");
+      size_t n_alloced = 200;
 
       assert( ifile);
-      subs = (char **)calloc( 2000, sizeof( char *));
+      subs = (char **)malloc( n_alloced * sizeof( char *));
       while( fgets( buff, sizeof( buff), ifile))
          if( *buff != '#')
             {
             buff[strlen( buff) - 1] = '\0';    /* remove trailing LF */
+            if( n_subs == n_alloced)
+               {
+               n_alloced *= 2;
+               subs = (char **)realloc( subs, n_alloced * sizeof( char *));
+               }
             subs[n_subs] = strdup( buff);
             i = 35;
             while( i && buff[i - 1] == ' ')
@@ -171,14 +197,34 @@ static void substitute_name( char *oname, const char *iname, const char *desig,
             subs[n_subs][i] = '\0';
             n_subs++;
             }
+      fclose( ifile);
+      hash_size = 64;
+      while( hash_size < n_subs * 2)
+         hash_size *= 2;
+      hash_table = (int *)malloc( hash_size * sizeof( int));
+      for( i = 0; i < hash_size; i++)
+         hash_table[i] = -1;
+      for( i = 0; i < n_subs; i++)
+         {
+         size_t loc = name_hash( subs[i]) & (hash_size - 1);
+
+         while( hash_table[loc] >= 0 && strcasecmp( subs[hash_table[loc]], subs[i]))
+            loc = (loc + 1) & (hash_size - 1);
+         if( hash_table[loc] < 0)
+            hash_table[loc] = (int)i;
+         }
       }
 
-   for( i = 0; i < n_subs; i++)
-      if( !strcasecmp( iname, subs[i]))
+   i = name_hash( iname) & (hash_size - 1);
+   while( hash_table[i] >= 0)
+      {
+      if( !strcasecmp( iname, subs[hash_table[i]]))
          {
-         strcpy( oname, subs[i] + 35);
+         strcpy( oname, subs[hash_table[i]] + 35);
          return;
          }
+      i = (i + 1) & (hash_size - 1);
+      }
    strcpy( oname, "!?");
    strcat( oname, iname);
    if( show_unknown_names && havent_seen_this_name( iname))
@@ -187,14 +233,12 @@ static void substitute_name( char *oname, const char *iname, const char *desig,
 
 /* This code assumes names will be comma-separated.  Which means that
 'Benner,L.A.M',  for example,  would be read as 'Benner' and 'L.A.M'.
-Exceptions have to be replaced with the right name(s). */
+Exceptions have to be replaced with the right name(s).  Each pair below is
+(text to look for,  case-insensitively),  (replacement);  they're applied
+in order,  each to the first place it occurs,  with later ones seeing the
+results of earlier ones.  */
 
-static void fix_observers( char *buff, const char *desig, const char *time_observed)
-{
-   char obuff[300], *tptr, *start = buff;
-   bool done = false;
-   size_t i, j;
-   static const char *subs[] = {
+static const char *observer_subs[] = {
             "Benner,L.A.M.",     "Benner",
             "Benner, L.A.M.",    "Benner",
             "Benner,L. A. M.",   "Benner",
@@ -250,13 +294,128 @@ static void fix_observers( char *buff, const char *desig, const char *time_obser
             "Zaitsev,A.",        "Zaitsev",
             NULL };
 
-   for( i = 0; subs[i]; i += 2)
-      if( (tptr = strcasestr( buff, subs[i])) != NULL)
+/* Rather than strcasestr() the buffer once for each of the above,  they're
+compiled into an Aho-Corasick automaton (a full DFA on lowercased bytes),
+so one pass over the buffer finds which of them occur.  The lowest-numbered
+one found is the one the sequential loop would have applied first.  After
+replacing it,  the buffer is rescanned for later patterns only.  Since
+most observer strings match nothing,  that's usually a single pass;  and
+the result is identical to applying them one at a time.  */
+
+typedef struct
+{
+   short next[256];
+   short pattern;          /* pattern ending here,  or -1 */
+   short dict_link;        /* next state on failure chain with a pattern */
+} ac_state_t;
+
+static ac_state_t *ac_states = NULL;
+
+static void build_observer_automaton( void)
+{
+   size_t i, n_states = 1, max_states = 1, head = 0, tail = 0;
+   short *fail, *queue;
+
+   for( i = 0; observer_subs[i]; i += 2)
+      max_states += strlen( observer_subs[i]);
+   ac_states = (ac_state_t *)malloc( max_states * sizeof( ac_state_t));
+   fail = (short *)calloc( max_states, sizeof( short));
+   queue = (short *)malloc( max_states * sizeof( short));
+   assert( ac_states && fail && queue);
+   memset( ac_states[0].next, 0xff, sizeof( ac_states[0].next));
+   ac_states[0].pattern = ac_states[0].dict_link = -1;
+   for( i = 0; observer_subs[i]; i += 2)
+      {
+      const unsigned char *tptr = (const unsigned char *)observer_subs[i];
+      int state = 0;
+
+      for( ; *tptr; tptr++)
+         {
+         const int c = tolower( *tptr);
+
+         if( ac_states[state].next[c] < 0)
+            {
+            memset( ac_states[n_states].next, 0xff, sizeof( ac_states[0].next));
+            ac_states[n_states].pattern = ac_states[n_states].dict_link = -1;
+            ac_states[state].next[c] = (short)n_states++;
+            }
+         state = ac_states[state].next[c];
+         }
+      if( ac_states[state].pattern < 0)
+         ac_states[state].pattern = (short)( i / 2);
+      }
+   for( i = 0; i < 256; i++)           /* breadth-first,  from the root */
+      if( ac_states[0].next[i] < 0)
+         ac_states[0].next[i] = 0;
+      else
+         queue[tail++] = ac_states[0].next[i];
+   while( head < tail)
+      {
+      const int state = queue[head++];
+
+      for( i = 0; i < 256; i++)
          {
-         strlcpy_error( obuff, subs[i + 1]);
-         strlcat_error( obuff, tptr + strlen( subs[i]));
-         strcpy( tptr, obuff);
+         const int next = ac_states[state].next[i];
+         const int via_fail = ac_states[fail[state]].next[i];
+
+         if( next < 0)
+            ac_states[state].next[i] = (short)via_fail;
+         else
+            {
+            fail[next] = (short)via_fail;
+            ac_states[next].dict_link = (ac_states[via_fail].pattern >= 0 ?
+                       (short)via_fail : ac_states[via_fail].dict_link);
+            queue[tail++] = (short)next;
+            }
          }
+      }
+   free( fail);
+   free( queue);
+}
+
+/* Returns the lowest-numbered pattern above 'min_pattern' found in 'buff'
+(or -1 if there are none),  and sets 'match' to its first occurrence.  */
+
+static int find_first_sub( char *buff, const int min_pattern, char **match)
+{
+   int state = 0, rval = -1;
+   char *tptr;
+
+   for( tptr = buff; *tptr; tptr++)
+      {
+      int s;
+
+      state = ac_states[state].next[tolower( (unsigned char)*tptr)];
+      for( s = (ac_states[state].pattern >= 0 ? state : ac_states[state].dict_link);
+                     s >= 0; s = ac_states[s].dict_link)
+         {
+         const int pattern = ac_states[s].pattern;
+
+         if( pattern > min_pattern && (rval < 0 || pattern < rval))
+            {
+            rval = pattern;
+            *match = tptr + 1 - strlen( observer_subs[pattern * 2]);
+            }
+         }
+      }
+   return( rval);
+}
+
+static void fix_observers( char *buff, const char *desig, const char *time_observed)
+{
+   char obuff[300], *tptr, *start = buff;
+   bool done = false;
+   size_t i, j;
+   int pattern = -1;
+
+   if( !ac_states)
+      build_observer_automaton( );
+   while( (pattern = find_first_sub( buff, pattern, &tptr)) >= 0)
+      {
+      strlcpy_error( obuff, observer_subs[pattern * 2 + 1]);
+      strlcat_error( obuff, tptr + strlen( observer_subs[pattern * 2]));
+      strcpy( tptr, obuff);
+      }
 
    for( tptr = buff; *tptr; tptr++)
       if( (tptr == buff || tptr[-1] == ',') &&
@@ -314,45 +473,158 @@ static void get_packed_desig( char *packed, const char *idesig)
       fprintf( stderr, "Couldn't pack '%s'\n", tbuff);
 }
 
-static void get_radar_obs( char *buff, radar_obs_t *obs)
+/* radar.json is read in fixed-size chunks,  and each record's fields are
+copied into a small arena that is reset once the record has been output.
+So memory use doesn't grow with the size of JPL's radar archive.  Only
+the '"data":' array is of interest;  each record in it is an array of
+twelve strings (or nulls),  see 'get_radar_obs()'.  Strings are kept as
+they appear in the JSON,  escapes and all.  */
+
+#define JSON_CHUNK_SIZE     65536
+#define RECORD_ARENA_SIZE   65536
+#define N_RADAR_FIELDS         12
+
+typedef struct
 {
-   int field;
+   FILE *ifile;
+   size_t pos, len;
+   bool in_data;
+   char buff[JSON_CHUNK_SIZE];
+} json_stream_t;
 
-   memset( obs, 0, sizeof( radar_obs_t));
-   for( field = 0; field < 12; field++)
+typedef struct
+{
+   size_t used;
+   char buff[RECORD_ARENA_SIZE];
+} record_arena_t;
+
+static void init_json_stream( json_stream_t *js, FILE *ifile)
+{
+   js->ifile = ifile;
+   js->pos = js->len = 0;
+   js->in_data = false;
+}
+
+static void rewind_json_stream( json_stream_t *js)
+{
+   fseek( js->ifile, 0L, SEEK_SET);
+   init_json_stream( js, js->ifile);
+}
+
+static int json_getc( json_stream_t *js)
+{
+   if( js->pos == js->len)
       {
-      int field_len;
-      char *tptr;
-      bool is_null = false;
+      js->len = fread( js->buff, 1, JSON_CHUNK_SIZE, js->ifile);
+      js->pos = 0;
+      if( !js->len)
+         return( EOF);
+      }
+   return( (unsigned char)js->buff[js->pos++]);
+}
 
-      if( *buff == '"')
-         {
-         size_t i = 1;
+static void arena_putc( record_arena_t *arena, const int c)
+{
+   if( arena->used == RECORD_ARENA_SIZE)
+      {
+      fprintf( stderr, "Record too long (over %d bytes)\n", RECORD_ARENA_SIZE);
+      exit( -1);
+      }
+   arena->buff[arena->used++] = (char)c;
+}
 
-         while( buff[i] && (buff[i] != '"' || buff[i - 1] == '\\'))
-            i++;
-         tptr = buff + 1;
-         field_len = (int)i - 1;
-         buff += i + 2;
-         }
-      else if( !memcmp( buff, "null", 4))
+static char *arena_strdup( record_arena_t *arena, const char *str)
+{
+   char *rval = arena->buff + arena->used;
+
+   do
+      {
+      arena_putc( arena, *str);
+      }
+      while( *str++);
+   return( rval);
+}
+
+/* Reads the next record from the '"data":' array into the arena,  setting
+fields[] to point to each field (or to NULL for nulls).  Returns false
+at the end of the file.   */
+
+static bool next_radar_record( json_stream_t *js, record_arena_t *arena,
+                               char **fields)
+{
+   static const char *data_tag = "\"data\":";
+   int c, prev_c = 0, field;
+
+   arena->used = 0;
+   if( !js->in_data)
+      {
+      size_t match_len = 0;
+
+      while( data_tag[match_len] && (c = json_getc( js)) != EOF)
+         if( c == data_tag[match_len])
+            match_len++;
+         else
+            match_len = (c == data_tag[0]);
+      if( data_tag[match_len])
+         return( false);
+      js->in_data = true;
+      }
+   while( (c = json_getc( js)) != EOF && (prev_c != '[' || c != '"'))
+      prev_c = c;
+   if( c == EOF)
+      return( false);
+   for( field = 0; field < N_RADAR_FIELDS; field++)
+      {
+      if( field)
+         c = json_getc( js);
+      if( c == '"')
          {
-         tptr = buff;
-         field_len = 4;
-         buff += 5;
-         is_null = true;
+         fields[field] = arena->buff + arena->used;
+         while( (c = json_getc( js)) != '"' && c != EOF)
+            {
+            arena_putc( arena, c);
+            if( c == '\\' && (c = json_getc( js)) != EOF)
+               arena_putc( arena, c);
+            }
+         arena_putc( arena, '\0');
          }
+      else if( c == 'n' && json_getc( js) == 'u' && json_getc( js) == 'l'
+                        && json_getc( js) == 'l')
+         fields[field] = NULL;
       else
+         c = EOF;
+      if( c != EOF)
+         c = json_getc( js);       /* skip ',' or closing ']' */
+      if( c == EOF || c != (field == N_RADAR_FIELDS - 1 ? ']' : ','))
          {
-         fprintf( stderr, "Error at '%.40s'\n", buff);
+         fprintf( stderr, "Error in field %d of a record\n", field);
          exit( -1);
          }
-      tptr[field_len] = '\0';
-      if( !is_null)
+      }
+   return( true);
+}
+
+/* Parses one record.  Observer names are fixed up only once we know the
+record is wanted,  i.e.,  (in incremental mode) was modified after
+'modified_after'.  Returns false for unwanted records.  'observers' and
+'notes' point into the arena,  and are valid until the next record is
+read.  */
+
+static bool get_radar_obs( char **fields, radar_obs_t *obs,
+                     const char *modified_after, record_arena_t *arena)
+{
+   int field;
+
+   memset( obs, 0, sizeof( radar_obs_t));
+   for( field = 0; field < N_RADAR_FIELDS; field++)
+      {
+      const char *tptr = fields[field];
+
+      if( tptr)
          switch( field)
             {
             case 0:
-               assert( field_len < 15);
+               assert( strlen( tptr) < 15);
                get_packed_desig( obs->desig, tptr);
                break;
             case 1:
@@ -393,79 +665,100 @@ static void get_radar_obs( char *buff, radar_obs_t *obs)
                assert( *tptr == 'C' || *tptr == 'P');
                break;
             case 9:
-               {
-               char tbuff[200];
-
-               assert( field_len < (int)sizeof( tbuff) - 1);
-               strlcpy_error( tbuff, tptr);
-//             printf( "%s\n", tbuff);
-               fix_observers( tbuff, obs->desig, obs->time);
-               obs->observers = (char *)malloc( strlen( tbuff) + 1);
-               strcpy( obs->observers, tbuff);
-               }
+               assert( strlen( tptr) < 199);
                break;
             case 10:
-               obs->notes = (char *)malloc( strlen( tptr) + 1);
-               strcpy( obs->notes, tptr);
+               obs->notes = fields[field];
                break;
             case 11:
                assert( strlen( tptr) == 19);
                strlcpy_error( obs->time_modified, tptr);
                break;
-            default:
-               fprintf( stderr, "? field %d\n", field);
             }
       }
+   if( modified_after && strcmp( obs->time_modified, modified_after) <= 0)
+      return( false);
+   if( fields[9])
+      {
+      char tbuff[200];
+
+      strlcpy_error( tbuff, fields[9]);
+      fix_observers( tbuff, obs->desig, obs->time);
+      obs->observers = arena_strdup( arena, tbuff);
+      }
+   return( true);
+}
+
+/* Packed designations are deduplicated with an open-addressed hash table
+(grown as needed,  so there's no limit on the number of objects),  then
+sorted.  Records for an object are usually consecutive,  so the previous
+designation is checked first.  */
+
+static int compare_desigs( const void *a, const void *b)
+{
+   return( strcmp( *(const char * const *)a, *(const char * const *)b));
 }
 
-static void output_index( const char *buff)
+static void output_index( json_stream_t *js, record_arena_t *arena)
 {
-   char **found = (char **)calloc( 10000, sizeof( char *));
-   size_t n_found = 0, i;
+   char **found = NULL;
+   char *fields[N_RADAR_FIELDS];
+   size_t n_found = 0, n_alloced = 0, hash_size = 0, i;
+   int *hash_table = NULL;
 
-   while( *buff)
-      {
-      buff++;
-      if( buff[0] == '[' && buff[1] == '"')
+   while( next_radar_record( js, arena, fields))
+      if( fields[0])
          {
-         char tbuff[20], packed[20];
+         char packed[20];
+         size_t loc;
 
-         buff += 2;
-         i = 0;
-         while( buff[i] && buff[i] != '"')
-            i++;
-         assert( i < sizeof( tbuff));
-         memcpy( tbuff, buff, i);
-         buff += i;
-         tbuff[i] = '\0';
-         get_packed_desig( packed, tbuff);
-         i = 0;
-         while( i < n_found && strcmp( found[i], packed))
-            i++;
-         if( i == n_found)
+         assert( strlen( fields[0]) < 20);
+         get_packed_desig( packed, fields[0]);
+         if( n_found && !strcmp( found[n_found - 1], packed))
+            continue;
+         if( n_found * 2 >= hash_size)     /* grow & rehash */
+            {
+            hash_size = (hash_size ? hash_size * 2 : 1024);
+            free( hash_table);
+            hash_table = (int *)malloc( hash_size * sizeof( int));
+            assert( hash_table);
+            for( i = 0; i < hash_size; i++)
+               hash_table[i] = -1;
+            for( i = 0; i < n_found; i++)
+               {
+               loc = name_hash( found[i]) & (hash_size - 1);
+               while( hash_table[loc] >= 0)
+                  loc = (loc + 1) & (hash_size - 1);
+               hash_table[loc] = (int)i;
+               }
+            }
+         loc = name_hash( packed) & (hash_size - 1);
+         while( hash_table[loc] >= 0 && strcmp( found[hash_table[loc]], packed))
+            loc = (loc + 1) & (hash_size - 1);
+         if( hash_table[loc] < 0)
             {
+            if( n_found == n_alloced)
+               {
+               n_alloced = (n_alloced ? n_alloced * 2 : 1024);
+               found = (char **)realloc( found, n_alloced * sizeof( char *));
+               assert( found);
+               }
+            hash_table[loc] = (int)n_found;
             found[n_found] = (char *)malloc( strlen( packed) + 1);
             strcpy( found[n_found++], packed);
             }
          }
-      }
-   for( i = 1; i < n_found; i++)
-      if( strcmp( found[i], found[i - 1]) < 0)
-         {
-         char *tptr = found[i];
-
-         found[i] = found[i - 1];
-         found[i - 1] = tptr;
-         if( i > 1)
-            i -= 2;
-         }
+   free( hash_table);
+   qsort( found, n_found, sizeof( char *), compare_desigs);
    for( i = 0; i < n_found; i++)
       {
       if( !(i % 5))
          printf( "\nCOM desigs :");
       printf( " %s", found[i]);
+      free( found[i]);
       }
    printf( "\n");
+   free( found);
 }
 
 /* The round-trip travel time,  Doppler frequency,  and their
@@ -498,15 +791,15 @@ static void put_with_implicit_decimal( char *line, const char *text)
 static char last_modified[20];
 static char last_observed[20];
 
-static void put_radar_comment( const radar_obs_t *obs)
+static void put_radar_comment( FILE *ofile, const radar_obs_t *obs)
 {
    const char *notes = obs->notes;
    char mpc_code[4];
 
    put_mpc_code_from_dss( mpc_code, obs->receiver);
-   printf( "\nCOD %.3s\n", mpc_code);
-   printf( "OBS %s\n", obs->observers);
-   printf( "COM Last modified %s\n", obs->time_modified);
+   fprintf( ofile, "\nCOD %.3s\n", mpc_code);
+   fprintf( ofile, "OBS %s\n", obs->observers);
+   fprintf( ofile, "COM Last modified %s\n", obs->time_modified);
    if( strcmp( last_modified, obs->time_modified) < 0)
       strlcpy_error( last_modified, obs->time_modified);
    if( strcmp( last_observed, obs->time) < 0)
@@ -524,7 +817,7 @@ static void put_radar_comment( const radar_obs_t *obs)
          insert = " ";
       if( len <= max_len)           /* finish up line */
          {
-         printf( "COM %s%s\n", insert, notes);
+         fprintf( ofile, "COM %s%s\n", insert, notes);
          return;
          }
       else
@@ -532,12 +825,330 @@ static void put_radar_comment( const radar_obs_t *obs)
          len = max_len;
          while( notes[len] != ' ')
             len--;
-         printf( "COM %s%.*s\n", insert, (int)len, notes);
+         fprintf( ofile, "COM %s%.*s\n", insert, (int)len, notes);
          notes += len + 1;
          }
       }
 }
 
+/* Incremental mode ('-i(previous radar.ast)').  Every JSON record has a
+'time_modified',  and the previous output ends with 'COM Final
+modification (time)'.  So only records modified since then need to be
+converted.  The previous output is split into blocks (the comment lines
+plus two observation lines for each observation),  keyed by packed desig,
+observation time,  Doppler vs. range,  transmitter,  and receiver.  A
+modified record with the same key replaces its old block;  a new one is
+inserted among that object's blocks,  after the last one observed at or
+before it (or at the end of the file,  for a newly-observed object).
+Unmodified records are only run through put_radar_obs() to get their
+keys.  Every record marks the block it matches as 'seen';  blocks left
+unseen at the end (the record was deleted,  or modified so that its key
+changed) are dropped,  so the output matches a full conversion.  Blocks
+are also chained per object,  so that finding where to insert a new one
+needn't look at every block.  The 'COM desigs' index is rebuilt from the
+JSON as usual.  Comments are required (i.e.,  '-c' can't be used),  since
+otherwise the previous output doesn't record the modification times.  */
+
+#define BLOCK_KEY_LEN 36
+
+typedef struct
+{
+   const char *text;
+   char *replacement;      /* malloced text of a modified record,  or NULL */
+   size_t len;
+   char key[BLOCK_KEY_LEN + 1];
+   bool seen;
+   int next_for_object;              /* next block with the same desig */
+   int first_insert, last_insert;    /* new blocks to go after this one */
+} ast_block_t;
+
+typedef struct
+{
+   char *text;
+   int next;
+} new_block_t;
+
+typedef struct
+{
+   char *buff;
+   ast_block_t *blocks;
+   int n_blocks, n_alloced;
+   int *key_table, *object_table;
+   size_t table_size;
+   new_block_t *new_blocks;
+   int n_new, n_new_alloced, n_replaced, n_dropped;
+   int first_prepended, last_prepended;   /* blocks before all others */
+   int first_appended, last_appended;     /* blocks for new objects */
+   char final_modified[20], final_observed[20];
+} prev_ast_t;
+
+static const char *find_obs_line( const char *text, const size_t len)
+{
+   const char *tptr = text, *end = text + len;
+
+   while( tptr < end)
+      {
+      const char *eol = (const char *)memchr( tptr, '\n', end - tptr);
+
+      if( !eol)
+         eol = end;
+      if( eol - tptr == 80 && !memcmp( tptr + 72, "JPLRS", 5))
+         return( tptr);
+      tptr = eol + 1;
+      }
+   return( NULL);
+}
+
+static void make_block_key( char *key, const char *line1)
+{
+   memcpy( key, line1, 12);                     /* packed desig */
+   memcpy( key + 12, line1 + 15, 17);           /* observation time */
+   key[29] = (line1[47] == ' ' ? 'r' : 'd');    /* range or Doppler */
+   memcpy( key + 30, line1 + 68, 3);            /* transmitter */
+   memcpy( key + 33, line1 + 77, 3);            /* receiver */
+   key[BLOCK_KEY_LEN] = '\0';
+}
+
+/* Returns the first block with the given key that hasn't been 'seen'
+yet (there can be more than one,  if JPL has duplicate records),  or -1.
+'loc' is left at the first empty slot after it,  for adding a new key.  */
+
+static int find_block( const prev_ast_t *prev, const char *key, size_t *loc)
+{
+   int rval = -1;
+
+   *loc = name_hash( key) & (prev->table_size - 1);
+   while( prev->key_table[*loc] >= 0)
+      {
+      const int idx = prev->key_table[*loc];
+
+      if( rval < 0 && !prev->blocks[idx].seen && !strcmp( prev->blocks[idx].key, key))
+         rval = idx;
+      *loc = (*loc + 1) & (prev->table_size - 1);
+      }
+   return( rval);
+}
+
+/* Returns the first block for the object with the given packed desig,
+or -1.  Later blocks for it are found by following 'next_for_object'.  */
+
+static int find_object( const prev_ast_t *prev, const char *key, size_t *loc)
+{
+   char desig[13];
+
+   memcpy( desig, key, 12);
+   desig[12] = '\0';
+   *loc = name_hash( desig) & (prev->table_size - 1);
+   while( prev->object_table[*loc] >= 0)
+      {
+      const int idx = prev->object_table[*loc];
+
+      if( !memcmp( prev->blocks[idx].key, desig, 12))
+         return( idx);
+      *loc = (*loc + 1) & (prev->table_size - 1);
+      }
+   return( -1);
+}
+
+static int load_previous_ast( prev_ast_t *prev, const char *filename)
+{
+   FILE *ifile = fopen( filename, "rb");
+   const char *tptr, *end;
+   long len;
+   int i;
+
+   memset( prev, 0, sizeof( prev_ast_t));
+   prev->first_prepended = prev->last_prepended = -1;
+   prev->first_appended = prev->last_appended = -1;
+   if( !ifile)
+      return( -1);
+   fseek( ifile, 0L, SEEK_END);
+   len = ftell( ifile);
+   fseek( ifile, 0L, SEEK_SET);
+   prev->buff = (char *)malloc( len + 1);
+   assert( prev->buff);
+   if( fread( prev->buff, 1, len, ifile) != (size_t)len)
+      len = 0;
+   prev->buff[len] = '\0';
+   fclose( ifile);
+   end = strstr( prev->buff, "COM Final modification ");
+   if( !end || sscanf( end + 23, "%19[^\n]", prev->final_modified) != 1)
+      return( -2);
+   if( (tptr = strstr( end, "COM Final observation ")) != NULL)
+      sscanf( tptr + 22, "%19[^\n]", prev->final_observed);
+   tptr = strstr( prev->buff, "\n\nCOD ");
+   while( tptr && tptr < end)
+      {
+      const char *block_start = tptr + 2, *line1, *line2;
+      ast_block_t *block;
+
+      line1 = find_obs_line( block_start, end - block_start);
+      if( !line1)
+         break;
+      line2 = find_obs_line( line1 + 81, end - line1 - 81);
+      if( !line2)
+         break;
+      if( prev->n_blocks == prev->n_alloced)
+         {
+         prev->n_alloced = (prev->n_alloced ? prev->n_alloced * 2 : 4096);
+         prev->blocks = (ast_block_t *)realloc( prev->blocks,
+                                 prev->n_alloced * sizeof( ast_block_t));
+         assert( prev->blocks);
+         }
+      block = prev->blocks + prev->n_blocks++;
+      block->text = block_start;
+      block->replacement = NULL;
+      block->len = (size_t)( line2 + 81 - block_start);
+      block->seen = false;
+      block->next_for_object = -1;
+      block->first_insert = block->last_insert = -1;
+      make_block_key( block->key, line1);
+      tptr = strstr( line2 + 80, "\n\nCOD ");
+      }
+   prev->table_size = 64;
+   while( prev->table_size < (size_t)prev->n_blocks * 2)
+      prev->table_size *= 2;
+   prev->key_table = (int *)malloc( prev->table_size * sizeof( int));
+   prev->object_table = (int *)malloc( prev->table_size * sizeof( int));
+   assert( prev->key_table && prev->object_table);
+   for( i = 0; i < (int)prev->table_size; i++)
+      prev->key_table[i] = prev->object_table[i] = -1;
+   for( i = 0; i < prev->n_blocks; i++)
+      {
+      size_t loc;
+
+      find_block( prev, prev->blocks[i].key, &loc);
+      prev->key_table[loc] = i;
+      }
+   for( i = prev->n_blocks - 1; i >= 0; i--)    /* build chains in file order */
+      {
+      size_t loc;
+      const int next = find_object( prev, prev->blocks[i].key, &loc);
+
+      prev->blocks[i].next_for_object = next;
+      prev->object_table[loc] = i;
+      }
+   return( 0);
+}
+
+static void free_previous_ast( prev_ast_t *prev)
+{
+   int i;
+
+   for( i = 0; i < prev->n_blocks; i++)
+      free( prev->blocks[i].replacement);
+   for( i = 0; i < prev->n_new; i++)
+      free( prev->new_blocks[i].text);
+   free( prev->blocks);
+   free( prev->new_blocks);
+   free( prev->key_table);
+   free( prev->object_table);
+   free( prev->buff);
+}
+
+static void add_to_list( new_block_t *new_blocks, int *first, int *last,
+                         const int idx)
+{
+   if( *last >= 0)
+      new_blocks[*last].next = idx;
+   else
+      *first = idx;
+   *last = idx;
+}
+
+/* An unmodified record just marks its block as seen. */
+
+static void mark_block_seen( prev_ast_t *prev, const char *line1)
+{
+   char key[BLOCK_KEY_LEN + 1];
+   size_t loc;
+   int idx;
+
+   make_block_key( key, line1);
+   idx = find_block( prev, key, &loc);
+   if( idx >= 0)
+      prev->blocks[idx].seen = true;
+}
+
+/* 'text' is a malloced block for a modified record,  starting with the
+blank line that separates it from the previous block.  It either
+replaces the old block with the same key,  or is added as a new block.
+Either way,  'prev' takes ownership of it.  */
+
+static void merge_block( prev_ast_t *prev, char *text)
+{
+   const char *line1 = find_obs_line( text, strlen( text));
+   char key[BLOCK_KEY_LEN + 1];
+   size_t loc;
+   int idx, i, anchor = -2;
+
+   assert( line1);
+   make_block_key( key, line1);
+   idx = find_block( prev, key, &loc);
+   if( idx >= 0)        /* modified observation : replace it */
+      {
+      prev->blocks[idx].replacement = text;
+      prev->blocks[idx].text = text + 1;     /* skip leading newline */
+      prev->blocks[idx].len = strlen( text + 1);
+      prev->blocks[idx].seen = true;
+      prev->n_replaced++;
+      return;
+      }
+   if( prev->n_new == prev->n_new_alloced)
+      {
+      prev->n_new_alloced = (prev->n_new_alloced ? prev->n_new_alloced * 2 : 256);
+      prev->new_blocks = (new_block_t *)realloc( prev->new_blocks,
+                           prev->n_new_alloced * sizeof( new_block_t));
+      assert( prev->new_blocks);
+      }
+   idx = prev->n_new++;
+   prev->new_blocks[idx].text = text;
+   prev->new_blocks[idx].next = -1;
+   i = find_object( prev, key, &loc);
+   if( i >= 0)
+      anchor = i - 1;      /* before the first block,  at worst */
+   for( ; i >= 0; i = prev->blocks[i].next_for_object)
+      if( memcmp( prev->blocks[i].key + 12, key + 12, 17) <= 0)
+         anchor = i;
+   if( anchor == -2)
+      add_to_list( prev->new_blocks, &prev->first_appended,
+                                     &prev->last_appended, idx);
+   else if( anchor == -1)     /* goes before everything else */
+      add_to_list( prev->new_blocks, &prev->first_prepended,
+                                     &prev->last_prepended, idx);
+   else
+      add_to_list( prev->new_blocks, &prev->blocks[anchor].first_insert,
+                                     &prev->blocks[anchor].last_insert, idx);
+}
+
+static void output_new_blocks( const new_block_t *new_blocks, int idx)
+{
+   while( idx >= 0)
+      {
+      printf( "%s", new_blocks[idx].text);
+      idx = new_blocks[idx].next;
+      }
+}
+
+static void output_merged_blocks( prev_ast_t *prev)
+{
+   int i;
+
+   for( i = 0; i < prev->n_blocks; i++)
+      if( !prev->blocks[i].seen)
+         prev->n_dropped++;
+   output_new_blocks( prev->new_blocks, prev->first_prepended);
+   for( i = 0; i < prev->n_blocks; i++)
+      {
+      if( prev->blocks[i].seen)
+         printf( "\n%.*s", (int)prev->blocks[i].len, prev->blocks[i].text);
+      output_new_blocks( prev->new_blocks, prev->blocks[i].first_insert);
+      }
+   output_new_blocks( prev->new_blocks, prev->first_appended);
+   fprintf( stderr, "%d records updated,  %d added,  %d removed\n",
+                  prev->n_replaced, prev->n_new, prev->n_dropped);
+}
+
 static void put_radar_obs( char *line1, char *line2, const radar_obs_t *obs)
 {
    const int seconds = atoi( obs->time + 17)
@@ -601,7 +1212,9 @@ int main( const int argc, const char **argv)
    const char *ifilename = "radar.json";
    int i;
    FILE *ifile;
+   const char *prev_filename = NULL;
    bool show_comments = true;
+   prev_ast_t prev;
 
    for( i = 1; i < argc; i++)
       if( argv[i][0] == '-')
@@ -613,6 +1226,9 @@ int main( const int argc, const char **argv)
             case 'c':
                show_comments = false;
                break;
+            case 'i':
+               prev_filename = argv[i] + 2;
+               break;
             default:
                fprintf( stderr, "'%s' unrecognized option\n", argv[i]);
                return( -1);
@@ -620,44 +1236,82 @@ int main( const int argc, const char **argv)
       else
          ifilename = argv[i];
 
+   if( prev_filename)
+      {
+      if( !show_comments)
+         {
+         fprintf( stderr, "'-i' and '-c' can't be used together\n");
+         return( -1);
+         }
+      i = load_previous_ast( &prev, prev_filename);
+      if( i)
+         {
+         fprintf( stderr, "'%s' %s\n", prev_filename, (i == -1 ?
+                 "not opened" : "isn't a complete 'radar' output file"));
+         return( -1);
+         }
+      strlcpy_error( last_modified, prev.final_modified);
+      strlcpy_error( last_observed, prev.final_observed);
+      }
    ifile = fopen( ifilename, "rb");
    if( !ifile)
       fprintf( stderr, "'%s' not opened", ifilename);
    else
       {
-      int len;
-      char *buff;
       time_t t0 = time( NULL);
+      json_stream_t *js = (json_stream_t *)malloc( sizeof( json_stream_t));
+      record_arena_t *arena = (record_arena_t *)malloc( sizeof( record_arena_t));
+      char *fields[N_RADAR_FIELDS];
 
-      fseek( ifile, 0L, SEEK_END);
-      len = (int)ftell( ifile);
-      fseek( ifile, 0L, SEEK_SET);
-      buff = (char *)malloc( len + 1);
-      buff[len] = '\0';
-      i = fread( buff, 1, len, ifile);
-      assert( i == len);
-      fclose( ifile);
-      i = 0;
-      while( buff[i] && memcmp( buff + i, "\"data\":", 7))
-         i++;
+      assert( js && arena);
+      init_json_stream( js, ifile);
       printf( "COM 'radar' converter run at %.24s UTC\n",
                                asctime( gmtime( &t0)));
       printf( "COM 'radar' version 2025 Jan 02;  see\n"
               "COM https://github.com/Bill-Gray/miscell/blob/master/radar.c\n"
               "COM for relevant code\n");
-      output_index( buff + i);
-      for( ; i < len; i++)
-         if( buff[i - 1] == '[' && buff[i] == '"')
+      output_index( js, arena);
+      rewind_json_stream( js);
+      while( next_radar_record( js, arena, fields))
+         {
+         radar_obs_t obs;
+         char line1[90], line2[90];
+
+         if( prev_filename)
             {
-            radar_obs_t obs;
-            char line1[90], line2[90];
+            char *text;
+            size_t text_len;
+            FILE *ofile;
 
-            get_radar_obs( buff + i, &obs);
-            if( show_comments)
-               put_radar_comment( &obs);
+            if( !get_radar_obs( fields, &obs, prev.final_modified, arena))
+               {
+               put_radar_obs( line1, line2, &obs);
+               mark_block_seen( &prev, line1);
+               continue;
+               }
+            ofile = open_memstream( &text, &text_len);
+            assert( ofile);
+            put_radar_comment( ofile, &obs);
             put_radar_obs( line1, line2, &obs);
-            printf( "%s\n%s\n", line1, line2);
+            fprintf( ofile, "%s\n%s\n", line1, line2);
+            fclose( ofile);
+            merge_block( &prev, text);
+            continue;
             }
+         get_radar_obs( fields, &obs, NULL, arena);
+         if( show_comments)
+            put_radar_comment( stdout, &obs);
+         put_radar_obs( line1, line2, &obs);
+         printf( "%s\n%s\n", line1, line2);
+         }
+      fclose( ifile);
+      free( js);
+      free( arena);
+      if( prev_filename)
+         {
+         output_merged_blocks( &prev);
+         free_previous_ast( &prev);
+         }
       printf( "COM Final modification %s\n", last_modified);
       printf( "COM Final observation %s\n", last_observed);
       }
@@ -0,0 +1,77 @@
+#!/bin/sh
+# Runs each of the download tools against 'http_replay',  with no network
+# access,  and reports the requests made,  bytes transferred,  and wall time
+# for each.  Usage :
+#
+# ./replay_bench.sh (recording dir) [http_replay options]
+#
+# e.g.,  './replay_bench.sh recs -l50 -b2000000 -e5' adds 50 ms latency,
+# limits each connection to 2 MB/s,  and fails 5% of requests with a 503.
+# See 'http_replay.c' for the options and the recording layout;  running
+# once with '-r' (and network access) records whatever is missing.
+#
+# Each tool is run in a fresh scratch directory.  If (recording dir)/_work
+# exists,  its contents are copied there first (neocp and neocp2 expect an
+# existing neocp.txt,  for example,  and mpecer an existing year file).
+# The download cache is disabled (DL_CACHE_DIR=-) unless DL_CACHE_DIR is
+# already set,  so that caching can be benchmarked as well.  Tools that
+# haven't been built are skipped.  The tools and arguments can be changed
+# by setting BENCH_TOOLS,  one 'tool args' per line.
+
+if [ -z "$1" ] || [ ! -d "$1" ]; then
+   echo "Usage: replay_bench.sh (recording dir) [http_replay options]"
+   exit 1
+fi
+REC=$(cd "$1" && pwd)
+shift
+BIN=${BIN:-$(pwd)}
+PORT=${PORT:-8642}
+DL_CACHE_DIR=${DL_CACHE_DIR:--}
+URL_FETCH_REPLAY=http://127.0.0.1:$PORT
+export DL_CACHE_DIR URL_FETCH_REPLAY
+
+if [ -z "$BENCH_TOOLS" ]; then
+   BENCH_TOOLS="neocp
+neocp2 -h-
+grab_mpc grab_mpc.txt 2024 AA
+grab_new grab_new.txt 433
+mpecer 2024 -p4
+my_wget https://www.minorplanetcenter.net/iau/ECS/MPCAT-OBS/NumObs.txt.gz NumObs.txt.gz
+my_wget https://www.minorplanetcenter.net/iau/ECS/MPCAT-OBS/NumObs.txt.gz NumObs.txt.gz -n4"
+fi
+
+SCRATCH=$(mktemp -d)
+LOG=$SCRATCH/server.log
+"$BIN/http_replay" "$REC" -p$PORT "$@" > "$LOG" 2> "$SCRATCH/server.err" &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null; rm -rf "$SCRATCH"' EXIT
+sleep 1
+
+printf "%-10s %8s %12s %9s %5s  %s\n" tool requests bytes seconds rval args
+echo "$BENCH_TOOLS" | while read -r TOOL ARGS; do
+   if [ -z "$TOOL" ] || [ ! -x "$BIN/$TOOL" ]; then
+      continue
+   fi
+   WORK=$SCRATCH/work
+   rm -rf "$WORK"
+   mkdir "$WORK"
+   if [ -d "$REC/_work" ]; then
+      cp -r "$REC/_work/." "$WORK"
+   fi
+   START_LINE=$(wc -l < "$LOG")
+   T0=$(date +%s.%N)
+   (cd "$WORK" && "$BIN/$TOOL" $ARGS > "$SCRATCH/$TOOL.out" 2>&1)
+   RVAL=$?
+   T1=$(date +%s.%N)
+   sleep 0.2          # let the server finish logging
+   tail -n +$((START_LINE + 1)) "$LOG" | awk -v tool="$TOOL" -v args="$ARGS" \
+        -v t0="$T0" -v t1="$T1" -v rval="$RVAL" \
+        '{ n++; bytes += $4 }
+         END { printf( "%-10s %8d %12d %9.3f %5d  %s\n", tool, n, bytes,
+                       t1 - t0, rval, args) }'
+done
+grep -v "^Replaying" "$SCRATCH/server.err" > "$SCRATCH/server.msg"
+if [ -s "$SCRATCH/server.msg" ]; then
+   echo "Server messages (missing recordings,  etc.) :"
+   sort -u "$SCRATCH/server.msg"
+fi
@@ -0,0 +1,332 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "url_fetch.h"
+
+/* The various download tools used to each do their own curl_easy_init(),
+setopt(),  perform(),  cleanup(),  so every request paid for a fresh DNS
+lookup,  TCP connection,  and TLS handshake,  and any hiccup was fatal.
+Instead :
+
+   -- All handles made by url_fetch_new_handle() share one connection
+pool,  DNS cache,  and TLS session cache (via a CURLSH 'share'),  so a
+second request to the same server reuses the open connection.  That's
+true even across threads (my_wget) and within curl_multi (mpecer).
+
+   -- HTTP/2 is requested for https (falling back to HTTP/1.1 if the
+server doesn't do it),  and handles wait to multiplex over an existing
+connection rather than open a new one.
+
+   -- url_fetch_perform() retries transient failures (timeouts,
+connection resets,  HTTP 408/429/5xx) up to URL_FETCH_MAX_RETRIES times,
+with exponential backoff.  Before each retry,  the caller's 'reset'
+function is called to discard partial data.  Other errors (404,  say)
+are returned immediately.
+
+   -- URLs are set with url_fetch_set_url().  If the environment variable
+URL_FETCH_REPLAY is set (to,  say,  'http://127.0.0.1:8642'),  then
+'https://www.minorplanetcenter.net/iau/NEO/neocp.txt' is fetched as
+'http://127.0.0.1:8642/www.minorplanetcenter.net/iau/NEO/neocp.txt'.
+That lets all these tools be run against 'http_replay' (q.v.),  with
+no network access.  Cache keys etc. still use the real URL.
+
+   url_fetch_to_memory() and url_fetch_to_file() cover the common cases,
+using one persistent default handle.  Tools with their own write
+callbacks just get a handle from url_fetch_new_handle() (or the default
+handle) and call url_fetch_perform() with a suitable reset function.  */
+
+static CURLSH *share;
+static CURL *default_handle;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t jitter_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t jitter_state;
+
+static void lock_share( CURL *curl, curl_lock_data data,
+                        curl_lock_access access, void *userptr)
+{
+   (void)curl;
+   (void)access;
+   (void)userptr;
+   pthread_mutex_lock( share_locks + data);
+}
+
+static void unlock_share( CURL *curl, curl_lock_data data, void *userptr)
+{
+   (void)curl;
+   (void)userptr;
+   pthread_mutex_unlock( share_locks + data);
+}
+
+static void init_url_fetch( void)
+{
+   int i;
+
+   curl_global_init( CURL_GLOBAL_DEFAULT);
+   for( i = 0; i < CURL_LOCK_DATA_LAST; i++)
+      pthread_mutex_init( share_locks + i, NULL);
+   share = curl_share_init( );
+   assert( share);
+   curl_share_setopt( share, CURLSHOPT_LOCKFUNC, lock_share);
+   curl_share_setopt( share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+   curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+   curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+   curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+   jitter_state = (uint32_t)time( NULL) ^ ((uint32_t)getpid( ) << 16);
+   if( !jitter_state)
+      jitter_state = 1;
+}
+
+CURL *url_fetch_new_handle( void)
+{
+   CURL *curl;
+
+   pthread_once( &init_once, init_url_fetch);
+   curl = curl_easy_init( );
+   assert( curl);
+   curl_easy_setopt( curl, CURLOPT_SHARE, share);
+   curl_easy_setopt( curl, CURLOPT_FOLLOWLOCATION, 1L);
+   curl_easy_setopt( curl, CURLOPT_TCP_KEEPALIVE, 1L);
+   curl_easy_setopt( curl, CURLOPT_CONNECTTIMEOUT, 30L);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+   curl_easy_setopt( curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+   curl_easy_setopt( curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+   return( curl);
+}
+
+CURL *url_fetch_default_handle( void)
+{
+   if( !default_handle)
+      default_handle = url_fetch_new_handle( );
+   return( default_handle);
+}
+
+void url_fetch_set_url( CURL *curl, const char *url)
+{
+   const char *replay = getenv( "URL_FETCH_REPLAY");
+   const char *tptr = strstr( url, "://");
+
+   if( replay && *replay && tptr)
+      {
+      const size_t len = strlen( replay) + strlen( tptr) + 2;
+      char *new_url = (char *)malloc( len);
+
+      assert( new_url);
+      snprintf( new_url, len, "%s/%s", replay, tptr + 3);
+      curl_easy_setopt( curl, CURLOPT_URL, new_url);
+      free( new_url);      /* libcurl has made its own copy */
+      }
+   else
+      curl_easy_setopt( curl, CURLOPT_URL, url);
+}
+
+bool url_fetch_is_transient( CURL *curl, const CURLcode res)
+{
+   long response_code = 0;
+
+   switch( res)
+      {
+      case CURLE_OK:
+         curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &response_code);
+         return( response_code == 408 || response_code == 429
+                     || (response_code >= 500 && response_code <= 599));
+      case CURLE_COULDNT_RESOLVE_HOST:
+      case CURLE_COULDNT_CONNECT:
+      case CURLE_OPERATION_TIMEDOUT:
+      case CURLE_SEND_ERROR:
+      case CURLE_RECV_ERROR:
+      case CURLE_GOT_NOTHING:
+      case CURLE_PARTIAL_FILE:
+      case CURLE_SSL_CONNECT_ERROR:
+      case CURLE_HTTP2:
+#if LIBCURL_VERSION_NUM >= 0x073100
+      case CURLE_HTTP2_STREAM:
+#endif
+         return( true);
+      default:
+         return( false);
+      }
+}
+
+/* 500 ms,  1 s,  2 s,  4 s... up to URL_FETCH_MAX_DELAY_MS,  with up to
+25% random jitter,  so that several cron jobs failing at once don't all
+come back at once.  The jitter comes from our own xorshift generator,
+seeded from the time and process ID,  so each process gets a different
+sequence;  rand() would be unseeded (the same in every process) and
+isn't thread-safe (my_wget's segments retry from separate threads). */
+
+static uint32_t jitter_rand( void)
+{
+   uint32_t rval;
+
+   pthread_once( &init_once, init_url_fetch);
+   pthread_mutex_lock( &jitter_lock);
+   jitter_state ^= jitter_state << 13;
+   jitter_state ^= jitter_state >> 17;
+   jitter_state ^= jitter_state << 5;
+   rval = jitter_state;
+   pthread_mutex_unlock( &jitter_lock);
+   return( rval);
+}
+
+long url_fetch_retry_delay_ms( const int attempt)
+{
+   long rval = URL_FETCH_BASE_DELAY_MS;
+   int i;
+
+   for( i = 0; i < attempt && rval < URL_FETCH_MAX_DELAY_MS; i++)
+      rval *= 2;
+   if( rval > URL_FETCH_MAX_DELAY_MS)
+      rval = URL_FETCH_MAX_DELAY_MS;
+   return( rval + (long)( jitter_rand( ) % (uint32_t)( rval / 4 + 1)));
+}
+
+void url_fetch_sleep_ms( const long ms)
+{
+   struct timespec t;
+
+   t.tv_sec = (time_t)( ms / 1000);
+   t.tv_nsec = (ms % 1000) * 1000000L;
+   nanosleep( &t, NULL);
+}
+
+CURLcode url_fetch_perform( CURL *curl, void (*reset)( void *context),
+                                    void *reset_context)
+{
+   CURLcode res;
+   int attempt = 0;
+
+   while( url_fetch_is_transient( curl, res = curl_easy_perform( curl))
+                  && attempt < URL_FETCH_MAX_RETRIES)
+      {
+      const long delay = url_fetch_retry_delay_ms( attempt++);
+      char *url = NULL;
+
+      curl_easy_getinfo( curl, CURLINFO_EFFECTIVE_URL, &url);
+      fprintf( stderr, "Transient error (%s) for %s;  retrying in %ld ms\n",
+                  (res ? curl_easy_strerror( res) : "server error"),
+                  (url ? url : "?"), delay);
+      url_fetch_sleep_ms( delay);
+      if( reset)
+         reset( reset_context);
+      }
+   if( !res && url_fetch_is_transient( curl, res))
+      res = CURLE_HTTP_RETURNED_ERROR;   /* out of retries on 5xx,  etc. */
+   return( res);
+}
+
+static size_t buff_write( char *ptr, size_t size, size_t nmemb, void *context)
+{
+   url_fetch_buff_t *b = (url_fetch_buff_t *)context;
+   size_t n_bytes = size * nmemb;
+
+   if( b->max_len && n_bytes > b->max_len - b->len)
+      return( 0);       /* would overflow;  abort transfer */
+   if( b->len + n_bytes + 1 > b->alloced)
+      {
+      b->alloced = (b->len + n_bytes + 1) * 2;
+      if( b->max_len && b->alloced > b->max_len + 1)
+         b->alloced = b->max_len + 1;
+      b->buff = (char *)realloc( b->buff, b->alloced);
+      assert( b->buff);
+      }
+   memcpy( b->buff + b->len, ptr, n_bytes);
+   b->len += n_bytes;
+   b->buff[b->len] = '\0';
+   return( n_bytes);
+}
+
+static void reset_buff( void *context)
+{
+   ((url_fetch_buff_t *)context)->len = 0;
+}
+
+/* Data is appended to 'buff' (which may be zeroed out,  in which case
+it will be allocated and should eventually be freed),  and is always
+followed by a '\0'.  If max_len is set,  exceeding it aborts the transfer
+with CURLE_WRITE_ERROR.  */
+
+CURLcode url_fetch_to_memory( const char *url, url_fetch_buff_t *buff)
+{
+   CURL *curl = url_fetch_default_handle( );
+
+   url_fetch_set_url( curl, url);
+   curl_easy_setopt( curl, CURLOPT_HTTPGET, 1L);
+   curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, buff_write);
+   curl_easy_setopt( curl, CURLOPT_WRITEDATA, buff);
+   buff->len = 0;
+   return( url_fetch_perform( curl, reset_buff, buff));
+}
+
+typedef struct
+{
+   FILE *ofile;
+   long start;
+} file_reset_t;
+
+static void reset_file( void *context)
+{
+   file_reset_t *r = (file_reset_t *)context;
+
+   if( r->start >= 0)
+      {
+      fflush( r->ofile);
+      fseek( r->ofile, r->start, SEEK_SET);
+      if( ftruncate( fileno( r->ofile), (off_t)r->start))
+         fprintf( stderr, "Couldn't discard partial download\n");
+      }
+}
+
+/* Data is written at the current position of 'ofile';  on a retry,  the
+file is truncated back to that point.  */
+
+CURLcode url_fetch_to_file( const char *url, FILE *ofile)
+{
+   CURL *curl = url_fetch_default_handle( );
+   file_reset_t r;
+
+   r.ofile = ofile;
+   r.start = ftell( ofile);
+   url_fetch_set_url( curl, url);
+   curl_easy_setopt( curl, CURLOPT_HTTPGET, 1L);
+   curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, fwrite);
+   curl_easy_setopt( curl, CURLOPT_WRITEDATA, ofile);
+   return( url_fetch_perform( curl, reset_file, &r));
+}
+
+void url_fetch_cleanup( void)
+{
+   if( default_handle)
+      curl_easy_cleanup( default_handle);
+   default_handle = NULL;
+   if( share)
+      curl_share_cleanup( share);
+   share = NULL;
+}
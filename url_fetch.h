@@ -0,0 +1,46 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <curl/curl.h>
+
+/* Shared libcurl fetching for grab_mpc,  grab_new,  mpecer,  my_wget,
+neocp,  and neocp2.  See 'url_fetch.c' for details.   */
+
+#define URL_FETCH_MAX_RETRIES          4
+#define URL_FETCH_BASE_DELAY_MS      500
+#define URL_FETCH_MAX_DELAY_MS     16000
+
+typedef struct
+{
+   char *buff;
+   size_t len, alloced;
+   size_t max_len;            /* zero = no limit */
+} url_fetch_buff_t;
+
+CURL *url_fetch_new_handle( void);
+CURL *url_fetch_default_handle( void);
+void url_fetch_set_url( CURL *curl, const char *url);
+CURLcode url_fetch_perform( CURL *curl, void (*reset)( void *context),
+                                    void *reset_context);
+bool url_fetch_is_transient( CURL *curl, const CURLcode res);
+long url_fetch_retry_delay_ms( const int attempt);
+void url_fetch_sleep_ms( const long ms);
+CURLcode url_fetch_to_memory( const char *url, url_fetch_buff_t *buff);
+CURLcode url_fetch_to_file( const char *url, FILE *ofile);
+void url_fetch_cleanup( void);